@@ -0,0 +1,85 @@
+//
+// alu.h
+// Specialized ALU kernels and lazily evaluated condition codes.
+//
+// Every ALU instruction stores its full 32-bit result in flags_result
+// instead of computing Z and V, which are only derived from it when bro or
+// a debugger actually reads them. Both flags are pure functions of that
+// result, so no operation tag needs to be kept alongside it.
+//
+// ALU_OPERATIONS lists every ALU opcode once; ALU_KERNELS expands it into an
+// imm/reg/mem kernel per opcode so no ALU instruction goes through a
+// function pointer or a mode switch at run time.
+//
+
+#ifndef NEOCORE_ALU_H
+#define NEOCORE_ALU_H
+
+#include "main.h"
+
+static inline bool get_z_flag(const CPUState *state) {
+    return state->flags_result == 0;
+}
+
+static inline bool get_v_flag(const CPUState *state) {
+    return state->flags_result > UINT16_MAX;
+}
+
+/* Set the flags directly, e.g. on reset. Z and V are never both set by an ALU result. */
+static inline void set_flags(CPUState *state, bool z_flag, bool v_flag) {
+    state->flags_result = z_flag ? 0 : v_flag ? UINT16_MAX + 1u : 1;
+}
+
+// X(name, NAME, expression over uint16_t a and uint32_t b). Shift counts wrap
+// at 32 like the host shift the original interpreter compiled to.
+#define ALU_OPERATIONS(X)                                                                 \
+    X(add, ADD, (uint32_t) a + b)                                                         \
+    X(sub, SUB, (int64_t) a - (int64_t) b < 0 ? 0 : (uint32_t) ((int64_t) a - (int64_t) b)) \
+    X(mul, MUL, (uint32_t) a * b)                                                         \
+    X(and, AND, (uint32_t) a & b)                                                         \
+    X(or,  OR,  (uint32_t) a | b)                                                         \
+    X(xor, XOR, (uint32_t) a ^ b)                                                         \
+    X(lsh, LSH, (uint32_t) a << (b & 31))                                                 \
+    X(rsh, RSH, (uint32_t) a >> (b & 31))
+
+// Mode 0: rd op #imm, mode 1: rn op rd, mode 2: rd op [normAddressing].
+#define ALU_KERNELS(name, NAME, expression)                                               \
+    static inline uint32_t alu_##name(uint16_t a, uint32_t b) {                           \
+        return (expression);                                                              \
+    }                                                                                     \
+    static inline void alu_##name##_imm(CPUState *state, uint8_t rd, uint16_t immediate) { \
+        uint32_t result = alu_##name(state->reg[rd], immediate);                          \
+        state->flags_result = result;                                                     \
+        state->reg[rd] = (uint16_t) result;                                               \
+    }                                                                                     \
+    static inline void alu_##name##_reg(CPUState *state, uint8_t rd, uint8_t rn) {        \
+        uint32_t result = alu_##name(state->reg[rn], state->reg[rd]);                     \
+        state->flags_result = result;                                                     \
+        state->reg[rd] = (uint16_t) result;                                               \
+    }                                                                                     \
+    static inline void alu_##name##_mem(CPUState *state, uint8_t rd, uint32_t address) {  \
+        uint32_t result = alu_##name(state->reg[rd], get_memory(state, address));         \
+        state->flags_result = result;                                                     \
+        state->reg[rd] = (uint16_t) result;                                               \
+    }
+
+ALU_OPERATIONS(ALU_KERNELS)
+
+#undef ALU_KERNELS
+
+/* Run an ALU instruction through the kernel specialized for its opcode and specifier. */
+static inline void alu_execute(CPUState *state, const DecodedInstruction *insn) {
+    switch (insn->handler) {
+#define ALU_CASES(name, NAME, expression)                                           \
+        case HANDLER_##NAME##_IMM: alu_##name##_imm(state, insn->rd, insn->immediate); break; \
+        case HANDLER_##NAME##_REG: alu_##name##_reg(state, insn->rd, insn->rn); break;        \
+        case HANDLER_##NAME##_MEM: alu_##name##_mem(state, insn->rd, insn->norm_address); break;
+        ALU_OPERATIONS(ALU_CASES)
+#undef ALU_CASES
+        default:
+            printf("Unsupported mode: %d\n", insn->specifier);
+            break;
+    }
+}
+
+#endif // NEOCORE_ALU_H
@@ -0,0 +1,36 @@
+//
+// aot_runtime.h
+// Helpers included by translation units generated by neocore_aot.
+//
+// ALU instructions use the kernels in alu.h directly. The stack helpers mirror
+// execute_decoded(); keep both in sync when instruction semantics change.
+//
+
+#ifndef NEOCORE_AOT_RUNTIME_H
+#define NEOCORE_AOT_RUNTIME_H
+
+#include "main.h"
+#include "alu.h"
+
+static inline void aot_pop16(CPUState *state, uint16_t *out) {
+    if (!popStack16(state, out)) {
+        fprintf(stderr, "Stack underflow while executing POP.\n");
+    }
+}
+
+/* Pop a return address for rts; on underflow execution continues at 'next_pc'. */
+static inline uint32_t aot_return(CPUState *state, uint32_t next_pc) {
+    uint32_t return_address;
+    if (!popStack32(state, &return_address)) {
+        fprintf(stderr, "Stack underflow while executing RTS.\n");
+        return next_pc;
+    }
+    return return_address;
+}
+
+/* True if a store since 'generation' rewrote cached code, possibly this block. */
+static inline bool aot_code_modified(const CPUState *state, uint32_t generation) {
+    return state->block_cache->generation != generation;
+}
+
+#endif // NEOCORE_AOT_RUNTIME_H
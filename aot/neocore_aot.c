@@ -0,0 +1,459 @@
+//
+// neocore_aot.c
+// Ahead-of-time recompiler: translates a NeoCore boot image to C.
+//
+// Starting from the entry point (and any extra entries given with -e), the
+// tool follows direct branches, fall-through edges and subroutine return
+// sites to find the reachable basic blocks. Each block becomes one C
+// function that runs the block and returns the next guest PC, using the
+// same block boundaries as block_cache.c. The generated file registers its
+// block table at startup; the block core then runs a translated function
+// whenever it enters one of these PCs and interprets everything else, so
+// indirect jumps, interrupts and code written at runtime keep working.
+//
+// hlt, wfi, invalid instructions and instructions naming registers past r15
+// are never translated: a block stops just before them and returns their PC
+// so the interpreter executes them.
+//
+
+#include "main.h"
+
+#include <errno.h>
+#include <inttypes.h>
+
+#define AOT_IMAGE_PADDING 16    // Longest instruction is 9 bytes; decode past the end safely
+
+typedef struct {
+    uint32_t start_pc;
+    uint32_t end_pc;
+    uint16_t op_count;
+    DecodedInstruction ops[BLOCK_MAX_OPS];
+} AotSourceBlock;
+
+typedef struct {
+    const uint8_t *image;       // Padded copy of the boot image
+    size_t image_size;
+    uint32_t load_address;
+
+    uint8_t *seen;              // One byte per image byte: block already queued
+    uint32_t *worklist;
+    size_t worklist_count;
+    size_t worklist_capacity;
+
+    AotSourceBlock *blocks;
+    size_t block_count;
+    size_t block_capacity;
+} AotTranslator;
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *result = realloc(ptr, size);
+    if (!result) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+static bool in_image(const AotTranslator *t, uint32_t pc) {
+    return pc >= t->load_address && (uint64_t) pc < (uint64_t) t->load_address + t->image_size;
+}
+
+static void queue_block(AotTranslator *t, uint32_t pc) {
+    if (!in_image(t, pc) || t->seen[pc - t->load_address]) {
+        return;
+    }
+    t->seen[pc - t->load_address] = 1;
+    if (t->worklist_count == t->worklist_capacity) {
+        t->worklist_capacity = t->worklist_capacity ? t->worklist_capacity * 2 : 64;
+        t->worklist = xrealloc(t->worklist, t->worklist_capacity * sizeof(uint32_t));
+    }
+    t->worklist[t->worklist_count++] = pc;
+}
+
+/* Same terminator set as block_cache.c, so translated blocks never outgrow cached ones. */
+static bool is_block_terminator(uint8_t opcode) {
+    switch (opcode) {
+        case OP_B:
+        case OP_BE:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BGT:
+        case OP_BRO:
+        case OP_JSR:
+        case OP_RTS:
+        case OP_HLT:
+        case OP_WFI:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* Only the register fields each form actually uses are range-checked. */
+static bool is_translatable(const DecodedInstruction *insn) {
+    uint8_t handler = insn->handler;
+    if (handler >= HANDLER_ADD_IMM && handler <= HANDLER_RSH_MEM) {
+        bool register_form = (handler - HANDLER_ADD_IMM) % 3 == 1;
+        return insn->rd < 16 && (!register_form || insn->rn < 16);
+    }
+    switch (handler) {
+        case HANDLER_HLT:
+        case HANDLER_WFI:
+        case HANDLER_INVALID:
+            return false;
+        case HANDLER_MOV_IMM:
+        case HANDLER_PSH:
+        case HANDLER_POP:
+            return insn->rd < 16;
+        case HANDLER_MOV_IMM32:
+        case HANDLER_MOV_REG:
+        case HANDLER_BE:
+        case HANDLER_BNE:
+        case HANDLER_BLT:
+        case HANDLER_BGT:
+            return insn->rd < 16 && insn->rn < 16;
+        case HANDLER_UMULL:
+        case HANDLER_SMULL:
+            return insn->rd < 16 && insn->rn1 < 16 && insn->mull_rn < 16;
+        default:
+            return true;
+    }
+}
+
+/* Decode one block at 'pc' and queue its successors. */
+static void translate_block(AotTranslator *t, uint32_t pc) {
+    AotSourceBlock block = { .start_pc = pc, .op_count = 0 };
+    uint32_t cursor = pc;
+    bool ends_in_terminator = false;
+
+    while (block.op_count < BLOCK_MAX_OPS && in_image(t, cursor)) {
+        DecodedInstruction insn;
+        decode_instruction(&t->image[cursor - t->load_address], &insn);
+        if (!is_translatable(&insn)) {
+            if (insn.handler == HANDLER_WFI) {
+                queue_block(t, cursor + insn.length);
+            }
+            break;
+        }
+        block.ops[block.op_count++] = insn;
+        cursor += insn.length;
+        if (is_block_terminator(insn.opcode)) {
+            ends_in_terminator = true;
+            break;
+        }
+    }
+    block.end_pc = cursor;
+    if (block.op_count == 0) {
+        return;  // Starts with an instruction left to the interpreter
+    }
+
+    const DecodedInstruction *last = &block.ops[block.op_count - 1];
+    if (!ends_in_terminator) {
+        queue_block(t, cursor);
+    } else {
+        switch (last->opcode) {
+            case OP_BE:
+            case OP_BNE:
+            case OP_BLT:
+            case OP_BGT:
+            case OP_BRO:
+                queue_block(t, last->label);
+                queue_block(t, cursor);
+                break;
+            case OP_B:
+                queue_block(t, last->label);
+                break;
+            case OP_JSR:
+                queue_block(t, last->label);
+                queue_block(t, cursor);  // Where the matching rts lands
+                break;
+            default:
+                break;
+        }
+    }
+
+    if (t->block_count == t->block_capacity) {
+        t->block_capacity = t->block_capacity ? t->block_capacity * 2 : 64;
+        t->blocks = xrealloc(t->blocks, t->block_capacity * sizeof(AotSourceBlock));
+    }
+    t->blocks[t->block_count++] = block;
+}
+
+static int compare_start_pc(const void *a, const void *b) {
+    const AotSourceBlock *block_a = a;
+    const AotSourceBlock *block_b = b;
+    if (block_a->start_pc == block_b->start_pc) return 0;
+    return block_a->start_pc < block_b->start_pc ? -1 : 1;
+}
+
+static const char *const alu_names[] = { "add", "sub", "mul", "and", "or", "xor", "lsh", "rsh" };
+
+/* Call the alu.h kernel specialized for this opcode and specifier. */
+static void emit_alu(FILE *out, const DecodedInstruction *insn) {
+    const char *name = alu_names[(insn->handler - HANDLER_ADD_IMM) / 3];
+    switch ((insn->handler - HANDLER_ADD_IMM) % 3) {
+        case 0:
+            fprintf(out, "    alu_%s_imm(state, %u, 0x%04xu);\n", name, insn->rd, insn->immediate);
+            break;
+        case 1:
+            fprintf(out, "    alu_%s_reg(state, %u, %u);\n", name, insn->rd, insn->rn);
+            break;
+        default:
+            fprintf(out, "    alu_%s_mem(state, %u, 0x%08" PRIx32 "u);\n", name, insn->rd, insn->norm_address);
+            break;
+    }
+}
+
+/* Return to the dispatcher if a store just rewrote code. */
+static void emit_code_check(FILE *out, uint32_t next_pc) {
+    fprintf(out, "    if (aot_code_modified(state, generation)) return 0x%08" PRIx32 "u;\n", next_pc);
+}
+
+static bool block_writes_memory(const AotSourceBlock *block) {
+    for (uint16_t i = 0; i < block->op_count; i++) {
+        uint8_t handler = block->ops[i].handler;
+        if (handler == HANDLER_MOV_MEMORY || handler == HANDLER_PSH) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* True if the block's C code indexes the local 'reg'; ALU kernels take 'state' instead. */
+static bool block_uses_registers(const AotSourceBlock *block) {
+    for (uint16_t i = 0; i < block->op_count; i++) {
+        uint8_t handler = block->ops[i].handler;
+        if (handler >= HANDLER_ADD_IMM && handler <= HANDLER_RSH_MEM) {
+            continue;
+        }
+        switch (handler) {
+            case HANDLER_NOP:
+            case HANDLER_B:
+            case HANDLER_BRO:
+            case HANDLER_JSR:
+            case HANDLER_RTS:
+            case HANDLER_ENI:
+            case HANDLER_DSI:
+            case HANDLER_MOV_MEMORY:
+                break;
+            default:
+                return true;
+        }
+    }
+    return false;
+}
+
+static void emit_block(FILE *out, const AotSourceBlock *block) {
+    fprintf(out, "static uint32_t aot_block_%08" PRIx32 "(CPUState *state) {\n", block->start_pc);
+    if (block_uses_registers(block)) {
+        fprintf(out, "    uint16_t *reg = state->reg;\n");
+    }
+    if (block_writes_memory(block)) {
+        fprintf(out, "    const uint32_t generation = state->block_cache->generation;\n");
+    }
+
+    uint32_t pc = block->start_pc;
+    bool returned = false;
+    for (uint16_t i = 0; i < block->op_count; i++) {
+        const DecodedInstruction *insn = &block->ops[i];
+        uint32_t next_pc = pc + insn->length;
+        fprintf(out, "    // 0x%08" PRIx32 ": %s\n", pc, handler_name(insn->handler));
+
+        switch (insn->handler) {
+            case HANDLER_NOP:
+                break;
+            case HANDLER_MOV_IMM:
+                fprintf(out, "    reg[%u] = 0x%04xu;\n", insn->rd, insn->immediate);
+                break;
+            case HANDLER_MOV_IMM32:
+                fprintf(out, "    reg[%u] = 0x%04" PRIx32 "u;\n", insn->rd, (insn->offset >> 16) & 0xFFFF);
+                fprintf(out, "    reg[%u] = 0x%04" PRIx32 "u;\n", insn->rn, insn->offset & 0xFFFF);
+                break;
+            case HANDLER_MOV_REG:
+                fprintf(out, "    reg[%u] = reg[%u];\n", insn->rn, insn->rd);
+                break;
+            case HANDLER_MOV_MEMORY:
+                fprintf(out, "    mov(state, %u, %u, %u, 0x%04xu, 0x%08" PRIx32 "u, 0x%08" PRIx32 "u, 0x%02x);\n",
+                        insn->rd, insn->rn, insn->rn1, insn->immediate,
+                        insn->norm_address, insn->offset, insn->specifier);
+                emit_code_check(out, next_pc);
+                break;
+            case HANDLER_B:
+                fprintf(out, "    return 0x%08" PRIx32 "u;\n", insn->label);
+                returned = true;
+                break;
+            case HANDLER_BE:
+            case HANDLER_BNE:
+            case HANDLER_BLT:
+            case HANDLER_BGT: {
+                static const char *const compare[] = { "==", "!=", "<", ">" };
+                fprintf(out, "    if (reg[%u] %s reg[%u]) return 0x%08" PRIx32 "u;\n",
+                        insn->rd, compare[insn->handler - HANDLER_BE], insn->rn, insn->label);
+                break;
+            }
+            case HANDLER_BRO:
+                fprintf(out, "    if (get_v_flag(state)) return 0x%08" PRIx32 "u;\n", insn->label);
+                break;
+            case HANDLER_UMULL:
+            case HANDLER_SMULL:
+                fprintf(out, "    %s(&reg[%u], &reg[%u], &reg[%u]);\n",
+                        insn->handler == HANDLER_UMULL ? "umull" : "smull",
+                        insn->rd, insn->rn1, insn->mull_rn);
+                break;
+            case HANDLER_PSH:
+                fprintf(out, "    pushStack16(state, reg[%u]);\n", insn->rd);
+                emit_code_check(out, next_pc);
+                break;
+            case HANDLER_POP:
+                fprintf(out, "    aot_pop16(state, &reg[%u]);\n", insn->rd);
+                break;
+            case HANDLER_JSR:
+                fprintf(out, "    pushStack32(state, 0x%08" PRIx32 "u);\n", next_pc);
+                fprintf(out, "    return 0x%08" PRIx32 "u;\n", insn->label);
+                returned = true;
+                break;
+            case HANDLER_RTS:
+                fprintf(out, "    return aot_return(state, 0x%08" PRIx32 "u);\n", next_pc);
+                returned = true;
+                break;
+            case HANDLER_ENI:
+                fprintf(out, "    state->enable_mask_interrupts = true;\n");
+                break;
+            case HANDLER_DSI:
+                fprintf(out, "    state->enable_mask_interrupts = false;\n");
+                break;
+            default:
+                emit_alu(out, insn);
+                break;
+        }
+        pc = next_pc;
+    }
+    if (!returned) {
+        fprintf(out, "    return 0x%08" PRIx32 "u;\n", block->end_pc);
+    }
+    fprintf(out, "}\n\n");
+}
+
+static void emit_translation_unit(FILE *out, const AotTranslator *t, const char *image_name, uint64_t hash) {
+    fprintf(out, "// Generated by neocore_aot from %s. Do not edit.\n\n", image_name);
+    fprintf(out, "#include \"main.h\"\n#include \"aot_runtime.h\"\n\n");
+
+    for (size_t i = 0; i < t->block_count; i++) {
+        emit_block(out, &t->blocks[i]);
+    }
+
+    fprintf(out, "static const AotBlock aot_blocks[] = {\n");
+    for (size_t i = 0; i < t->block_count; i++) {
+        fprintf(out, "    { 0x%08" PRIx32 "u, 0x%08" PRIx32 "u, aot_block_%08" PRIx32 " },\n",
+                t->blocks[i].start_pc, t->blocks[i].end_pc, t->blocks[i].start_pc);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const AotImage aot_image = {\n");
+    fprintf(out, "    .image_hash   = 0x%016" PRIx64 "ULL,\n", hash);
+    fprintf(out, "    .load_address = 0x%08" PRIx32 "u,\n", t->load_address);
+    fprintf(out, "    .image_size   = %zuu,\n", t->image_size);
+    fprintf(out, "    .blocks       = aot_blocks,\n");
+    fprintf(out, "    .block_count  = sizeof(aot_blocks) / sizeof(aot_blocks[0]),\n");
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "__attribute__((constructor)) static void aot_register(void) {\n");
+    fprintf(out, "    register_aot_image(&aot_image);\n");
+    fprintf(out, "}\n");
+}
+
+static uint32_t parse_address(const char *text) {
+    char *end;
+    errno = 0;
+    unsigned long value = strtoul(text, &end, 0);
+    if (errno != 0 || end == text || *end != '\0' || value > UINT32_MAX) {
+        fprintf(stderr, "Invalid address: %s\n", text);
+        exit(EXIT_FAILURE);
+    }
+    return (uint32_t) value;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s -p program_file [-o output.c] [-b load_address] [-e entry_pc]...\n", program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    const char *program_file = NULL;
+    const char *output_file = NULL;
+    uint32_t load_address = 0;
+    uint32_t entries[64];
+    size_t entry_count = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:o:b:e:")) != -1) {
+        switch (opt) {
+            case 'p':
+                program_file = optarg;
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'b':
+                load_address = parse_address(optarg);
+                break;
+            case 'e':
+                if (entry_count == sizeof(entries) / sizeof(entries[0])) {
+                    fprintf(stderr, "Too many entry points.\n");
+                    exit(EXIT_FAILURE);
+                }
+                entries[entry_count++] = parse_address(optarg);
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (!program_file) {
+        usage(argv[0]);
+    }
+
+    ProgramImage program;
+    if (!load_program(program_file, &program) || program.size == 0) {
+        fprintf(stderr, "Could not read program %s\n", program_file);
+        return EXIT_FAILURE;
+    }
+
+    size_t program_size = program.size;
+    AotTranslator t = { .image_size = program_size, .load_address = load_address };
+    uint8_t *padded = calloc(program_size + AOT_IMAGE_PADDING, 1);
+    t.seen = calloc(program_size, 1);
+    if (!padded || !t.seen) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+    memcpy(padded, program.data, program_size);
+    unload_program(&program);
+    t.image = padded;
+
+    // The CPU starts at the beginning of the boot sector.
+    queue_block(&t, load_address);
+    for (size_t i = 0; i < entry_count; i++) {
+        queue_block(&t, entries[i]);
+    }
+    while (t.worklist_count > 0) {
+        translate_block(&t, t.worklist[--t.worklist_count]);
+    }
+    qsort(t.blocks, t.block_count, sizeof(AotSourceBlock), compare_start_pc);
+
+    FILE *out = output_file ? fopen(output_file, "w") : stdout;
+    if (!out) {
+        perror("Failed to open output file");
+        return EXIT_FAILURE;
+    }
+    emit_translation_unit(out, &t, program_file, hash_bytes(padded, program_size));
+    if (output_file) {
+        fclose(out);
+    }
+    fprintf(stderr, "Translated %zu blocks from %s (%zu bytes)\n", t.block_count, program_file, program_size);
+
+    free(t.blocks);
+    free(t.worklist);
+    free(t.seen);
+    free(padded);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+//
+// aot_runtime.c
+// Runtime support for blocks translated ahead of time by neocore_aot.
+//
+// A build that links a generated translation unit registers one AotImage
+// before main() runs. When the boot image loaded at runtime hashes to the
+// same value, the block core runs the translated functions instead of
+// interpreting those blocks. Anything the translator did not see (indirect
+// targets it could not discover, code written at runtime, pages modified
+// since load) is still handled by the interpreter.
+//
+
+#include "main.h"
+
+static const AotImage *registered_image = NULL;
+
+/* Called from the constructor in a generated translation unit. */
+void register_aot_image(const AotImage *image) {
+    registered_image = image;
+}
+
+const AotImage* registered_aot_image(void) {
+    return registered_image;
+}
+
+/**
+ * Use the registered translation if the boot image is the exact image it was
+ * built from and is loaded at the same address.
+ */
+void attach_aot_image(CPUState *state) {
+    const BootImage *image = &state->boot_image;
+    state->aot = NULL;
+    if (!registered_image || image->size == 0) {
+        return;
+    }
+    if (registered_image->load_address != image->load_address ||
+        registered_image->image_size != image->size ||
+        registered_image->image_hash != image->hash) {
+        printf("Loaded image does not match the built-in translation; interpreting.\n");
+        return;
+    }
+    state->aot = registered_image;
+    printf("Using %zu ahead-of-time translated blocks.\n", registered_image->block_count);
+}
+
+void detach_aot_image(CPUState *state) {
+    state->aot = NULL;
+}
+
+/**
+ * Return the translated function for the block [pc, end_pc), or NULL if there
+ * is none or any of its bytes were overwritten since the image loaded. The
+ * translator stops before instructions it leaves to the interpreter, so a
+ * translation that ends elsewhere covers a different block and is not used.
+ */
+NativeBlockFn lookup_aot_block(CPUState *state, uint32_t pc, uint32_t end_pc) {
+    const AotImage *image = state->aot;
+    if (!image) {
+        return NULL;
+    }
+
+    size_t low = 0, high = image->block_count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (image->blocks[mid].start_pc < pc) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == image->block_count || image->blocks[low].start_pc != pc) {
+        return NULL;
+    }
+
+    const AotBlock *block = &image->blocks[low];
+    if (block->end_pc != end_pc) {
+        return NULL;
+    }
+    return is_boot_image_range_clean(state, block->start_pc, block->end_pc) ? block->code : NULL;
+}
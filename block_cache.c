@@ -0,0 +1,583 @@
+//
+// block_cache.c
+// Basic-block translation cache with block chaining.
+//
+// A basic block is a run of decoded instructions ending at the first
+// control-flow instruction (b/be/bne/blt/bgt/bro/jsr/rts/hlt/wfi) or after
+// BLOCK_MAX_OPS instructions. Each block remembers the successor reached
+// through its taken and fall-through exits, so hot loops go from block to
+// block without consulting the hash table.
+//
+
+#include "main.h"
+
+#define BLOCK_PAGE_SHIFT 12
+#define BLOCK_CODE_WORDS (PAGE_SIZE / 64)  // 64-bit words of one page's code bitmap
+#define BLOCK_MAX_BYTES (BLOCK_MAX_OPS * MAX_INSTRUCTION_LENGTH) // Longest span a block can cover
+
+static inline uint32_t block_hash(uint32_t pc) {
+    return (pc ^ (pc >> BLOCK_PAGE_SHIFT)) & (BLOCK_CACHE_BUCKETS - 1);
+}
+
+/* The code bitmap of 'page', or NULL if no block has covered it and 'allocate' is false. */
+static uint64_t* code_bitmap(BlockCache *cache, uint32_t page, bool allocate) {
+    BlockCodeLeaf **leaf = &cache->code_bytes[page >> PAGE_TABLE_LEAF_BITS];
+    if (!*leaf) {
+        if (!allocate) {
+            return NULL;
+        }
+        *leaf = calloc(1, sizeof(BlockCodeLeaf));
+        if (!*leaf) {
+            fprintf(stderr, "Memory allocation failed for block code bitmap.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    uint64_t **bitmap = &(*leaf)->pages[page & (PAGE_TABLE_LEAF_ENTRIES - 1)];
+    if (!*bitmap && allocate) {
+        *bitmap = calloc(BLOCK_CODE_WORDS, sizeof(uint64_t));
+        if (!*bitmap) {
+            fprintf(stderr, "Memory allocation failed for block code bitmap.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return *bitmap;
+}
+
+typedef enum {
+    CODE_BITS_TEST,
+    CODE_BITS_SET,
+    CODE_BITS_CLEAR,
+} CodeBitsOp;
+
+/**
+ * Test, set or clear the code bits of the bytes [start, end). Returns true if
+ * any of them was set beforehand.
+ */
+static bool update_code_bits(BlockCache *cache, uint32_t start, uint64_t end, CodeBitsOp op) {
+    bool found = false;
+    uint64_t address = start;
+    while (address < end) {
+        uint32_t page = (uint32_t) (address >> BLOCK_PAGE_SHIFT);
+        uint64_t page_end = (uint64_t) (page + 1ULL) << BLOCK_PAGE_SHIFT;
+        uint64_t stop = end < page_end ? end : page_end;
+        uint64_t *bitmap = code_bitmap(cache, page, op == CODE_BITS_SET);
+        for (; bitmap && address < stop; address++) {
+            uint32_t offset = (uint32_t) address & (PAGE_SIZE - 1);
+            uint64_t bit = 1ULL << (offset & 63);
+            found |= (bitmap[offset >> 6] & bit) != 0;
+            if (op == CODE_BITS_SET) {
+                bitmap[offset >> 6] |= bit;
+            } else if (op == CODE_BITS_CLEAR) {
+                bitmap[offset >> 6] &= ~bit;
+            } else if (found) {
+                return true;
+            }
+        }
+        address = stop;
+    }
+    return found;
+}
+
+static void free_code_bitmaps(BlockCache *cache) {
+    for (uint32_t dir = 0; dir < PAGE_DIRECTORY_ENTRIES; dir++) {
+        BlockCodeLeaf *leaf = cache->code_bytes[dir];
+        if (!leaf) continue;
+        for (uint32_t i = 0; i < PAGE_TABLE_LEAF_ENTRIES; i++) {
+            free(leaf->pages[i]);
+        }
+        free(leaf);
+        cache->code_bytes[dir] = NULL;
+    }
+}
+
+static bool is_block_terminator(uint8_t opcode) {
+    switch (opcode) {
+        case OP_B:
+        case OP_BE:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BGT:
+        case OP_BRO:
+        case OP_JSR:
+        case OP_RTS:
+        case OP_HLT:
+        case OP_WFI:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/* True for terminators whose taken target is encoded in the instruction. */
+static bool has_direct_target(uint8_t opcode) {
+    switch (opcode) {
+        case OP_B:
+        case OP_BE:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BGT:
+        case OP_BRO:
+        case OP_JSR:
+            return true;
+        default:
+            return false;
+    }
+}
+
+BlockCache* create_block_cache(void) {
+    BlockCache *cache = calloc(1, sizeof(BlockCache));
+    if (!cache) {
+        fprintf(stderr, "Failed to allocate memory for BlockCache.\n");
+        exit(EXIT_FAILURE);
+    }
+    return cache;
+}
+
+/* Return the cached block starting at 'pc' without building one on a miss. */
+BasicBlock* find_block(const BlockCache *cache, uint32_t pc) {
+    for (BasicBlock *block = cache->buckets[block_hash(pc)]; block; block = block->hash_next) {
+        if (block->start_pc == pc) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Add a block made of the 'op_count' instructions in 'ops', which start at
+ * 'pc', to the cache. The caller makes sure no block starts at 'pc' yet.
+ */
+BasicBlock* install_block(CPUState *state, uint32_t pc, const DecodedInstruction *ops, uint16_t op_count) {
+    BlockCache *cache = state->block_cache;
+    BasicBlock *block = malloc(sizeof(BasicBlock) + op_count * sizeof(DecodedInstruction));
+    if (!block) {
+        fprintf(stderr, "Memory allocation failed for BasicBlock.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t end_pc = pc;
+    uint32_t cycles = 0;
+    for (uint16_t i = 0; i < op_count; i++) {
+        end_pc += ops[i].length;
+        cycles += ops[i].cycles;
+    }
+    memcpy(block->ops, ops, op_count * sizeof(DecodedInstruction));
+    fuse_block_ops(block->ops, op_count);
+    block->op_count    = op_count;
+    block->start_pc    = pc;
+    block->end_pc      = end_pc;
+    block->exec_count  = 0;
+    block->cycles      = cycles;
+    block->jit_code    = NULL;
+    block->jit_failed  = false;
+    block->aot_code    = lookup_aot_block(state, pc, end_pc);
+    block->taken       = NULL;
+    block->fallthrough = NULL;
+    block->chained_from = NULL;
+    block->chained_from_count = 0;
+    block->chained_from_capacity = 0;
+
+    const DecodedInstruction *last = &block->ops[op_count - 1];
+    block->has_taken_exit = has_direct_target(last->opcode);
+    block->taken_pc = block->has_taken_exit ? last->label : 0;
+    block->idle_loop = is_idle_loop(block);
+
+    uint32_t bucket = block_hash(pc);
+    block->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = block;
+    cache->block_count++;
+    update_code_bits(cache, pc, (uint64_t) pc + (end_pc - pc), CODE_BITS_SET);
+    return block;
+}
+
+/**
+ * Return the cached block starting at 'pc', decoding it on a miss.
+ * Returns NULL if the PC points at unmapped memory.
+ */
+BasicBlock* lookup_block(CPUState *state, uint32_t pc) {
+    BasicBlock *block = find_block(state->block_cache, pc);
+    if (block) {
+        return block;
+    }
+
+    DecodedInstruction ops[BLOCK_MAX_OPS];
+    uint16_t count = 0;
+    uint32_t cursor = pc;
+    while (count < BLOCK_MAX_OPS) {
+        const DecodedInstruction *insn = fetch_decoded(state, cursor);
+        if (!insn) {
+            break;  // The next block will fault on this address.
+        }
+        ops[count++] = *insn;
+        cursor += insn->length;
+        if (is_block_terminator(insn->opcode)) {
+            break;
+        }
+    }
+    if (count == 0) {
+        return NULL;
+    }
+    return install_block(state, pc, ops, count);
+}
+
+/* Record that 'from' has a chain link to 'block'. */
+static void add_chained_from(BasicBlock *block, BasicBlock *from) {
+    if (block->chained_from_count == block->chained_from_capacity) {
+        uint32_t capacity = block->chained_from_capacity ? block->chained_from_capacity * 2 : 4;
+        BasicBlock **grown = realloc(block->chained_from, capacity * sizeof(BasicBlock *));
+        if (!grown) {
+            fprintf(stderr, "Memory allocation failed for block chain links.\n");
+            exit(EXIT_FAILURE);
+        }
+        block->chained_from = grown;
+        block->chained_from_capacity = capacity;
+    }
+    block->chained_from[block->chained_from_count++] = from;
+}
+
+/* Forget the links from 'from' to 'block'; a block may reach another through both exits. */
+static void remove_chained_from(BasicBlock *block, BasicBlock *from) {
+    for (uint32_t i = 0; i < block->chained_from_count; ) {
+        if (block->chained_from[i] == from) {
+            block->chained_from[i] = block->chained_from[--block->chained_from_count];
+        } else {
+            i++;
+        }
+    }
+}
+
+/* Link the taken or fall-through exit of 'from' to 'to', if there is one. */
+void chain_block(BasicBlock *from, bool taken, BasicBlock *to) {
+    if (!to) {
+        return;
+    }
+    if (taken) {
+        from->taken = to;
+    } else {
+        from->fallthrough = to;
+    }
+    add_chained_from(to, from);
+}
+
+/**
+ * Unhook 'block' from the hash table and from the blocks chained to and from
+ * it, and queue it on the retired list. Other chain links are left alone.
+ */
+static void retire_block(BlockCache *cache, BasicBlock *block) {
+    BasicBlock **link = &cache->buckets[block_hash(block->start_pc)];
+    while (*link != block) {
+        link = &(*link)->hash_next;
+    }
+    *link = block->hash_next;
+
+    for (uint32_t i = 0; i < block->chained_from_count; i++) {
+        BasicBlock *from = block->chained_from[i];
+        if (from->taken == block) from->taken = NULL;
+        if (from->fallthrough == block) from->fallthrough = NULL;
+    }
+    block->chained_from_count = 0;
+    if (block->taken) remove_chained_from(block->taken, block);
+    if (block->fallthrough) remove_chained_from(block->fallthrough, block);
+    block->taken = NULL;
+    block->fallthrough = NULL;
+
+    block->hash_next = cache->retired;
+    cache->retired = block;
+    cache->block_count--;
+}
+
+static inline bool block_overlaps(const BasicBlock *block, uint32_t address, uint64_t end) {
+    return block->start_pc < end && (uint64_t) block->start_pc + (block->end_pc - block->start_pc) > address;
+}
+
+/**
+ * Invalidate the blocks holding any byte of the write [address, address + length).
+ * A bitmap of the bytes covered by blocks makes writes next to code, such as
+ * data kept in the boot sector, cost a bit test. Blocks are only retired
+ * here; the executor frees them once it is no longer running any of their
+ * instructions.
+ */
+void invalidate_block_range(CPUState *state, uint32_t address, size_t length) {
+    BlockCache *cache = state->block_cache;
+    if (!cache || length == 0) {
+        return;
+    }
+    uint64_t end = (uint64_t) address + length;
+    if (!update_code_bits(cache, address, end, CODE_BITS_TEST)) {
+        return;
+    }
+
+    bool retired_any = false;
+    uint64_t first_pc = address >= BLOCK_MAX_BYTES - 1 ? address - (BLOCK_MAX_BYTES - 1) : 0;
+    if (end - first_pc <= BLOCK_CACHE_BUCKETS) {
+        // Probe every PC a block reaching the write could start at.
+        for (uint64_t pc = first_pc; pc < end; pc++) {
+            BasicBlock *block = find_block(cache, (uint32_t) pc);
+            if (block && block_overlaps(block, address, end)) {
+                retire_block(cache, block);
+                retired_any = true;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < BLOCK_CACHE_BUCKETS; i++) {
+            BasicBlock *next;
+            for (BasicBlock *block = cache->buckets[i]; block; block = next) {
+                next = block->hash_next;
+                if (block_overlaps(block, address, end)) {
+                    retire_block(cache, block);
+                    retired_any = true;
+                }
+            }
+        }
+    }
+
+    // No block holds these bytes any more.
+    update_code_bits(cache, address, end, CODE_BITS_CLEAR);
+    if (retired_any) {
+        cache->generation++;
+    }
+}
+
+static void free_block(BasicBlock *block) {
+    free(block->chained_from);
+    free(block);
+}
+
+static void reclaim_retired_blocks(BlockCache *cache) {
+    while (cache->retired) {
+        BasicBlock *next = cache->retired->hash_next;
+        free_block(cache->retired);
+        cache->retired = next;
+    }
+}
+
+/* Forget every block, e.g. after a new program is loaded. */
+void flush_block_cache(CPUState *state) {
+    BlockCache *cache = state->block_cache;
+    if (!cache) {
+        return;
+    }
+    for (size_t i = 0; i < BLOCK_CACHE_BUCKETS; i++) {
+        BasicBlock *block = cache->buckets[i];
+        while (block) {
+            BasicBlock *next = block->hash_next;
+            free_block(block);
+            block = next;
+        }
+        cache->buckets[i] = NULL;
+    }
+    reclaim_retired_blocks(cache);
+    free_code_bitmaps(cache);
+    cache->block_count = 0;
+    cache->generation++;
+}
+
+void free_block_cache(BlockCache *cache) {
+    if (!cache) {
+        return;
+    }
+    for (size_t i = 0; i < BLOCK_CACHE_BUCKETS; i++) {
+        BasicBlock *block = cache->buckets[i];
+        while (block) {
+            BasicBlock *next = block->hash_next;
+            free_block(block);
+            block = next;
+        }
+    }
+    reclaim_retired_blocks(cache);
+    free_code_bitmaps(cache);
+    free(cache);
+}
+
+/* Follow (and lazily create) the chain link for the exit that produced 'pc'. */
+static inline BasicBlock* next_block(CPUState *state, BasicBlock *block, uint32_t pc) {
+    if (block->has_taken_exit && pc == block->taken_pc) {
+        if (!block->taken) {
+            chain_block(block, true, lookup_block(state, pc));
+        }
+        return block->taken;
+    }
+    if (pc == block->end_pc) {
+        if (!block->fallthrough) {
+            chain_block(block, false, lookup_block(state, pc));
+        }
+        return block->fallthrough;
+    }
+    return lookup_block(state, pc);  // Indirect exit (rts) or interrupted block
+}
+
+/**
+ * Interpret 'block' one instruction at a time, reaching a sync point after
+ * each, so a run limit that falls inside the block stops on the exact
+ * instruction. Returns STOP_NONE if the whole block ran (or it rewrote code).
+ */
+static StopReason step_block(CPUState *state, const BasicBlock *block) {
+    uint32_t generation = state->block_cache->generation;
+    for (uint16_t i = 0; i < block->op_count; i++) {
+        state->cycles += block->ops[i].cycles;
+        state->instructions++;
+        if (execute_decoded(state, &block->ops[i])) {
+            return STOP_HALT;
+        }
+        if (state->cycles >= __atomic_load_n(&state->clock.next_sync, __ATOMIC_RELAXED)) {
+            StopReason reason = clock_sync(state);
+            if (reason != STOP_NONE) {
+                return reason;
+            }
+        }
+        if (state->block_cache->generation != generation) {
+            break;
+        }
+    }
+    return STOP_NONE;
+}
+
+/**
+ * Take back the charge for ops 'first' onwards of 'block', which did not run
+ * because an earlier op rewrote code.
+ */
+static void refund_ops(CPUState *state, const BasicBlock *block, uint16_t first) {
+    for (uint16_t i = first; i < block->op_count; i++) {
+        state->cycles -= block->ops[i].cycles;
+        state->instructions--;
+    }
+}
+
+/* Index of the op of 'block' that starts at 'pc', or op_count if none after the first does. */
+static uint16_t op_index_at(const BasicBlock *block, uint32_t pc) {
+    uint32_t cursor = block->start_pc;
+    for (uint16_t i = 0; i < block->op_count; i++) {
+        if (i > 0 && cursor == pc) {
+            return i;
+        }
+        cursor += block->ops[i].length;
+    }
+    return block->op_count;
+}
+
+/**
+ * Run the CPU one basic block at a time until it halts, faults, is asked to
+ * stop or reaches a run limit.
+ * Interrupts are taken and the clock is paced between blocks, each of which
+ * is charged its full cycle count on entry; the ops a block skips by
+ * rewriting code are refunded when it exits. Blocks are run from their
+ * ahead-of-time translation when there is one, then from JIT code once hot,
+ * and are interpreted otherwise by run_block_ops().
+ */
+StopReason run_blocks(CPUState *state) {
+    BlockCache *cache = state->block_cache;
+    BasicBlock *block = NULL;
+
+    for (;;) {
+        if (__atomic_load_n(&state->i_queue->count, __ATOMIC_RELAXED) != 0 &&
+            state->enable_mask_interrupts) {
+            service_pending_interrupt(state);
+            block = NULL;
+        }
+        if (cache->retired) {
+            // Nothing retired is referenced past this point.
+            block = NULL;
+            reclaim_retired_blocks(cache);
+        }
+        if (!block) {
+            block = lookup_block(state, *(state->pc));
+            if (!block) {
+                fprintf(stderr, "Invalid memory access at PC address 0x%08x\n", *(state->pc));
+                return STOP_FAULT;
+            }
+        }
+
+        block->exec_count++;
+        uint64_t next_sync = __atomic_load_n(&state->clock.next_sync, __ATOMIC_RELAXED);
+        if (state->cycles + block->cycles >= next_sync &&
+            (state->instruction_limit || state->cycle_limit)) {
+            // A run limit may fall inside this block.
+            uint32_t generation = cache->generation;
+            StopReason reason = step_block(state, block);
+            if (reason != STOP_NONE) {
+                return reason;
+            }
+            block = cache->generation == generation ? next_block(state, block, *(state->pc)) : NULL;
+            continue;
+        }
+
+        state->cycles += block->cycles;
+        state->instructions += block->op_count;
+        if (state->jit && !block->aot_code && !block->jit_code && !block->jit_failed &&
+            block->exec_count >= JIT_HOT_THRESHOLD) {
+            jit_compile_block(state, block);
+        }
+
+        uint32_t generation = cache->generation;
+        if (block->aot_code || block->jit_code) {
+            *(state->pc) = block->aot_code ? block->aot_code(state) : block->jit_code(state);
+            if (cache->generation != generation) {
+                // Native code leaves at the op after the store that rewrote code.
+                refund_ops(state, block, op_index_at(block, *(state->pc)));
+            }
+        } else {
+            uint16_t ops_run;
+            if (run_block_ops(state, block, &ops_run)) {
+                return STOP_HALT;
+            }
+            refund_ops(state, block, ops_run);
+        }
+
+        if (block->idle_loop && *(state->pc) == block->start_pc) {
+            // Nothing changes until an interrupt arrives; wait for it instead of spinning.
+            idle_wait(state, block->cycles, block->op_count);
+        }
+        if (state->cycles >= __atomic_load_n(&state->clock.next_sync, __ATOMIC_RELAXED)) {
+            StopReason reason = clock_sync(state);
+            if (reason != STOP_NONE) {
+                return reason;
+            }
+        }
+        if (cache->generation != generation) {
+            block = NULL;
+            continue;
+        }
+        block = next_block(state, block, *(state->pc));
+        if (!block) {
+            fprintf(stderr, "Invalid memory access at PC address 0x%08x\n", *(state->pc));
+            return STOP_FAULT;
+        }
+    }
+}
+
+static int compare_exec_count(const void *a, const void *b) {
+    const BasicBlock *block_a = *(const BasicBlock *const *) a;
+    const BasicBlock *block_b = *(const BasicBlock *const *) b;
+    if (block_a->exec_count == block_b->exec_count) return 0;
+    return block_a->exec_count < block_b->exec_count ? 1 : -1;
+}
+
+/* Print the 'top_n' most frequently executed blocks. */
+void print_block_stats(CPUState *state, size_t top_n) {
+    BlockCache *cache = state->block_cache;
+    printf("Basic blocks cached: %zu\n", cache->block_count);
+    if (cache->block_count == 0 || top_n == 0) {
+        return;
+    }
+
+    BasicBlock **blocks = malloc(cache->block_count * sizeof(BasicBlock *));
+    if (!blocks) {
+        fprintf(stderr, "Memory allocation failed for block statistics.\n");
+        return;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < BLOCK_CACHE_BUCKETS; i++) {
+        for (BasicBlock *block = cache->buckets[i]; block; block = block->hash_next) {
+            blocks[count++] = block;
+        }
+    }
+    qsort(blocks, count, sizeof(BasicBlock *), compare_exec_count);
+
+    if (top_n > count) top_n = count;
+    for (size_t i = 0; i < top_n; i++) {
+        printf("  0x%08x-0x%08x  %3u ops  %llu executions%s\n",
+               blocks[i]->start_pc, blocks[i]->end_pc, blocks[i]->op_count,
+               (unsigned long long) blocks[i]->exec_count,
+               blocks[i]->aot_code ? "  [aot]" : blocks[i]->jit_code ? "  [jit]" : "");
+    }
+    free(blocks);
+}
@@ -0,0 +1,287 @@
+//
+// checkpoint.c
+// In-memory checkpoint and restore of the whole emulator state.
+//
+// A checkpoint copies the CPU registers, the interrupt queue and vector
+// table and the UART registers and FIFOs, but no guest memory. Instead it
+// drops the cached write translations, so the first write to each page
+// afterwards goes through tlb_fill(), which saves the page as it still is
+// (preserve_checkpoint_page()). Taking a checkpoint therefore costs a few
+// microseconds whatever the size of guest memory.
+//
+// The dirty bitmap is cleared at the same time, so on restore it names
+// exactly the pages written since; those are copied back from their saved
+// copies and pages that did not exist at the checkpoint are released again.
+// Restoring costs time proportional to the pages written since the
+// checkpoint (or since the last restore), and the checkpoint stays valid, so
+// one booted state can be restored any number of times. Pages keep their
+// frames, so cached translations stay valid across a restore.
+//
+// Only one checkpoint is kept. A new page table (program or flash load)
+// discards it.
+//
+
+#include "main.h"
+#include "uart.h"
+
+// Marks a page that was not allocated when the checkpoint was taken.
+static uint8_t checkpoint_absent_page[1];
+
+static uint8_t** saved_page_slot(Checkpoint *checkpoint, uint32_t page, bool allocate) {
+    CheckpointLeaf **leaf = &checkpoint->directory[page >> PAGE_TABLE_LEAF_BITS];
+    if (!*leaf) {
+        if (!allocate) {
+            return NULL;
+        }
+        *leaf = calloc(1, sizeof(CheckpointLeaf));
+        if (!*leaf) {
+            fprintf(stderr, "Memory allocation failed for checkpoint pages.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return &(*leaf)->pages[page & (PAGE_TABLE_LEAF_ENTRIES - 1)];
+}
+
+/**
+ * Called by tlb_fill() before a page is first written after the checkpoint:
+ * save it unless it already is. Pages saved before keep their first copy.
+ */
+void preserve_checkpoint_page(CPUState *state, uint32_t page) {
+    Checkpoint *checkpoint = state->checkpoint;
+    uint8_t **slot = saved_page_slot(checkpoint, page, true);
+    if (*slot) {
+        return;
+    }
+    if (!is_page_allocated(state->page_table, page)) {
+        *slot = checkpoint_absent_page;
+    } else {
+        uint8_t *copy = page_arena_alloc_frame(&state->page_arena);
+        memcpy(copy, translate_address(state, page << PAGE_SHIFT, false), PAGE_SIZE);
+        *slot = copy;
+    }
+    checkpoint->saved_pages++;
+}
+
+static bool save_fifo(CheckpointFifo *fifo, const uint8_t *data, size_t size, size_t head, size_t tail) {
+    *fifo = (CheckpointFifo) { .size = size, .head = head, .tail = tail };
+    if (!data || size == 0) {
+        return true;
+    }
+    fifo->data = malloc(size);
+    if (!fifo->data) {
+        fprintf(stderr, "Memory allocation failed for checkpoint UART buffers.\n");
+        return false;
+    }
+    memcpy(fifo->data, data, size);
+    return true;
+}
+
+/* Put a FIFO back if the UART still has a buffer of the same size. */
+static void restore_fifo(const CheckpointFifo *fifo, uint8_t *data, size_t size, size_t *head, size_t *tail) {
+    if (!fifo->data || !data || fifo->size != size) {
+        return;
+    }
+    memcpy(data, fifo->data, size);
+    *head = fifo->head;
+    *tail = fifo->tail;
+}
+
+static bool save_uart(Checkpoint *checkpoint, UART *uart) {
+    if (!uart) {
+        return true;
+    }
+    // The mutexes only exist while the UART thread runs.
+    if (uart->running) {
+        pthread_mutex_lock(&uart->tx_mutex);
+        pthread_mutex_lock(&uart->rx_mutex);
+    }
+    checkpoint->uart_status = uart->status_reg;
+    checkpoint->uart_tx_reg = uart->tx_reg;
+    checkpoint->uart_rx_reg = uart->rx_reg;
+    bool saved = save_fifo(&checkpoint->uart_tx, uart->tx_buffer, uart->tx_buffer_size,
+                           uart->tx_head, uart->tx_tail) &&
+                 save_fifo(&checkpoint->uart_rx, uart->rx_buffer, uart->rx_buffer_size,
+                           uart->rx_head, uart->rx_tail);
+    if (uart->running) {
+        pthread_mutex_unlock(&uart->rx_mutex);
+        pthread_mutex_unlock(&uart->tx_mutex);
+    }
+    return saved;
+}
+
+static void restore_uart(const Checkpoint *checkpoint, UART *uart) {
+    if (!uart) {
+        return;
+    }
+    if (uart->running) {
+        pthread_mutex_lock(&uart->tx_mutex);
+        pthread_mutex_lock(&uart->rx_mutex);
+    }
+    uart->status_reg = checkpoint->uart_status;
+    uart->tx_reg = checkpoint->uart_tx_reg;
+    uart->rx_reg = checkpoint->uart_rx_reg;
+    restore_fifo(&checkpoint->uart_tx, uart->tx_buffer, uart->tx_buffer_size, &uart->tx_head, &uart->tx_tail);
+    restore_fifo(&checkpoint->uart_rx, uart->rx_buffer, uart->rx_buffer_size, &uart->rx_head, &uart->rx_tail);
+    if (uart->running) {
+        pthread_mutex_unlock(&uart->rx_mutex);
+        pthread_mutex_unlock(&uart->tx_mutex);
+    }
+}
+
+static void save_interrupts(Checkpoint *checkpoint, const CPUState *state) {
+    if (state->i_vector_table) {
+        checkpoint->vector_table = *state->i_vector_table;
+    }
+    InterruptQueue *queue = state->i_queue;
+    if (queue) {
+        pthread_mutex_lock(&queue->mutex);
+        memcpy(checkpoint->irq_queue, queue->queue, IRQ_QUEUE_SIZE);
+        checkpoint->irq_head = queue->head;
+        checkpoint->irq_tail = queue->tail;
+        checkpoint->irq_count = queue->count;
+        pthread_mutex_unlock(&queue->mutex);
+    }
+}
+
+static void restore_interrupts(const Checkpoint *checkpoint, CPUState *state) {
+    if (state->i_vector_table) {
+        *state->i_vector_table = checkpoint->vector_table;
+    }
+    InterruptQueue *queue = state->i_queue;
+    if (queue) {
+        // 'enqueued' only ever grows; idle loops use it to notice new interrupts.
+        pthread_mutex_lock(&queue->mutex);
+        memcpy(queue->queue, checkpoint->irq_queue, IRQ_QUEUE_SIZE);
+        queue->head = checkpoint->irq_head;
+        queue->tail = checkpoint->irq_tail;
+        queue->count = checkpoint->irq_count;
+        pthread_mutex_unlock(&queue->mutex);
+    }
+}
+
+/**
+ * Checkpoint the current state, replacing any earlier checkpoint. The CPU
+ * must not be running. Returns false if the checkpoint cannot be allocated.
+ */
+bool take_checkpoint(CPUState *state) {
+    discard_checkpoint(state);
+    Checkpoint *checkpoint = calloc(1, sizeof(Checkpoint));
+    if (!checkpoint) {
+        fprintf(stderr, "Memory allocation failed for checkpoint.\n");
+        return false;
+    }
+    memcpy(checkpoint->reg, state->reg, sizeof(checkpoint->reg));
+    checkpoint->pc = state->pc ? *state->pc : 0;
+    checkpoint->flags_result = state->flags_result;
+    checkpoint->enable_mask_interrupts = state->enable_mask_interrupts;
+    checkpoint->cycles = state->cycles;
+    checkpoint->instructions = state->instructions;
+    checkpoint->idle_cycles = state->idle_cycles;
+    save_interrupts(checkpoint, state);
+    if (!save_uart(checkpoint, state->uart)) {
+        free(checkpoint->uart_tx.data);
+        free(checkpoint);
+        return false;
+    }
+
+    // From here on, the first write to each page saves it (tlb_fill()). The
+    // stack engine writes through pages it resolved itself, so it resolves
+    // them again.
+    state->checkpoint = checkpoint;
+    tlb_flush_writes(state);
+    stack_engine_reset(state);
+    clear_dirty_pages(state);
+    return true;
+}
+
+typedef struct {
+    CPUState *state;
+    size_t restored;
+    bool released;
+} RestorePass;
+
+static void restore_page(uint32_t page, void *context) {
+    RestorePass *pass = context;
+    CPUState *state = pass->state;
+    uint8_t **slot = saved_page_slot(state->checkpoint, page, false);
+    uint8_t *saved = slot ? *slot : NULL;
+    uint32_t address = page << PAGE_SHIFT;
+    if (!saved) {
+        fprintf(stderr, "[WARN] Page 0x%08x was written without being saved; not restored.\n", address);
+        return;
+    }
+    if (saved == checkpoint_absent_page) {
+        release_page(state, page);
+        pass->released = true;
+    } else {
+        uint8_t *data = get_memory_ptr(state, address, true);
+        if (!data) {
+            return;
+        }
+        memcpy(data, saved, PAGE_SIZE);
+    }
+    invalidate_code_range(state, address, PAGE_SIZE);
+    pass->restored++;
+}
+
+/**
+ * Go back to the state of the checkpoint, which is kept for the next
+ * restore. The CPU must not be running. Stores the number of pages copied
+ * back or released in 'restored_pages' if it is not NULL. Returns false if
+ * no checkpoint has been taken.
+ */
+bool restore_checkpoint(CPUState *state, size_t *restored_pages) {
+    Checkpoint *checkpoint = state->checkpoint;
+    if (!checkpoint) {
+        return false;
+    }
+    RestorePass pass = { .state = state };
+    collect_dirty_pages(state, restore_page, &pass);
+    if (pass.released) {
+        // The stack engine may hold a page that no longer exists.
+        stack_engine_reset(state);
+    }
+
+    memcpy(state->reg, checkpoint->reg, sizeof(checkpoint->reg));
+    if (!state->pc) {
+        state->pc = calloc(1, sizeof(uint32_t));
+    }
+    if (state->pc) {
+        *state->pc = checkpoint->pc;
+    }
+    state->flags_result = checkpoint->flags_result;
+    state->enable_mask_interrupts = checkpoint->enable_mask_interrupts;
+    state->cycles = checkpoint->cycles;
+    state->instructions = checkpoint->instructions;
+    state->idle_cycles = checkpoint->idle_cycles;
+    restore_interrupts(checkpoint, state);
+    restore_uart(checkpoint, state->uart);
+    clock_reset(state);
+
+    if (restored_pages) {
+        *restored_pages = pass.restored;
+    }
+    return true;
+}
+
+/* Drop the checkpoint, if any, and the pages it saved. */
+void discard_checkpoint(CPUState *state) {
+    Checkpoint *checkpoint = state->checkpoint;
+    if (!checkpoint) {
+        return;
+    }
+    for (uint32_t dir = 0; dir < PAGE_DIRECTORY_ENTRIES; dir++) {
+        CheckpointLeaf *leaf = checkpoint->directory[dir];
+        if (!leaf) continue;
+        for (uint32_t i = 0; i < PAGE_TABLE_LEAF_ENTRIES; i++) {
+            if (leaf->pages[i] && leaf->pages[i] != checkpoint_absent_page) {
+                page_arena_free_frame(&state->page_arena, leaf->pages[i]);
+            }
+        }
+        free(leaf);
+    }
+    free(checkpoint->uart_tx.data);
+    free(checkpoint->uart_rx.data);
+    free(checkpoint);
+    state->checkpoint = NULL;
+}
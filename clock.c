@@ -0,0 +1,198 @@
+//
+// clock.c
+// Guest clock model: per-instruction cycle costs and real-time pacing.
+//
+// Every instruction is charged a fixed number of cycles at decode time. The
+// cores add them to state->cycles as they run and call clock_sync() once
+// the count reaches state->clock.next_sync, i.e. once per batch_cycles. The
+// sync sleeps until the host clock catches up with the guest schedule,
+// base_time + (cycles - base_cycles) / frequency, so a whole batch costs a
+// single clock_nanosleep() on CLOCK_MONOTONIC instead of a sleep per
+// instruction. Unthrottled runs only reach a sync point when a run limit
+// (-n/-k, step, run_until) is set or a stop is requested (control.c); both
+// are checked there as well.
+//
+
+#include "main.h"
+
+#include <errno.h>
+
+#define NANOSECONDS_PER_SECOND 1000000000ull
+
+// Cycles per instruction: one for register operations, three for a memory
+// access, two for a branch and more for the multipliers and subroutine
+// linkage, which also move a return address through the stack.
+static const uint8_t handler_cycles[HANDLER_COUNT] = {
+    [HANDLER_NOP]        = 1,
+    [HANDLER_ADD_IMM]    = 1, [HANDLER_ADD_REG] = 1, [HANDLER_ADD_MEM] = 3,
+    [HANDLER_SUB_IMM]    = 1, [HANDLER_SUB_REG] = 1, [HANDLER_SUB_MEM] = 3,
+    [HANDLER_MUL_IMM]    = 3, [HANDLER_MUL_REG] = 3, [HANDLER_MUL_MEM] = 5,
+    [HANDLER_AND_IMM]    = 1, [HANDLER_AND_REG] = 1, [HANDLER_AND_MEM] = 3,
+    [HANDLER_OR_IMM]     = 1, [HANDLER_OR_REG]  = 1, [HANDLER_OR_MEM]  = 3,
+    [HANDLER_XOR_IMM]    = 1, [HANDLER_XOR_REG] = 1, [HANDLER_XOR_MEM] = 3,
+    [HANDLER_LSH_IMM]    = 1, [HANDLER_LSH_REG] = 1, [HANDLER_LSH_MEM] = 3,
+    [HANDLER_RSH_IMM]    = 1, [HANDLER_RSH_REG] = 1, [HANDLER_RSH_MEM] = 3,
+    [HANDLER_MOV_IMM]    = 1,
+    [HANDLER_MOV_IMM32]  = 2,
+    [HANDLER_MOV_REG]    = 1,
+    [HANDLER_MOV_MEMORY] = 3,
+    [HANDLER_B]          = 2,
+    [HANDLER_BE]         = 2,
+    [HANDLER_BNE]        = 2,
+    [HANDLER_BLT]        = 2,
+    [HANDLER_BGT]        = 2,
+    [HANDLER_BRO]        = 2,
+    [HANDLER_UMULL]      = 4,
+    [HANDLER_SMULL]      = 4,
+    [HANDLER_HLT]        = 1,
+    [HANDLER_PSH]        = 2,
+    [HANDLER_POP]        = 2,
+    [HANDLER_JSR]        = 5,
+    [HANDLER_RTS]        = 5,
+    [HANDLER_WFI]        = 1,
+    [HANDLER_ENI]        = 1,
+    [HANDLER_DSI]        = 1,
+    [HANDLER_INVALID]    = 1,
+};
+
+uint8_t handler_cycle_count(uint8_t handler) {
+    return handler < HANDLER_COUNT ? handler_cycles[handler] : 1;
+}
+
+void clock_default_config(ClockConfig *config) {
+    config->frequency_hz = CLOCK_DEFAULT_FREQUENCY;
+    config->unthrottled = false;
+    config->batch_cycles = CLOCK_DEFAULT_BATCH;
+}
+
+static inline bool is_paced(const ClockConfig *config) {
+    return !config->unthrottled && config->frequency_hz > 0;
+}
+
+bool clock_is_paced(const CPUState *state) {
+    return is_paced(&state->clock.config);
+}
+
+static inline uint64_t elapsed_ns(const struct timespec *from, const struct timespec *to) {
+    return (uint64_t) (to->tv_sec - from->tv_sec) * NANOSECONDS_PER_SECOND +
+           (uint64_t) to->tv_nsec - (uint64_t) from->tv_nsec;
+}
+
+/* Host time 'cycles' guest cycles take at 'frequency_hz', without overflowing for long runs. */
+static inline uint64_t cycles_to_ns(uint64_t cycles, uint64_t frequency_hz) {
+    return (cycles / frequency_hz) * NANOSECONDS_PER_SECOND +
+           (cycles % frequency_hz) * NANOSECONDS_PER_SECOND / frequency_hz;
+}
+
+/* Inverse of cycles_to_ns(): the whole cycles run in 'ns' at 'frequency_hz'. */
+static inline uint64_t ns_to_cycles(uint64_t ns, uint64_t frequency_hz) {
+    return (ns / NANOSECONDS_PER_SECOND) * frequency_hz +
+           (ns % NANOSECONDS_PER_SECOND) * frequency_hz / NANOSECONDS_PER_SECOND;
+}
+
+/**
+ * The cycle count by which a run limit may be reached, UINT64_MAX without
+ * limits. Every instruction costs at least one cycle, so the instruction
+ * limit cannot be passed within the remaining instruction count in cycles.
+ */
+uint64_t clock_limit_horizon(const CPUState *state) {
+    uint64_t horizon = UINT64_MAX;
+    if (state->cycle_limit) {
+        horizon = state->cycle_limit;
+    }
+    if (state->instruction_limit) {
+        uint64_t remaining = state->instruction_limit > state->instructions
+                             ? state->instruction_limit - state->instructions : 0;
+        if (state->cycles + remaining < horizon) {
+            horizon = state->cycles + remaining;
+        }
+    }
+    return horizon;
+}
+
+/* The host CLOCK_MONOTONIC time at which the paced guest reaches 'cycles'. */
+void clock_time_at(const CPUState *state, uint64_t cycles, struct timespec *out) {
+    const Clock *clock = &state->clock;
+    uint64_t offset = cycles > clock->base_cycles
+                      ? cycles_to_ns(cycles - clock->base_cycles, clock->config.frequency_hz) : 0;
+    uint64_t deadline_ns = (uint64_t) clock->base_time.tv_nsec + offset;
+    out->tv_sec = clock->base_time.tv_sec + (time_t) (deadline_ns / NANOSECONDS_PER_SECOND);
+    out->tv_nsec = (long) (deadline_ns % NANOSECONDS_PER_SECOND);
+}
+
+/* The cycle count the paced guest should have reached by now. */
+uint64_t clock_cycles_now(const CPUState *state) {
+    const Clock *clock = &state->clock;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return clock->base_cycles + ns_to_cycles(elapsed_ns(&clock->base_time, &now), clock->config.frequency_hz);
+}
+
+/**
+ * Set the cycle count of the next sync point: the end of the current batch
+ * when paced, or earlier if a run limit could be reached before that.
+ */
+static void schedule_next_sync(CPUState *state) {
+    const ClockConfig *config = &state->clock.config;
+    uint32_t batch = config->batch_cycles ? config->batch_cycles : CLOCK_DEFAULT_BATCH;
+    uint64_t next = is_paced(config) ? state->cycles + batch : UINT64_MAX;
+    uint64_t horizon = clock_limit_horizon(state);
+    if (horizon < next) {
+        next = horizon;
+    }
+    // Pairs with request_cpu_stop(): a request made while this runs is
+    // either seen here or its zeroing of next_sync lands after this store.
+    __atomic_store_n(&state->clock.next_sync, next, __ATOMIC_SEQ_CST);
+    if (is_cpu_stop_requested(state)) {
+        __atomic_store_n(&state->clock.next_sync, 0, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* Anchor the schedule at the current cycle count, e.g. when the CPU starts. */
+void clock_reset(CPUState *state) {
+    clock_gettime(CLOCK_MONOTONIC, &state->clock.base_time);
+    state->clock.base_cycles = state->cycles;
+    schedule_next_sync(state);
+}
+
+/**
+ * Called by the cores once state->cycles reaches state->clock.next_sync.
+ * Returns the stop request or run limit that was reached, if any. Otherwise
+ * sleeps until the host clock reaches the time at which the guest should
+ * have executed state->cycles cycles and schedules the next sync. When the
+ * guest fell behind by more than CLOCK_MAX_LAG_NS (host stalls, waiting in
+ * wfi) the schedule is re-anchored rather than running flat out to catch up.
+ */
+StopReason clock_sync(CPUState *state) {
+    Clock *clock = &state->clock;
+    if (is_cpu_stop_requested(state)) {
+        return STOP_REQUESTED;
+    }
+    if (state->instruction_limit && state->instructions >= state->instruction_limit) {
+        return STOP_INSTRUCTION_LIMIT;
+    }
+    if (state->cycle_limit && state->cycles >= state->cycle_limit) {
+        return STOP_CYCLE_LIMIT;
+    }
+    if (!is_paced(&clock->config)) {
+        schedule_next_sync(state);
+        return STOP_NONE;
+    }
+
+    uint64_t target = cycles_to_ns(state->cycles - clock->base_cycles, clock->config.frequency_hz);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t elapsed = elapsed_ns(&clock->base_time, &now);
+
+    if (target > elapsed) {
+        struct timespec deadline;
+        clock_time_at(state, state->cycles, &deadline);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {
+        }
+    } else if (elapsed - target > CLOCK_MAX_LAG_NS) {
+        clock->base_time = now;
+        clock->base_cycles = state->cycles;
+    }
+    schedule_next_sync(state);
+    return STOP_NONE;
+}
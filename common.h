@@ -17,7 +17,8 @@
 #include <sys/types.h>
 #include <ctype.h>
 #include <pthread.h>
-#include "constants.h"  // Ensure constants (like MAX_SECTIONS, MAX_INTERRUPTS, IRQ_QUEUE_SIZE, LCD_WIDTH, LCD_HEIGHT) are defined here
+#include <time.h>
+#include "constants.h"  // Ensure constants (like MAX_INTERRUPTS, IRQ_QUEUE_SIZE, LCD_WIDTH, LCD_HEIGHT) are defined here
 
 // ----------------------------
 // Page Table Definitions
@@ -25,17 +26,65 @@
 typedef struct PageTableEntry {
     uint8_t* page_data;     // Points to physical memory data for this page
     bool is_allocated;      // Indicates if the page is allocated
+    bool is_shared;         // page_data is a read-only frame shared with other pages, copied on write
     uint32_t page_index;    // The logical index of this page (for address calculation)
-    struct PageTableEntry* next;  // Pointer to the next page in the list
-    struct PageTableEntry* prev;  // Pointer to the previous page in the list
 } PageTableEntry;
 
+// Second level of the page table: the pages of one directory slot.
 typedef struct {
-    PageTableEntry* head;   // Head of the doubly linked list
-    PageTableEntry* tail;   // Tail of the doubly linked list
+    PageTableEntry entries[PAGE_TABLE_LEAF_ENTRIES];
+} PageTableLeaf;
+
+// One mapping carved into equally sized, page-aligned blocks (paging_arena.c).
+typedef struct PageSlab {
+    uint8_t* base;
+    uint32_t carved;        // Blocks handed out from the start of the slab so far
+    uint32_t live;          // Blocks currently in use
+    void** free_blocks;     // Returned blocks, blocks_per_slab slots; kept outside the blocks
+    uint32_t free_count;    // so a released block stays untouched until it is reused
+    struct PageSlab* next;
+} PageSlab;
+
+typedef struct {
+    PageSlab* slabs;
+    size_t block_size;      // Multiple of PAGE_SIZE
+    uint32_t blocks_per_slab;
+} SlabPool;
+
+// Per-instance allocator for page data and page table leaves; outlives page tables.
+typedef struct {
+    SlabPool frames;        // PAGE_SIZE blocks holding guest page data
+    SlabPool leaves;        // PageTableLeaf blocks
+} PageArena;
+
+// A host mapping whose pages are installed as frames of a page table, e.g.
+// a program file mapped into the boot sector. Unmapped with the table.
+typedef struct {
+    uint8_t* base;
+    size_t size;
+} ImageMapping;
+
+typedef struct {
+    PageTableLeaf* directory[PAGE_DIRECTORY_ENTRIES]; // Indexed by the high page index bits, NULL until used
+    size_t leaf_count;      // Second-level tables allocated
+    PageArena* arena;       // Where pages and leaves come from and go back to
+    uint8_t* flat_base;     // Flat backend: the reserved guest address space, NULL when paged
+    uint8_t* flat_committed; // Flat backend: one bit per page made accessible
+    ImageMapping* image_mappings; // Paged backend: host mappings backing image sections
+    size_t image_mapping_count;
+    uint8_t** shared_frames; // Paged backend: arena frames merged by reclaim_guest_memory()
+    size_t shared_frame_count;
     size_t page_count;      // Total number of pages in the table
+    size_t peak_page_count; // Most pages allocated at any one time
 } PageTable;
 
+// What one reclaim_guest_memory() pass gave back.
+typedef struct {
+    size_t zero_pages;      // Pages found to be all zero
+    size_t merged_pages;    // Pages now sharing a frame with an identical page
+    size_t released_bytes;  // Host memory returned to the OS
+} ReclaimStats;
+
 typedef enum {
     BOOT_SECTOR,
     USABLE_MEMORY,
@@ -53,11 +102,251 @@ typedef struct {
     char device[64];        // Optional device information for MMIO pages
 } MemorySection;
 
+typedef enum {
+    MEMORY_PAGED,           // Pages allocated one by one behind the radix page table
+    MEMORY_FLAT             // One reserved 4 GiB mapping, guest address = offset (paging_flat.c)
+} MemoryBackend;
+
+// Attribute bits of a guest page, also cached in the TLB.
+#define PAGE_ATTR_RAM   0x01        // Plain memory: stores have no side effects
+#define PAGE_ATTR_MMIO  0x02        // Device page: accesses go through the device's callbacks (mmu.c)
+#define PAGE_ATTR_READ  0x04
+#define PAGE_ATTR_WRITE 0x08
+#define PAGE_ATTR_EXEC  0x10        // Instructions may be fetched from the page
+
+#define NO_SECTION UINT32_MAX
+
+// ----------------------------
+// MMIO Devices
+// ----------------------------
+// A device register, relative to the base address of the device's section.
+typedef struct {
+    const char *name;
+    uint32_t offset;
+    uint8_t size;           // Bytes
+    uint8_t access;         // PAGE_ATTR_READ and/or PAGE_ATTR_WRITE: accesses that reach the callbacks
+} MmioRegister;
+
+struct CPUState;
+struct MmioDevice;
+
+// A kind of device that sections map with device = <name> (peripherals.c).
+// Accesses to a register go to the callbacks; everything else in the page is
+// plain memory. Reads must have no side effects and may only change value
+// when an interrupt is enqueued, which idle-loop detection relies on.
+typedef struct MmioDeviceType {
+    const char *name;
+    const MmioRegister *registers;
+    size_t register_count;
+    uint32_t (*read)(struct CPUState *state, const struct MmioDevice *device, const MmioRegister *reg);
+    void (*write)(struct CPUState *state, const struct MmioDevice *device, const MmioRegister *reg, uint32_t value);
+    int irq;                // Interrupt the device raises, -1 for none
+    void (*interrupt)(struct CPUState *state, const struct MmioDevice *device); // Called as 'irq' is serviced
+} MmioDeviceType;
+
+// An instance of a device type, created for an MMIO section.
+typedef struct MmioDevice {
+    const MmioDeviceType *type;
+    uint32_t base;
+    uint32_t size;
+} MmioDevice;
+
+// Per-page view of the memory sections, compiled once per configuration (memory_map.c).
+typedef struct {
+    uint8_t type;           // PageType of the section holding the page
+    uint8_t flags;          // PAGE_ATTR_* bits, 0 for a page outside every section
+    uint16_t device;        // Index + 1 into MemoryMap.devices, 0 for none
+    uint32_t section;       // Index into MemoryConfig.sections, NO_SECTION if none
+} PageAttributes;
+
+typedef struct {
+    PageAttributes entries[PAGE_TABLE_LEAF_ENTRIES];
+} PageAttributeLeaf;
+
+typedef struct {
+    PageAttributeLeaf* directory[PAGE_DIRECTORY_ENTRIES]; // Same split as the page table, NULL where no section is
+    MmioDevice* devices;    // One per MMIO section with a registered device type
+    size_t device_count;
+} MemoryMap;
+
 typedef struct {
-    MemorySection sections[MAX_SECTIONS];
+    MemorySection* sections; // Sorted by start address, non-overlapping
     size_t section_count;
+    size_t section_capacity;
+    MemoryBackend backend;  // Selected by memory_backend in [Emulator]
+    MemoryMap map;          // Attributes of every page, built from the sections
 } MemoryConfig;
 
+// ----------------------------
+// Decoded Instruction Cache
+// ----------------------------
+// Dense handler index for every valid opcode/specifier pair, computed at
+// decode time so interpreter cores can dispatch with a single table lookup.
+typedef enum {
+    HANDLER_NOP,
+    HANDLER_ADD_IMM, HANDLER_ADD_REG, HANDLER_ADD_MEM,
+    HANDLER_SUB_IMM, HANDLER_SUB_REG, HANDLER_SUB_MEM,
+    HANDLER_MUL_IMM, HANDLER_MUL_REG, HANDLER_MUL_MEM,
+    HANDLER_AND_IMM, HANDLER_AND_REG, HANDLER_AND_MEM,
+    HANDLER_OR_IMM,  HANDLER_OR_REG,  HANDLER_OR_MEM,
+    HANDLER_XOR_IMM, HANDLER_XOR_REG, HANDLER_XOR_MEM,
+    HANDLER_LSH_IMM, HANDLER_LSH_REG, HANDLER_LSH_MEM,
+    HANDLER_RSH_IMM, HANDLER_RSH_REG, HANDLER_RSH_MEM,
+    HANDLER_MOV_IMM,        // 0x00: rd = #imm16
+    HANDLER_MOV_IMM32,      // 0x01: rd:rn = #imm32
+    HANDLER_MOV_REG,        // 0x02: rn = rd
+    HANDLER_MOV_MEMORY,     // 0x03-0x12: every form that touches memory
+    HANDLER_B,
+    HANDLER_BE,
+    HANDLER_BNE,
+    HANDLER_BLT,
+    HANDLER_BGT,
+    HANDLER_BRO,
+    HANDLER_UMULL,
+    HANDLER_SMULL,
+    HANDLER_HLT,
+    HANDLER_PSH,
+    HANDLER_POP,
+    HANDLER_JSR,
+    HANDLER_RTS,
+    HANDLER_WFI,
+    HANDLER_ENI,
+    HANDLER_DSI,
+    HANDLER_INVALID,        // Unknown opcode or specifier; executed by the switch core
+    HANDLER_COUNT
+} InstructionHandler;
+
+// Adjacent instruction pairs the block interpreter runs as one operation.
+// The tag sits on the first instruction of the pair; see fusion.c.
+typedef enum {
+    FUSION_NONE,
+    FUSION_MOV_IMM_ALU,     // mov rd, #imm; <alu> rd, ...
+    FUSION_SUB_BRANCH,      // sub rd, ...; be/bne/blt/bgt rd, ...
+    FUSION_PSH_POP,         // psh ra; pop rb
+    FUSION_PSH_PSH,         // psh ra; psh rb
+    FUSION_POP_POP,         // pop ra; pop rb
+    FUSION_COUNT
+} FusionKind;
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t specifier;
+    uint8_t handler;        // InstructionHandler for this opcode/specifier
+    uint8_t rd;             // Byte 2: destination register
+    uint8_t rn;             // Byte 3: source register
+    uint8_t rn1;            // Byte 3: second destination in the 32-bit mov forms
+    uint8_t mull_rn;        // Byte 4: multiplier register for umull/smull
+    uint8_t length;         // Instruction length from get_instruction_length()
+    uint8_t fusion;         // FusionKind pairing this with the next op of its block
+    uint8_t cycles;         // Clock cycles charged for the instruction (clock.c)
+    uint16_t immediate;     // Bytes 3-4, already byte-swapped
+    uint32_t norm_address;  // Bytes 3-6, already byte-swapped
+    uint32_t label;         // Branch target (bytes 2-5 for b/bro/jsr, 4-7 for be/bne/blt/bgt)
+    uint32_t offset;        // Bytes 4-7, already byte-swapped
+} DecodedInstruction;
+
+typedef struct {
+    uint32_t pc;            // Guest PC this entry was decoded from
+    bool valid;
+    DecodedInstruction insn;
+} DecodeCacheEntry;
+
+typedef struct DecodeCache {
+    DecodeCacheEntry entries[DECODE_CACHE_SIZE];  // Direct-mapped on the low PC bits
+    uint8_t code_pages[NUM_PAGES / 8];            // One bit per page holding cached instructions
+} DecodeCache;
+
+// ----------------------------
+// Basic Block Cache
+// ----------------------------
+struct CPUState;
+
+// Native code for a block: runs the whole block and returns the next guest PC.
+typedef uint32_t (*NativeBlockFn)(struct CPUState *state);
+
+typedef struct BasicBlock {
+    uint32_t start_pc;
+    uint32_t end_pc;                // PC following the last instruction (fall-through exit)
+    uint32_t taken_pc;              // Direct branch target of the terminator, if any
+    bool has_taken_exit;
+    bool idle_loop;                 // Loops to itself without changing state (idle.c)
+    uint64_t exec_count;            // Number of times the block was entered
+    uint32_t cycles;                // Clock cycles of all ops, charged on entry
+    NativeBlockFn jit_code;         // Native translation, NULL until the block is hot
+    NativeBlockFn aot_code;         // Ahead-of-time translation of this PC, if any
+    bool jit_failed;                // Block contains instructions the JIT cannot handle
+    struct BasicBlock *taken;       // Chained successor for the taken exit
+    struct BasicBlock *fallthrough; // Chained successor for the fall-through exit
+    struct BasicBlock **chained_from; // Blocks whose taken or fall-through link points here
+    uint32_t chained_from_count;
+    uint32_t chained_from_capacity;
+    struct BasicBlock *hash_next;   // Bucket chain
+    uint16_t op_count;
+    DecodedInstruction ops[];       // Decoded instructions, terminator last
+} BasicBlock;
+
+// One bit per byte of a page, set where a cached block holds instructions.
+typedef struct {
+    uint64_t *pages[PAGE_TABLE_LEAF_ENTRIES];   // NULL for pages no block has covered
+} BlockCodeLeaf;
+
+typedef struct BlockCache {
+    BasicBlock *buckets[BLOCK_CACHE_BUCKETS];
+    BlockCodeLeaf *code_bytes[PAGE_DIRECTORY_ENTRIES]; // Same split as the page table
+    BasicBlock *retired;            // Invalidated blocks, freed at the next safe point
+    uint32_t generation;            // Bumped whenever blocks are invalidated
+    size_t block_count;
+    uint64_t fusion_hits[FUSION_COUNT]; // Fused pairs run by the block interpreter, by kind
+} BlockCache;
+
+// ----------------------------
+// JIT Compiler
+// ----------------------------
+typedef struct JitCompiler {
+    uint8_t *buffer;                // mmap'd code buffer, writable only while emitting
+    size_t capacity;
+    size_t used;
+    size_t compiled_blocks;
+} JitCompiler;
+
+// ----------------------------
+// Program Image
+// ----------------------------
+// A program file as returned by load_program(): mapped, not read.
+typedef struct {
+    const uint8_t *data;            // File contents, NULL if nothing was loaded
+    size_t size;                    // File size in bytes
+    int fd;                         // Kept open so the boot sector can map the file itself; -1 if none
+} ProgramImage;
+
+// ----------------------------
+// Boot Image
+// ----------------------------
+typedef struct {
+    uint64_t hash;                  // hash_bytes() of the image as loaded
+    uint32_t load_address;
+    uint32_t size;                  // 0 if no image is loaded
+    uint8_t *dirty_pages;           // One bit per image page written since load
+} BootImage;
+
+// ----------------------------
+// Ahead-of-Time Translations
+// ----------------------------
+typedef struct {
+    uint32_t start_pc;
+    uint32_t end_pc;                // PC following the last translated instruction
+    NativeBlockFn code;
+} AotBlock;
+
+// Emitted by neocore_aot for one boot image and registered at startup.
+typedef struct AotImage {
+    uint64_t image_hash;            // hash_bytes() of the image the blocks were translated from
+    uint32_t load_address;          // Guest address the image was translated for
+    uint32_t image_size;
+    const AotBlock *blocks;         // Sorted by start_pc
+    size_t block_count;
+} AotImage;
+
 // ----------------------------
 // Interrupt Definitions
 // ----------------------------
@@ -76,31 +365,161 @@ typedef struct {
     uint8_t head;                   // Read index
     uint8_t tail;                   // Write index
     uint8_t count;                  // Number of pending interrupts
+    uint32_t enqueued;              // Interrupts enqueued so far, to detect new arrivals
     pthread_mutex_t mutex;          // Mutex for thread safety
     pthread_cond_t cond;            // Condition variable to signal new interrupts
 } InterruptQueue;
 
+// ----------------------------
+// Clock Model
+// ----------------------------
+typedef struct {
+    uint64_t frequency_hz;          // Target guest clock rate
+    bool unthrottled;               // Run as fast as the host allows
+    uint32_t batch_cycles;          // Guest cycles between two pacing points
+} ClockConfig;
+
+typedef struct {
+    ClockConfig config;             // [Emulator] section of the configuration file
+    uint64_t next_sync;             // Cycle count at which clock_sync() is next due
+    uint64_t base_cycles;           // Cycle count at base_time
+    struct timespec base_time;      // Host time (CLOCK_MONOTONIC) the schedule is anchored to
+} Clock;
+
+// Why the CPU stopped running; STOP_NONE while it keeps going.
+typedef enum {
+    STOP_NONE,
+    STOP_HALT,              // Executed hlt
+    STOP_FAULT,             // Fetched from unmapped memory
+    STOP_INSTRUCTION_LIMIT, // Retired CPUState.instruction_limit instructions
+    STOP_CYCLE_LIMIT,       // Ran CPUState.cycle_limit cycles
+    STOP_REQUESTED,         // Paused through request_cpu_stop()
+    STOP_PC_REACHED         // Reached the PC given to run_until_pc()
+} StopReason;
+
 // ----------------------------
 // Forward Declaration for UART
 // ----------------------------
 struct UART;  // Forward declaration so CPUState can hold a pointer to UART
 
+// ----------------------------
+// Software TLB
+// ----------------------------
+typedef struct {
+    uint32_t tag;                   // Page index + 1, 0 for an empty entry
+    uint8_t attributes;             // PAGE_ATTR_* bits of the page
+    uint8_t *host_page;             // Host address of the start of the page
+} TlbEntry;
+
+// Translations from guest page to host memory, kept apart for instruction
+// fetches, data reads and data writes so none evicts the others. Only the
+// write set is guaranteed to point at a private frame.
+typedef struct {
+    TlbEntry fetch[TLB_ENTRIES];
+    TlbEntry data[TLB_ENTRIES];
+    TlbEntry write[TLB_ENTRIES];
+} SoftTlb;
+
+// ----------------------------
+// Dirty page tracking
+// ----------------------------
+// One bit per guest page, set by every write (dirty_pages.h) and cleared
+// when the pages are collected.
+typedef struct {
+    uint64_t words[DIRTY_MAP_WORDS];
+} DirtyPageMap;
+
+// ----------------------------
+// Stack engine
+// ----------------------------
+// Where the STACK section lives in host memory, resolved once per page
+// table. The section starts with the 32-bit stack pointer (bytes in use),
+// followed by the data area, which grows upward.
+typedef struct {
+    bool bound;                     // Fields below are valid for the current page table
+    uint32_t base;                  // Guest address of the section
+    uint32_t limit;                 // Size of the data area in bytes
+    uint32_t *sp;                   // Host address of the stack pointer word
+    uint8_t **pages;                // Host address of every page of the section
+    uint32_t page_count;
+} StackEngine;
+
+// ----------------------------
+// Checkpoints
+// ----------------------------
+// Guest pages as they were when the checkpoint was taken, indexed like the
+// page table. A page is saved the first time it is written afterwards.
+typedef struct {
+    uint8_t *pages[PAGE_TABLE_LEAF_ENTRIES]; // Saved copy, checkpoint_absent_page, or NULL if not saved
+} CheckpointLeaf;
+
+// Contents of one UART FIFO.
+typedef struct {
+    uint8_t *data;                  // NULL if the UART had no buffer
+    size_t size;
+    size_t head;
+    size_t tail;
+} CheckpointFifo;
+
+// Everything restore_checkpoint() puts back (checkpoint.c).
+typedef struct Checkpoint {
+    uint16_t reg[REGISTER_COUNT];
+    uint32_t pc;
+    uint32_t flags_result;
+    bool enable_mask_interrupts;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t idle_cycles;
+
+    InterruptVectorTable vector_table;
+    uint8_t irq_queue[IRQ_QUEUE_SIZE];
+    uint8_t irq_head;
+    uint8_t irq_tail;
+    uint8_t irq_count;
+
+    uint32_t uart_status;
+    uint8_t uart_tx_reg;
+    uint8_t uart_rx_reg;
+    CheckpointFifo uart_tx;
+    CheckpointFifo uart_rx;
+
+    CheckpointLeaf *directory[PAGE_DIRECTORY_ENTRIES]; // NULL until a page in the slot is saved
+    size_t saved_pages;             // Pages saved so far
+} Checkpoint;
+
 // ----------------------------
 // CPU State
 // ----------------------------
 typedef struct CPUState {
     PageTable *page_table;          // Pointer to the page table
+    PageArena page_arena;           // Backing store for page tables across reloads
     MemoryConfig memory_config;     // Memory configuration
+    SoftTlb tlb;                    // Cached page translations (tlb.h), flushed with the page table
+    StackEngine stack;              // Resolved STACK section (stack.c), reset with the page table
+    DirtyPageMap dirty;             // Pages written since they were last collected (dirty_pages.c)
+    Checkpoint *checkpoint;         // State to go back to (checkpoint.c), NULL if none is taken
 
     uint16_t* reg;
     uint32_t* pc;
     bool enable_mask_interrupts;
-    bool z_flag;
-    bool v_flag;
+    uint32_t flags_result;          // Last ALU result; Z and V are derived from it (alu.h)
+    uint64_t cycles;                // Guest clock cycles since start()
+    uint64_t instructions;          // Instructions retired since start()
+    Clock clock;                    // Pacing of guest cycles against host time
+    uint64_t instruction_limit;     // Stop after this many instructions, 0 for no limit
+    uint64_t cycle_limit;           // Stop after this many cycles, 0 for no limit
+    uint32_t stop_requested;        // Set (atomically) to pause at the next sync point
+    uint64_t idle_cycles;           // Cycles skipped while waiting in idle loops (idle.c)
 
     InterruptQueue *i_queue;
     InterruptVectorTable *i_vector_table;
 
+    DecodeCache *decode_cache;      // Pre-decoded instructions keyed by guest PC
+    BlockCache *block_cache;        // Basic blocks keyed by start PC
+    JitCompiler *jit;               // Native code generator for hot blocks, NULL when disabled
+    BootImage boot_image;           // Image loaded into the boot sector
+    const AotImage *aot;            // Static translation of the loaded image, NULL if none matches
+
     struct UART *uart;              // Pointer to UART (full definition in uart.h)
     pthread_t uart_thread;
 
@@ -111,12 +530,26 @@ typedef struct CPUState {
 // ----------------------------
 // Application State
 // ----------------------------
+typedef enum {
+    CORE_SWITCH,            // Reference interpreter: one switch dispatch per instruction
+    CORE_THREADED,          // Computed-goto interpreter (threaded_core.c)
+    CORE_BLOCK              // Chained basic-block interpreter (block_cache.c)
+} ExecutionCore;
+
 typedef struct AppState {
     char *program_file;
     char *flash_file;
 
     CPUState *state;
 
+    ExecutionCore core;             // Interpreter core used by start()
+    bool jit_enabled;               // Compile hot blocks when running the block core
+    bool translation_cache_enabled; // Persist decoded blocks between runs
+    char *translation_cache_file;   // Cache file for the loaded program, NULL if none
+    bool headless;                  // Run the program to completion without the REPL (-r)
+    bool emulator_thread_joinable;  // emulator_thread exited or is running and was not joined yet
+    StopReason last_stop;           // Why the last run on the emulator thread stopped
+
     uint8_t *emulator_running;
     pthread_t emulator_thread;
 
@@ -8,7 +8,31 @@
 // Emulator Configuration
 #define MAX_INPUT_LENGTH 1024
 #define PAGE_SIZE 4096
+#define PAGE_SHIFT 12 // Log2 of PAGE_SIZE
 #define NUM_PAGES (1 << 20) // For a 32-bit address space and 4 KB pages
+#define PAGE_TABLE_LEAF_BITS 10 // Page index bits resolved by a second-level table
+#define PAGE_TABLE_LEAF_ENTRIES (1 << PAGE_TABLE_LEAF_BITS)
+#define PAGE_DIRECTORY_ENTRIES (NUM_PAGES >> PAGE_TABLE_LEAF_BITS)
+#define PAGE_SLAB_SIZE (2 * 1024 * 1024) // Bytes mapped at a time for page data and page table leaves
+#define TLB_ENTRIES 64 // Direct-mapped software TLB entries per access kind (power of two)
+#define DIRTY_MAP_WORDS (NUM_PAGES / 64) // 64-bit words of the dirty page bitmap
+#define DECODE_CACHE_SIZE 4096 // Direct-mapped decoded instruction entries (power of two)
+#define BLOCK_CACHE_BUCKETS 4096 // Hash buckets for basic blocks (power of two)
+#define BLOCK_MAX_OPS 64         // Longest basic block before it is split
+#define MAX_INSTRUCTION_LENGTH 9 // Longest encoding get_instruction_length() returns (mov 0x0E, 0x12)
+#define JIT_HOT_THRESHOLD 16     // Block executions before it is compiled
+#define JIT_BUFFER_SIZE (16 * 1024 * 1024) // Executable code buffer per instance
+#define CLOCK_DEFAULT_FREQUENCY 1000000 // Guest clock in Hz when the configuration sets none
+#define CLOCK_DEFAULT_BATCH 10000       // Guest cycles run between pacing sleeps
+#define CLOCK_MAX_LAG_NS 50000000       // Lag behind the schedule that is dropped instead of caught up
+#define WFI_POLL_INTERVAL_MS 50         // How often a CPU waiting in wfi or an idle loop checks for a stop request
+#define REGISTER_COUNT 16               // General purpose registers
+#define TRANSLATION_CACHE_SUFFIX ".ncache" // Appended to the program path for the on-disk block cache
+
+// Exit status of a headless (-r) run; EXIT_FAILURE (1) means it could not start
+#define EXIT_HALTED        0
+#define EXIT_FAULT         2
+#define EXIT_LIMIT_REACHED 3
 
 // CPU Operation Codes
 #define OP_NOP  0x00
@@ -46,7 +70,7 @@
 // Interrupt Definitions
 #define IRQ_QUEUE_SIZE   8     // Size of the FIFO queue for pending interrupts
 #define MAX_INTERRUPTS   32    // Maximum number of interrupts that can be registered
+#define MAX_MMIO_DEVICE_TYPES 16 // Device types that can be registered for device = in config.ini
 
-#define MAX_SECTIONS 64
 
 #endif //NEOCORE_CONSTANTS_H
@@ -0,0 +1,101 @@
+//
+// control.c
+// Cooperative run control: pause, resume, single-step and run-until.
+//
+// Nothing here interrupts the CPU thread from outside. A stop request sets
+// a flag and pulls state->clock.next_sync down to zero, so every core
+// notices it at its next sync point (between blocks, at branch targets, or
+// after an instruction on the switch core) and returns STOP_REQUESTED with
+// the CPU in a consistent state that run_cpu() can pick up again. Stepping
+// and run-until use the exact instruction and cycle limits of the cores, so
+// they run at full speed until the limit is reached.
+//
+
+#include "main.h"
+
+/**
+ * Ask the running CPU to stop at its next sync point. Only atomic stores, so
+ * this is safe to call from another thread or a signal handler.
+ */
+void request_cpu_stop(CPUState *state) {
+    __atomic_store_n(&state->stop_requested, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&state->clock.next_sync, 0, __ATOMIC_SEQ_CST);
+}
+
+bool is_cpu_stop_requested(CPUState *state) {
+    return __atomic_load_n(&state->stop_requested, __ATOMIC_SEQ_CST) != 0;
+}
+
+static inline void clear_cpu_stop_request(CPUState *state) {
+    __atomic_store_n(&state->stop_requested, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Run exactly 'count' more instructions (fewer if the CPU stops first). */
+StopReason step_cpu(AppState *appState, uint64_t count) {
+    CPUState *state = appState->state;
+    if (count == 0) {
+        return STOP_INSTRUCTION_LIMIT;
+    }
+    uint64_t saved_limit = state->instruction_limit;
+    uint64_t target = state->instructions + count;
+    if (saved_limit == 0 || target < saved_limit) {
+        state->instruction_limit = target;
+    }
+    clear_cpu_stop_request(state);
+    StopReason reason = run_cpu(appState);
+    state->instruction_limit = saved_limit;
+    return reason;
+}
+
+/* Run until the cycle counter reaches 'cycles' (an absolute count since start). */
+StopReason run_until_cycles(AppState *appState, uint64_t cycles) {
+    CPUState *state = appState->state;
+    if (state->cycles >= cycles) {
+        return STOP_CYCLE_LIMIT;
+    }
+    uint64_t saved_limit = state->cycle_limit;
+    if (saved_limit == 0 || cycles < saved_limit) {
+        state->cycle_limit = cycles;
+    }
+    clear_cpu_stop_request(state);
+    StopReason reason = run_cpu(appState);
+    state->cycle_limit = saved_limit;
+    return reason;
+}
+
+/**
+ * Run until the PC reaches 'pc' after at least one instruction. The PC has
+ * to be compared after every instruction, so this always runs on the
+ * reference switch core whatever core is selected.
+ */
+StopReason run_until_pc(AppState *appState, uint32_t pc) {
+    CPUState *state = appState->state;
+    clear_cpu_stop_request(state);
+    clock_reset(state);
+
+    StopReason reason;
+    do {
+        if (__atomic_load_n(&state->i_queue->count, __ATOMIC_RELAXED) != 0 &&
+            state->enable_mask_interrupts) {
+            service_pending_interrupt(state);
+        }
+        reason = execute_instruction(state);
+        if (reason == STOP_NONE &&
+            state->cycles >= __atomic_load_n(&state->clock.next_sync, __ATOMIC_RELAXED)) {
+            reason = clock_sync(state);
+        }
+    } while (reason == STOP_NONE && *(state->pc) != pc);
+    return reason == STOP_NONE ? STOP_PC_REACHED : reason;
+}
+
+const char* stop_reason_name(StopReason reason) {
+    switch (reason) {
+        case STOP_HALT:              return "halted";
+        case STOP_FAULT:             return "fault";
+        case STOP_INSTRUCTION_LIMIT: return "instruction limit reached";
+        case STOP_CYCLE_LIMIT:       return "cycle limit reached";
+        case STOP_REQUESTED:         return "stop requested";
+        case STOP_PC_REACHED:        return "PC reached";
+        default:                     return "running";
+    }
+}
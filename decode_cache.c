@@ -0,0 +1,257 @@
+//
+// decode_cache.c
+// Pre-decoded instruction cache keyed by guest PC.
+//
+
+#include "main.h"
+#include "tlb.h"
+#include "guest_memory.h"
+
+#define DECODE_PAGE_SHIFT 12
+#define DECODE_WINDOW 8  // Bytes decode_instruction() reads, whatever the length
+
+static inline void mark_code_page(DecodeCache *cache, uint32_t page_index) {
+    cache->code_pages[page_index >> 3] |= (uint8_t) (1u << (page_index & 7));
+}
+
+static inline bool is_code_page(const DecodeCache *cache, uint32_t page_index) {
+    return (cache->code_pages[page_index >> 3] >> (page_index & 7)) & 1;
+}
+
+DecodeCache* create_decode_cache(void) {
+    DecodeCache *cache = calloc(1, sizeof(DecodeCache));
+    if (!cache) {
+        fprintf(stderr, "Failed to allocate memory for DecodeCache.\n");
+        exit(EXIT_FAILURE);
+    }
+    return cache;
+}
+
+/* Map an opcode/specifier pair to its dense InstructionHandler index. */
+static uint8_t classify_instruction(uint8_t opcode, uint8_t specifier) {
+    switch (opcode) {
+        case OP_NOP: return HANDLER_NOP;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_AND:
+        case OP_OR:
+        case OP_XOR:
+        case OP_LSH:
+        case OP_RSH:
+            // The ALU handlers are laid out as consecutive IMM/REG/MEM triples.
+            if (specifier > 0x02) return HANDLER_INVALID;
+            return (uint8_t) (HANDLER_ADD_IMM + (opcode - OP_ADD) * 3 + specifier);
+        case OP_MOV:
+            switch (specifier) {
+                case 0x00: return HANDLER_MOV_IMM;
+                case 0x01: return HANDLER_MOV_IMM32;
+                case 0x02: return HANDLER_MOV_REG;
+                default:
+                    return specifier <= 0x12 ? HANDLER_MOV_MEMORY : HANDLER_INVALID;
+            }
+        case OP_B:     return HANDLER_B;
+        case OP_BE:    return HANDLER_BE;
+        case OP_BNE:   return HANDLER_BNE;
+        case OP_BLT:   return HANDLER_BLT;
+        case OP_BGT:   return HANDLER_BGT;
+        case OP_BRO:   return HANDLER_BRO;
+        case OP_UMULL: return HANDLER_UMULL;
+        case OP_SMULL: return HANDLER_SMULL;
+        case OP_HLT:   return HANDLER_HLT;
+        case OP_PSH:   return HANDLER_PSH;
+        case OP_POP:   return HANDLER_POP;
+        case OP_JSR:   return HANDLER_JSR;
+        case OP_RTS:   return HANDLER_RTS;
+        case OP_WFI:   return HANDLER_WFI;
+        case OP_ENI:   return HANDLER_ENI;
+        case OP_DSI:   return HANDLER_DSI;
+        default:       return HANDLER_INVALID;
+    }
+}
+
+static const char *const handler_names[HANDLER_COUNT] = {
+    [HANDLER_NOP] = "nop",
+    [HANDLER_ADD_IMM] = "add", [HANDLER_ADD_REG] = "add", [HANDLER_ADD_MEM] = "add",
+    [HANDLER_SUB_IMM] = "sub", [HANDLER_SUB_REG] = "sub", [HANDLER_SUB_MEM] = "sub",
+    [HANDLER_MUL_IMM] = "mul", [HANDLER_MUL_REG] = "mul", [HANDLER_MUL_MEM] = "mul",
+    [HANDLER_AND_IMM] = "and", [HANDLER_AND_REG] = "and", [HANDLER_AND_MEM] = "and",
+    [HANDLER_OR_IMM]  = "or",  [HANDLER_OR_REG]  = "or",  [HANDLER_OR_MEM]  = "or",
+    [HANDLER_XOR_IMM] = "xor", [HANDLER_XOR_REG] = "xor", [HANDLER_XOR_MEM] = "xor",
+    [HANDLER_LSH_IMM] = "lsh", [HANDLER_LSH_REG] = "lsh", [HANDLER_LSH_MEM] = "lsh",
+    [HANDLER_RSH_IMM] = "rsh", [HANDLER_RSH_REG] = "rsh", [HANDLER_RSH_MEM] = "rsh",
+    [HANDLER_MOV_IMM] = "mov", [HANDLER_MOV_IMM32] = "mov", [HANDLER_MOV_REG] = "mov",
+    [HANDLER_MOV_MEMORY] = "mov",
+    [HANDLER_B] = "b", [HANDLER_BE] = "be", [HANDLER_BNE] = "bne", [HANDLER_BLT] = "blt",
+    [HANDLER_BGT] = "bgt", [HANDLER_BRO] = "bro", [HANDLER_UMULL] = "umull",
+    [HANDLER_SMULL] = "smull", [HANDLER_HLT] = "hlt", [HANDLER_PSH] = "psh",
+    [HANDLER_POP] = "pop", [HANDLER_JSR] = "jsr", [HANDLER_RTS] = "rts", [HANDLER_WFI] = "wfi",
+    [HANDLER_ENI] = "eni", [HANDLER_DSI] = "dsi", [HANDLER_INVALID] = "invalid",
+};
+
+/* Mnemonic of 'handler', for disassembly and statistics. */
+const char* handler_name(uint8_t handler) {
+    return handler < HANDLER_COUNT ? handler_names[handler] : "invalid";
+}
+
+/**
+ * Decode the raw instruction bytes at 'bytes' into 'out'.
+ * All multi-byte fields are byte-swapped up front so the executor never
+ * touches guest memory again for this instruction.
+ */
+void decode_instruction(const uint8_t *bytes, DecodedInstruction *out) {
+    out->specifier    = bytes[0];
+    out->opcode       = bytes[1];
+    out->handler      = classify_instruction(out->opcode, out->specifier);
+    out->rd           = bytes[2];
+    out->rn           = bytes[3];
+    out->rn1          = bytes[3];
+    out->mull_rn      = bytes[4];
+    out->length       = get_instruction_length(out->opcode, out->specifier);
+    out->fusion       = FUSION_NONE;
+    out->cycles       = handler_cycle_count(out->handler);
+    out->immediate    = ((uint16_t) bytes[3] << 8) | bytes[4];
+    out->norm_address = load_be32(&bytes[3]);
+    out->offset       = load_be32(&bytes[4]);
+
+    switch (out->opcode) {
+        case OP_BE:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BGT:
+            out->label = load_be32(&bytes[4]);
+            break;
+        default:
+            // b, bro and jsr carry their label in bytes 2-5.
+            out->label = load_be32(&bytes[2]);
+            break;
+    }
+}
+
+/**
+ * Gather the decode window at 'pc' into 'window' when it runs past the end
+ * of the page at 'pc_ptr'. The next page is only translated if the
+ * instruction itself reaches into it; the rest of the window is zero.
+ * Returns NULL if that page is unmapped.
+ */
+static __attribute__((noinline)) uint8_t* fetch_split(CPUState *state, uint32_t pc,
+                                                      const uint8_t *pc_ptr, uint8_t *window) {
+    uint32_t available = PAGE_SIZE - (pc & (PAGE_SIZE - 1));
+    memset(window, 0, DECODE_WINDOW);
+    memcpy(window, pc_ptr, available);
+    uint32_t length = available >= 2 ? get_instruction_length(window[1], window[0]) : DECODE_WINDOW;
+    if (length > available) {
+        uint8_t attributes;
+        uint8_t *next = tlb_translate(state, state->tlb.fetch, pc + available, false, &attributes);
+        if (!next) {
+            return NULL;
+        }
+        memcpy(window + available, next, DECODE_WINDOW - available);
+    }
+    return window;
+}
+
+/**
+ * Return the decoded instruction at 'pc', decoding and caching it on a miss.
+ * Returns NULL if the PC points at unmapped memory.
+ */
+const DecodedInstruction* fetch_decoded(CPUState *state, uint32_t pc) {
+    DecodeCache *cache = state->decode_cache;
+    DecodeCacheEntry *entry = &cache->entries[pc & (DECODE_CACHE_SIZE - 1)];
+    if (entry->valid && entry->pc == pc) {
+        return &entry->insn;
+    }
+
+    uint8_t attributes;
+    uint8_t *pc_ptr = tlb_translate(state, state->tlb.fetch, pc, false, &attributes);
+    if (!pc_ptr) {
+        return NULL;
+    }
+    uint8_t window[DECODE_WINDOW];
+    if (__builtin_expect(!fits_in_page(pc, DECODE_WINDOW), 0)) {
+        pc_ptr = fetch_split(state, pc, pc_ptr, window);
+        if (!pc_ptr) {
+            return NULL;
+        }
+    }
+    decode_instruction(pc_ptr, &entry->insn);
+    entry->pc = pc;
+    entry->valid = true;
+
+    // An instruction may straddle two pages; both must invalidate it.
+    mark_code_page(cache, pc >> DECODE_PAGE_SHIFT);
+    mark_code_page(cache, (pc + entry->insn.length - 1) >> DECODE_PAGE_SHIFT);
+    return &entry->insn;
+}
+
+/**
+ * Drop every cached instruction overlapping the write [address, address + length).
+ * Writes to pages that never held decoded code cost a single bit test. The
+ * cache is direct-mapped on the offset within the page, so a short write only
+ * probes the entries that could start an instruction reaching it; data
+ * stored next to code leaves that code cached. Writes of a page or more drop
+ * every entry on the pages they touch.
+ */
+void invalidate_decoded_range(CPUState *state, uint32_t address, size_t length) {
+    DecodeCache *cache = state->decode_cache;
+    if (!cache || length == 0) {
+        return;
+    }
+    uint32_t first_page = address >> DECODE_PAGE_SHIFT;
+    uint32_t last_page  = (uint32_t) (address + length - 1) >> DECODE_PAGE_SHIFT;
+    bool touches_code = false;
+    for (uint32_t page = first_page; ; page++) {
+        touches_code |= is_code_page(cache, page);
+        if (page == last_page) break;
+    }
+    if (!touches_code) {
+        return;
+    }
+
+    if (length < DECODE_CACHE_SIZE - MAX_INSTRUCTION_LENGTH) {
+        // An instruction reaching the write starts at most MAX_INSTRUCTION_LENGTH - 1 bytes before it.
+        uint64_t end = (uint64_t) address + length;
+        uint64_t pc = address >= MAX_INSTRUCTION_LENGTH - 1 ? address - (MAX_INSTRUCTION_LENGTH - 1) : 0;
+        for (; pc < end; pc++) {
+            DecodeCacheEntry *entry = &cache->entries[pc & (DECODE_CACHE_SIZE - 1)];
+            if (entry->valid && entry->pc == pc && pc + entry->insn.length > address) {
+                entry->valid = false;
+            }
+        }
+        return;
+    }
+
+    for (uint32_t page = first_page; ; page++) {
+        if (is_code_page(cache, page)) {
+            for (size_t i = 0; i < DECODE_CACHE_SIZE; i++) {
+                DecodeCacheEntry *entry = &cache->entries[i];
+                if (!entry->valid) continue;
+                uint32_t entry_first = entry->pc >> DECODE_PAGE_SHIFT;
+                uint32_t entry_last  = (entry->pc + entry->insn.length - 1) >> DECODE_PAGE_SHIFT;
+                if (entry_first == page || entry_last == page) {
+                    entry->valid = false;
+                }
+            }
+            cache->code_pages[page >> 3] &= (uint8_t) ~(1u << (page & 7));
+        }
+        if (page == last_page) break;
+    }
+}
+
+/**
+ * Called by every guest write path: drops decoded instructions and basic
+ * blocks overlapping the written range, and records writes to the boot image
+ * so its ahead-of-time and on-disk translations are no longer trusted there.
+ */
+void invalidate_code_range(CPUState *state, uint32_t address, size_t length) {
+    invalidate_decoded_range(state, address, length);
+    invalidate_block_range(state, address, length);
+    mark_boot_image_written(state, address, length);
+}
+
+/* Forget every decoded instruction, e.g. after a new program is loaded. */
+void flush_decode_cache(CPUState *state) {
+    if (state->decode_cache) {
+        memset(state->decode_cache, 0, sizeof(DecodeCache));
+    }
+}
@@ -0,0 +1,34 @@
+//
+// dirty_pages.h
+// Marking guest pages as written: the part of dirty page tracking that sits
+// on every write path (collection is in dirty_pages.c).
+//
+// state->dirty holds one bit per guest page. The write accessors, the stack
+// engine and the bulk loaders mark the page of each byte they store, which is
+// a single OR into the bitmap. Writes that fail to translate mark nothing.
+//
+
+#ifndef NEOCORE_DIRTY_PAGES_H
+#define NEOCORE_DIRTY_PAGES_H
+
+#include "main.h"
+
+/* Mark guest page 'page' as written. */
+static inline void mark_page_dirty(CPUState *state, uint32_t page) {
+    state->dirty.words[page >> 6] |= 1ULL << (page & 63);
+}
+
+/* Mark the page holding 'address' as written. */
+static inline void mark_address_dirty(CPUState *state, uint32_t address) {
+    mark_page_dirty(state, address >> PAGE_SHIFT);
+}
+
+/* Mark every page touched by the 'length' bytes at 'address'; length > 0. */
+static inline void mark_range_dirty(CPUState *state, uint32_t address, size_t length) {
+    uint32_t last = (uint32_t) (((uint64_t) address + length - 1) >> PAGE_SHIFT);
+    for (uint32_t page = address >> PAGE_SHIFT; page <= last; page++) {
+        mark_page_dirty(state, page);
+    }
+}
+
+#endif // NEOCORE_DIRTY_PAGES_H
@@ -1,20 +1,16 @@
 #include <signal.h>
 
 #include "main.h"
+#include "alu.h"
 #include <stdio.h>
-#include "uart.h"
 // ReSharper disable once CppParameterMayBeConstPtrOrRef
-int start(AppState *appState) {
-    // debug stuff
-    appState->state->pc = calloc(1, sizeof(uint32_t));
-    appState->state->v_flag = false;
-    appState->state->z_flag = false;
-    appState->state->enable_mask_interrupts = false;
+StopReason start(AppState *appState) {
+    reset_cpu(appState);
 
     printf("Starting emulator\n");
-    bool exitCode = false;
     MemoryConfig *mc = &appState->state->memory_config;
-    printf("Memory Config: %zu sections\n", mc->section_count);
+    printf("Memory Config: %zu sections, %s backend\n", mc->section_count,
+           mc->backend == MEMORY_FLAT ? "flat" : "paged");
 
     for (size_t i = 0; i < mc->section_count; i++) {
         MemorySection *sec = &mc->sections[i];
@@ -29,40 +25,110 @@ int start(AppState *appState) {
         printf("\n");
     }
 
-    while (*(appState->state->pc) + 1 < UINT32_MAX && !exitCode) {
-        // Check if the interrupt queue is not empty.
-        if (!is_interrupt_queue_empty(appState->state->i_queue) && appState->state->enable_mask_interrupts) {
-            uint8_t irq;
-            dequeue_interrupt(appState->state->i_queue, &irq);
-            if (irq==0) {
-                uint8_t value;
-                uart_read(appState->state->uart, &value);
-                write8(appState->state, 0x10001, value);
-                printf("%02x\n", value);
-            }
-            InterruptVectorEntry *ive = get_interrupt_vector(appState->state->i_vector_table, irq);
-            if (ive != NULL) {
-                // Save the current PC as the return address.
-                uint32_t return_address = *(appState->state->pc);
-                // Push the return address onto the stack (as a 32-bit value split into 4 bytes).
-                pushStack(appState->state, (uint8_t)(return_address & 0xFF));
-                pushStack(appState->state, (uint8_t)((return_address >> 8) & 0xFF));
-                pushStack(appState->state, (uint8_t)((return_address >> 16) & 0xFF));
-                pushStack(appState->state, (uint8_t)((return_address >> 24) & 0xFF));
+    const ClockConfig *clock = &appState->state->clock.config;
+    if (clock->unthrottled || clock->frequency_hz == 0) {
+        printf("Clock: unthrottled\n");
+    } else {
+        printf("Clock: %llu Hz, paced every %u cycles\n",
+               (unsigned long long) clock->frequency_hz, clock->batch_cycles);
+    }
 
-                printf("Interrupt %d received: pushing return address 0x%08x and jumping to ISR at 0x%08x\n",
-                       irq, return_address, ive->handler_address);
+    StopReason reason;
+    if (appState->core == CORE_THREADED) {
+        printf("Using threaded interpreter core\n");
+        reason = run_cpu(appState);
+    } else if (appState->core == CORE_BLOCK) {
+        printf("Using basic block core\n");
+        reason = run_cpu(appState);
+        // Let the next run of this image start with its blocks already decoded
+        save_translation_cache(appState->state, appState->translation_cache_file);
+    } else {
+        reason = run_cpu(appState);
+    }
+    return reason;
+}
 
-                // Set the program counter to the ISR handler address.
-                *(appState->state->pc) = ive->handler_address;
-            } else {
-                printf("Interrupt %d received but no ISR registered.\n", irq);
-            }
+/* Put the CPU back at the reset vector with cleared flags and counters. */
+void reset_cpu(AppState *appState) {
+    CPUState *state = appState->state;
+    if (state->pc == NULL) {
+        state->pc = calloc(1, sizeof(uint32_t));
+    }
+    *(state->pc) = 0;
+    set_flags(state, false, false);
+    state->enable_mask_interrupts = false;
+    state->cycles = 0;
+    state->instructions = 0;
+    state->idle_cycles = 0;
+    __atomic_store_n(&state->stop_requested, 0, __ATOMIC_SEQ_CST);
+}
+
+/* The reference core: one switch dispatch per instruction. */
+static StopReason run_switch(CPUState *state) {
+    StopReason reason = STOP_NONE;
+    while (*(state->pc) + 1 < UINT32_MAX && reason == STOP_NONE) {
+        // Check if the interrupt queue is not empty. The unlocked peek keeps
+        // the queue mutex off the per-instruction path, as in the other cores.
+        if (__atomic_load_n(&state->i_queue->count, __ATOMIC_RELAXED) != 0 &&
+            state->enable_mask_interrupts) {
+            service_pending_interrupt(state);
         }
 
         // Execute the next instruction.
-        exitCode = execute_instruction(appState->state);
-        usleep(1000);
+        reason = execute_instruction(state);
+
+        // Sleep once per batch of cycles to hold the configured clock rate.
+        if (reason == STOP_NONE &&
+            state->cycles >= __atomic_load_n(&state->clock.next_sync, __ATOMIC_RELAXED)) {
+            reason = clock_sync(state);
+        }
+    }
+    return reason == STOP_NONE ? STOP_FAULT : reason;
+}
+
+/**
+ * Run the CPU on the selected core from wherever it is until it halts,
+ * faults, is asked to stop or reaches a run limit. Unlike start() this does
+ * not reset anything, so it also resumes a paused CPU.
+ */
+StopReason run_cpu(AppState *appState) {
+    // Anchor the clock now so time spent paused is not caught up on.
+    clock_reset(appState->state);
+    switch (appState->core) {
+        case CORE_THREADED:
+            return run_threaded(appState->state);
+        case CORE_BLOCK:
+            return run_blocks(appState->state);
+        default:
+            return run_switch(appState->state);
+    }
+}
+
+/**
+ * Dequeue one pending interrupt and, if an ISR is registered for it, push
+ * the current PC as the return address and vector to the handler.
+ * Returns true if the PC was redirected.
+ */
+bool service_pending_interrupt(CPUState *state) {
+    uint8_t irq;
+    if (!dequeue_interrupt(state->i_queue, &irq)) {
+        return false;
+    }
+    mmio_interrupt(state, irq);
+    InterruptVectorEntry *ive = get_interrupt_vector(state->i_vector_table, irq);
+    if (ive != NULL) {
+        // Save the current PC as the return address.
+        uint32_t return_address = *(state->pc);
+        // Push the return address onto the stack (as a 32-bit value split into 4 bytes).
+        pushStack32(state, return_address);
+
+        printf("Interrupt %d received: pushing return address 0x%08x and jumping to ISR at 0x%08x\n",
+               irq, return_address, ive->handler_address);
+
+        // Set the program counter to the ISR handler address.
+        *(state->pc) = ive->handler_address;
+        return true;
     }
-    return 0;
+    printf("Interrupt %d received but no ISR registered.\n", irq);
+    return false;
 }
@@ -3,71 +3,52 @@
 //
 
 #include "main.h"
+#include "alu.h"
 #include <stdint.h>
 #include <sys/stat.h>
 
-bool execute_instruction(CPUState *state) {
-    // Get a pointer to the current program counter (PC) address
-    uint8_t *pc_ptr = get_memory_ptr(state, *(state->pc), false);
-    if (!pc_ptr) {
+/* Fetch and execute the instruction at the PC. Returns why the CPU stopped, if it did. */
+StopReason execute_instruction(CPUState *state) {
+    // Fetch the pre-decoded instruction for the current program counter (PC)
+    const DecodedInstruction *insn = fetch_decoded(state, *(state->pc));
+    if (!insn) {
         fprintf(stderr, "Invalid memory access at PC address 0x%08x\n", *(state->pc));
-        return false;
+        return STOP_FAULT;
     }
-    //TODO!! NOT GONNA WORK ON PAGE BOUNDARY
+    uint32_t pc = *(state->pc);
+    state->cycles += insn->cycles;
+    state->instructions++;
+    if (execute_decoded(state, insn)) {
+        return STOP_HALT;
+    }
+    if (__builtin_expect(insn->handler == HANDLER_B && insn->label == pc, 0)) {
+        // b to itself: nothing changes until an interrupt arrives.
+        idle_wait(state, insn->cycles, 1);
+    }
+    return STOP_NONE;
+}
 
+/**
+ * Execute one already-decoded instruction located at the current PC and
+ * advance the PC. Returns true when the instruction halts the CPU.
+ */
+bool execute_decoded(CPUState *state, const DecodedInstruction *insn) {
     // Every instruction always has a specifier and an opcode:
-    uint8_t specifier = pc_ptr[0];
-    uint8_t opcode = pc_ptr[1];
-
-    // Many instructions use a destination register.
-    // (For instructions that are shorter than 3 bytes, this would be invalid.)
-    uint8_t rd = pc_ptr[2];
-    uint8_t mull_rn = pc_ptr[4];
-
-    // Some instructions use a source register at offset 3.
-    uint8_t rn = pc_ptr[3];
-
-
-    // Some instructions use an immediate 16-bit value.
-    // For example: "add %rd, #immediate" uses bytes 3 and 4.
-    uint16_t immediate = ((uint16_t) pc_ptr[3] << 8) | pc_ptr[4];
-
-    // Some instructions use a 32-bit value for normal addressing.
-    // For example: "add %rd, [%normAddressing]" uses bytes 3,4,5,6.
-    uint32_t normAddressing = ((uint32_t) pc_ptr[3] << 24) |
-                              ((uint32_t) pc_ptr[4] << 16) |
-                              ((uint32_t) pc_ptr[5] << 8) |
-                              pc_ptr[6];
-
-    // Branch instructions use a 32-bit label.
-    // The "b" instruction (length 6) uses bytes 2-5.
-    uint32_t label_b = ((uint32_t) pc_ptr[2] << 24) |
-                       ((uint32_t) pc_ptr[3] << 16) |
-                       ((uint32_t) pc_ptr[4] << 8) |
-                       pc_ptr[5];
-
-    // Other branch instructions (be, bne, blt, bgt) use a 32-bit label from bytes 4-7.
-    uint32_t label_branch = ((uint32_t) pc_ptr[4] << 24) |
-                            ((uint32_t) pc_ptr[5] << 16) |
-                            ((uint32_t) pc_ptr[6] << 8) |
-                            pc_ptr[7];
-
-    // Some mov instruction variants use an offset.
-    // For example, "mov %rd.L, [%rn + #offset]" (length 8) has an offset in bytes 4-7.
-    uint32_t offset = ((uint32_t) pc_ptr[4] << 24) |
-                      ((uint32_t) pc_ptr[5] << 16) |
-                      ((uint32_t) pc_ptr[6] << 8) |
-                      pc_ptr[7];
-
-    // There are also variants with two register fields.
-    // For example, "mov %rd, %rd1, [%rn + #offset]" (length 9)
-    // Here: rd is at byte 2, rd1 is at byte 3, rn is at byte 4, and the offset is bytes 5-8.
-    // uint8_t rd1 = pc_ptr[3]; // also used as rn1 in some variants
-    uint8_t rn1 = pc_ptr[3]; // note: same offset as rd1 in some encodings
-    /*uint32_t offset2 = ((uint32_t) pc_ptr[5] << 24) |
-                       ((uint32_t) pc_ptr[6] << 16) |
-                       ((uint32_t) pc_ptr[7] << 8) |
-                       pc_ptr[8];*/
+    const uint8_t specifier = insn->specifier;
+    const uint8_t opcode = insn->opcode;
+
+    // Register fields and immediates were byte-swapped once at decode time.
+    const uint8_t rd = insn->rd;
+    const uint8_t rn = insn->rn;
+    const uint8_t rn1 = insn->rn1;
+    const uint8_t mull_rn = insn->mull_rn;
+    const uint16_t immediate = insn->immediate;
+    const uint32_t normAddressing = insn->norm_address;
+    const uint32_t offset = insn->offset;
+
+    // Branch targets: bytes 2-5 for b/bro/jsr, bytes 4-7 for be/bne/blt/bgt.
+    const uint32_t label_b = insn->label;
+    const uint32_t label_branch = insn->label;
 
     bool skipIncrementPC = false; // Flag to skip incrementing the program counter
 
@@ -77,35 +58,14 @@ bool execute_instruction(CPUState *state) {
             break;
 
         case OP_ADD:
-            add(state, rd, rn, immediate, normAddressing, specifier);
-            break;
-
         case OP_SUB:
-            subtract(state, rd, rn, immediate, normAddressing, specifier);
-            break;
-
         case OP_MUL:
-            multiply(state, rd, rn, immediate, normAddressing, specifier);
-            break;
-
-        case OP_LSH:
-            left_shift(state, rd, rn, immediate, normAddressing, specifier);
-            break;
-
-        case OP_RSH:
-            right_shift(state, rd, rn, immediate, normAddressing, specifier);
-            break;
-
         case OP_AND:
-            bitwise_and(state, rd, rn, immediate, normAddressing, specifier);
-            break;
-
         case OP_OR:
-            bitwise_or(state, rd, rn, immediate, normAddressing, specifier);
-            break;
-
         case OP_XOR:
-            bitwise_xor(state, rd, rn, immediate, normAddressing, specifier);
+        case OP_LSH:
+        case OP_RSH:
+            alu_execute(state, insn);
             break;
 
         case OP_MOV:
@@ -158,8 +118,11 @@ bool execute_instruction(CPUState *state) {
         }
 
         case OP_BRO: {
-            if (state->v_flag) *(state->pc) = label_b;
-            skipIncrementPC = true;
+            // Branch on overflow; fall through to the next instruction otherwise.
+            if (get_v_flag(state)) {
+                *(state->pc) = label_b;
+                skipIncrementPC = true;
+            }
             break;
         }
         case OP_UMULL:
@@ -173,72 +136,55 @@ bool execute_instruction(CPUState *state) {
             return true;
         case OP_PSH: {
             // Push the value from the register onto the stack
-            pushStack(state, (uint8_t) (state->reg[rd] & 0xFF));
-            pushStack(state, (uint8_t) ((state->reg[rd] >> 8) & 0xFF));
+            pushStack16(state, state->reg[rd]);
             break;
         }
 
         case OP_POP: {
             // Pop the value from the stack into the register
-            uint8_t low, high;
-            if (!popStack(state, &high) || !popStack(state, &low)) {
+            if (!popStack16(state, &state->reg[rd])) {
                 fprintf(stderr, "Stack underflow while executing POP.\n");
-                break;
             }
-            state->reg[rd] = ((uint16_t) high << 8) | low;
             break;
         }
         case OP_JSR: {
             // Calculate the return address as the address following the jsr instruction.
             uint32_t return_address = *(state->pc) + 6;
             // Push the return address onto the stack (as a 32-bit value split into four bytes).
-            pushStack(state, (uint8_t) (return_address & 0xFF));
-            pushStack(state, (uint8_t) ((return_address >> 8) & 0xFF));
-            pushStack(state, (uint8_t) ((return_address >> 16) & 0xFF));
-            pushStack(state, (uint8_t) ((return_address >> 24) & 0xFF));
-
-            // Read the 32-bit target label from the instruction (bytes 2-5).
-            const uint32_t label = ((uint32_t) pc_ptr[2] << 24) |
-                                   ((uint32_t) pc_ptr[3] << 16) |
-                                   ((uint32_t) pc_ptr[4] << 8) |
-                                   pc_ptr[5];
-            *(state->pc) = label;
+            pushStack32(state, return_address);
+
+            // Jump to the 32-bit target label (bytes 2-5).
+            *(state->pc) = label_b;
             skipIncrementPC = true;
             break;
         }
         case OP_RTS: {
             // Pop a 32-bit return address from the stack (four 8-bit pops).
-            uint8_t b1, b2, b3, b4;
-            if (!popStack(state, &b1) || !popStack(state, &b2) ||
-                !popStack(state, &b3) || !popStack(state, &b4)) {
+            uint32_t return_address;
+            if (!popStack32(state, &return_address)) {
                 fprintf(stderr, "Stack underflow while executing RTS.\n");
                 break;
             }
-            const uint32_t return_address = ((uint32_t) b1 << 24) |
-                                            ((uint32_t) b2 << 16) |
-                                            ((uint32_t) b3 << 8) |
-                                            b4;
             *(state->pc) = return_address;
             skipIncrementPC = true;
             break;
         }
 
         case OP_WFI: {
-            // Wait until an interrupt is enqueued
-            pthread_mutex_lock(&state->i_queue->mutex);
-            while (state->i_queue->count == 0) {
-                // Block until signaled that an interrupt has been enqueued
-                pthread_cond_wait(&state->i_queue->cond, &state->i_queue->mutex);
-                printf("im using cpu\n");
+            // Wait until an interrupt is enqueued. If the CPU is paused
+            // instead, stay on the wfi so it waits again when resumed.
+            if (!wait_for_interrupt(state)) {
+                skipIncrementPC = true;
             }
-            pthread_mutex_unlock(&state->i_queue->mutex);
             break;
         }
         case OP_ENI: {
             state->enable_mask_interrupts = true;
+            break;
         }
         case OP_DSI: {
             state->enable_mask_interrupts = false;
+            break;
         }
         // Add additional opcodes here...
         default:
@@ -246,7 +192,7 @@ bool execute_instruction(CPUState *state) {
             break;
     }
     if (!skipIncrementPC) {
-        increment_pc(state, opcode, specifier); // Increment the program counter if not skipped
+        *(state->pc) += insn->length; // Increment the program counter if not skipped
     }
     return false;
 }
@@ -0,0 +1,203 @@
+//
+// fusion.c
+// Superinstructions: adjacent instruction pairs run as one operation.
+//
+// When a block is built, fuse_block_ops() tags the first instruction of
+// every pair it recognizes. The block interpreter (run_block_ops()) runs
+// stack pairs with a single call to execute_fused(), which performs both
+// instructions with the same kernels and in the same order as running them
+// one by one, so registers, flags, memory and the PC end up identical.
+// Register pairs already cost one indirect jump per half there, so they are
+// only counted and run back to back.
+//
+// Only pairs that cannot rewrite code are fused (the stack helpers never
+// invalidate cached code), so no self-modification check is needed between
+// the two halves. Native (JIT/AOT) blocks ignore the tags.
+//
+
+#include "main.h"
+#include "alu.h"
+
+static const char *const fusion_names[FUSION_COUNT] = {
+    [FUSION_NONE]        = "none",
+    [FUSION_MOV_IMM_ALU] = "mov #imm + alu",
+    [FUSION_SUB_BRANCH]  = "sub + be/bne/blt/bgt",
+    [FUSION_PSH_POP]     = "psh + pop",
+    [FUSION_PSH_PSH]     = "psh + psh",
+    [FUSION_POP_POP]     = "pop + pop",
+};
+
+static inline bool is_alu_handler(uint8_t handler) {
+    return handler >= HANDLER_ADD_IMM && handler <= HANDLER_RSH_MEM;
+}
+
+static inline bool is_compare_branch(uint8_t handler) {
+    return handler == HANDLER_BE || handler == HANDLER_BNE ||
+           handler == HANDLER_BLT || handler == HANDLER_BGT;
+}
+
+/* The fusion, if any, for 'first' immediately followed by 'second'. */
+static FusionKind classify_pair(const DecodedInstruction *first, const DecodedInstruction *second) {
+    switch (first->handler) {
+        case HANDLER_MOV_IMM:
+            if (is_alu_handler(second->handler) && second->rd == first->rd) {
+                return FUSION_MOV_IMM_ALU;
+            }
+            break;
+        case HANDLER_SUB_IMM:
+        case HANDLER_SUB_REG:
+        case HANDLER_SUB_MEM:
+            if (is_compare_branch(second->handler) &&
+                (second->rd == first->rd || second->rn == first->rd)) {
+                return FUSION_SUB_BRANCH;
+            }
+            break;
+        case HANDLER_PSH:
+            if (second->handler == HANDLER_POP) return FUSION_PSH_POP;
+            if (second->handler == HANDLER_PSH) return FUSION_PSH_PSH;
+            break;
+        case HANDLER_POP:
+            if (second->handler == HANDLER_POP) return FUSION_POP_POP;
+            break;
+        default:
+            break;
+    }
+    return FUSION_NONE;
+}
+
+/**
+ * Tag fusable pairs in a block's instructions, greedily from the start. The
+ * second instruction of a pair is never the first of another one.
+ */
+void fuse_block_ops(DecodedInstruction *ops, uint16_t op_count) {
+    for (uint16_t i = 0; i < op_count; i++) {
+        ops[i].fusion = FUSION_NONE;
+    }
+    for (uint16_t i = 0; i + 1 < op_count; i++) {
+        ops[i].fusion = (uint8_t) classify_pair(&ops[i], &ops[i + 1]);
+        if (ops[i].fusion != FUSION_NONE) {
+            i++;
+        }
+    }
+}
+
+/**
+ * Execute the tagged instruction 'first' and the one after it, located at
+ * the current PC, and advance the PC past both (or to the branch target).
+ */
+void execute_fused(CPUState *state, const DecodedInstruction *first) {
+    const DecodedInstruction *second = first + 1;
+    uint16_t *reg = state->reg;
+    uint32_t next_pc = *(state->pc) + first->length + second->length;
+
+    state->block_cache->fusion_hits[first->fusion]++;
+    switch (first->fusion) {
+        case FUSION_MOV_IMM_ALU:
+            reg[first->rd] = first->immediate;
+            alu_execute(state, second);
+            break;
+
+        case FUSION_SUB_BRANCH: {
+            alu_execute(state, first);
+            uint16_t a = reg[second->rd];
+            uint16_t b = reg[second->rn];
+            bool taken;
+            switch (second->handler) {
+                case HANDLER_BE:  taken = a == b; break;
+                case HANDLER_BNE: taken = a != b; break;
+                case HANDLER_BLT: taken = a < b; break;
+                default:          taken = a > b; break;
+            }
+            if (taken) {
+                next_pc = second->label;
+            }
+            break;
+        }
+
+        case FUSION_PSH_POP:
+            pushStack16(state, reg[first->rd]);
+            if (!popStack16(state, &reg[second->rd])) {
+                fprintf(stderr, "Stack underflow while executing POP.\n");
+            }
+            break;
+
+        case FUSION_PSH_PSH:
+            // psh ra; psh rb leaves ra.L, ra.H, rb.L, rb.H on the stack: one 4-byte push.
+            pushStack32(state, ((uint32_t) reg[second->rd] << 16) | reg[first->rd]);
+            break;
+
+        case FUSION_POP_POP:
+            if (!popStack16(state, &reg[first->rd])) {
+                fprintf(stderr, "Stack underflow while executing POP.\n");
+            }
+            if (!popStack16(state, &reg[second->rd])) {
+                fprintf(stderr, "Stack underflow while executing POP.\n");
+            }
+            break;
+
+        default:
+            // Not a fused pair; run both halves normally.
+            if (execute_decoded(state, first)) {
+                return;
+            }
+            execute_decoded(state, second);
+            return;
+    }
+    *(state->pc) = next_pc;
+}
+
+typedef struct {
+    uint8_t first;
+    uint8_t second;
+    uint64_t count;
+} PairCount;
+
+static int compare_pair_count(const void *a, const void *b) {
+    const PairCount *pair_a = a;
+    const PairCount *pair_b = b;
+    if (pair_a->count == pair_b->count) return 0;
+    return pair_a->count < pair_b->count ? 1 : -1;
+}
+
+/**
+ * Print how often each fusion ran, then the 'top_n' most frequently executed
+ * adjacent handler pairs in cached blocks (weighted by block executions),
+ * whether fused or not, to show which pairs are worth fusing next.
+ */
+void print_fusion_stats(CPUState *state, size_t top_n) {
+    BlockCache *cache = state->block_cache;
+    printf("Fused pairs executed:\n");
+    for (int kind = FUSION_NONE + 1; kind < FUSION_COUNT; kind++) {
+        printf("  %-22s %llu\n", fusion_names[kind], (unsigned long long) cache->fusion_hits[kind]);
+    }
+    if (top_n == 0) {
+        return;
+    }
+
+    PairCount *pairs = calloc(HANDLER_COUNT * HANDLER_COUNT, sizeof(PairCount));
+    if (!pairs) {
+        fprintf(stderr, "Memory allocation failed for fusion statistics.\n");
+        return;
+    }
+    for (size_t i = 0; i < BLOCK_CACHE_BUCKETS; i++) {
+        for (BasicBlock *block = cache->buckets[i]; block; block = block->hash_next) {
+            for (uint16_t op = 0; op + 1 < block->op_count; op++) {
+                uint8_t first = block->ops[op].handler;
+                uint8_t second = block->ops[op + 1].handler;
+                pairs[first * HANDLER_COUNT + second].count += block->exec_count;
+            }
+        }
+    }
+    for (size_t i = 0; i < HANDLER_COUNT * HANDLER_COUNT; i++) {
+        pairs[i].first = (uint8_t) (i / HANDLER_COUNT);
+        pairs[i].second = (uint8_t) (i % HANDLER_COUNT);
+    }
+    qsort(pairs, HANDLER_COUNT * HANDLER_COUNT, sizeof(PairCount), compare_pair_count);
+
+    printf("Hottest instruction pairs:\n");
+    for (size_t i = 0; i < top_n && i < HANDLER_COUNT * HANDLER_COUNT && pairs[i].count > 0; i++) {
+        printf("  %-6s %-6s %llu\n", handler_name(pairs[i].first), handler_name(pairs[i].second),
+               (unsigned long long) pairs[i].count);
+    }
+    free(pairs);
+}
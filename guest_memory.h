@@ -0,0 +1,88 @@
+//
+// guest_memory.h
+// Byte-order-explicit loads and stores on host pointers into guest pages.
+//
+// A translation is only valid up to the end of its page, so a multi-byte
+// access may use one pointer only when it fits in the page; accesses that
+// straddle two pages are split by the callers (mov.c, decode_cache.c,
+// stack.c). Instructions and data are big-endian; the stack keeps values
+// least significant byte first, as psh and jsr push them. The
+// loads and stores below are unaligned-safe and compile to a single move
+// plus a byte swap on little-endian hosts.
+//
+
+#ifndef NEOCORE_GUEST_MEMORY_H
+#define NEOCORE_GUEST_MEMORY_H
+
+#include "main.h"
+
+/* True if the 'size' bytes at 'address' lie in one page. */
+static inline bool fits_in_page(uint32_t address, uint32_t size) {
+    return (address & (PAGE_SIZE - 1)) <= PAGE_SIZE - size;
+}
+
+static inline uint16_t load_be16(const uint8_t *p) {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    return value;
+}
+
+static inline uint32_t load_be32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static inline void store_be16(uint8_t *p, uint16_t value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    memcpy(p, &value, sizeof(value));
+}
+
+static inline void store_be32(uint8_t *p, uint32_t value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    memcpy(p, &value, sizeof(value));
+}
+
+static inline uint16_t load_le16(const uint8_t *p) {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    return value;
+}
+
+static inline uint32_t load_le32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static inline void store_le16(uint8_t *p, uint16_t value) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    memcpy(p, &value, sizeof(value));
+}
+
+static inline void store_le32(uint8_t *p, uint32_t value) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    memcpy(p, &value, sizeof(value));
+}
+
+#endif // NEOCORE_GUEST_MEMORY_H
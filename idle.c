@@ -0,0 +1,184 @@
+//
+// idle.c
+// Idle-loop detection and virtual-time fast-forward.
+//
+// Firmware waiting for something to happen usually spins: a b to itself, or
+// a short loop that loads a device register and branches back while it
+// holds the same value. Such a loop computes the same registers on every
+// iteration, and the memory it reads only changes when an interrupt is
+// serviced (device register reads have no side effects, see MmioDeviceType).
+// Once one iteration has run, further iterations cannot change anything
+// until an interrupt arrives. So instead of running them, idle_wait()
+// blocks the host thread on the interrupt queue and then credits the
+// iterations that would have run in the meantime to the cycle and
+// instruction counters.
+//
+// The block core recognises both kinds of loop when a block is built. The
+// switch and threaded cores only recognise a b to itself, which costs them
+// nothing extra to detect.
+//
+
+#include "main.h"
+
+/* Bit for register 'r'; clears 'valid' for an index past the register file. */
+static inline uint32_t reg_bit(uint8_t r, bool *valid) {
+    if (r >= REGISTER_COUNT) {
+        *valid = false;
+        return 0;
+    }
+    return 1u << r;
+}
+
+/**
+ * Registers 'op' reads and writes, as bit masks. Returns false for anything
+ * an idle loop may not contain: stores, stack and subroutine operations,
+ * multiplies into register pairs, interrupt control, bro (which reads the
+ * flags) and hlt.
+ */
+static bool op_registers(const DecodedInstruction *op, uint32_t *reads, uint32_t *writes, bool *partial) {
+    bool valid = true;
+    *reads = 0;
+    *writes = 0;
+    *partial = false;
+    switch (op->handler) {
+        case HANDLER_NOP:
+        case HANDLER_B:
+            break;
+        case HANDLER_ADD_IMM: case HANDLER_SUB_IMM: case HANDLER_MUL_IMM: case HANDLER_AND_IMM:
+        case HANDLER_OR_IMM:  case HANDLER_XOR_IMM: case HANDLER_LSH_IMM: case HANDLER_RSH_IMM:
+        case HANDLER_ADD_MEM: case HANDLER_SUB_MEM: case HANDLER_MUL_MEM: case HANDLER_AND_MEM:
+        case HANDLER_OR_MEM:  case HANDLER_XOR_MEM: case HANDLER_LSH_MEM: case HANDLER_RSH_MEM:
+            *reads = *writes = reg_bit(op->rd, &valid);
+            break;
+        case HANDLER_ADD_REG: case HANDLER_SUB_REG: case HANDLER_MUL_REG: case HANDLER_AND_REG:
+        case HANDLER_OR_REG:  case HANDLER_XOR_REG: case HANDLER_LSH_REG: case HANDLER_RSH_REG:
+            *reads = reg_bit(op->rd, &valid) | reg_bit(op->rn, &valid);
+            *writes = reg_bit(op->rd, &valid);
+            break;
+        case HANDLER_MOV_IMM:
+            *writes = reg_bit(op->rd, &valid);
+            break;
+        case HANDLER_MOV_IMM32:
+            *writes = reg_bit(op->rd, &valid) | reg_bit(op->rn, &valid);
+            break;
+        case HANDLER_MOV_REG:
+            *reads = reg_bit(op->rd, &valid);
+            *writes = reg_bit(op->rn, &valid);
+            break;
+        case HANDLER_MOV_MEMORY:
+            switch (op->specifier) {
+                case 0x03:  // rd.L <- [address]
+                case 0x04:  // rd.H <- [address]
+                    *reads = *writes = reg_bit(op->rd & 0x3F, &valid);
+                    *partial = true;
+                    break;
+                case 0x05:  // rd <- [address]
+                    *writes = reg_bit(op->rd, &valid);
+                    break;
+                case 0x06:  // rd:rn1 <- [address]
+                    *writes = reg_bit(op->rd, &valid) | reg_bit(op->rn1, &valid);
+                    break;
+                default:
+                    return false;
+            }
+            break;
+        case HANDLER_BE:
+        case HANDLER_BNE:
+        case HANDLER_BLT:
+        case HANDLER_BGT:
+            *reads = reg_bit(op->rd, &valid) | reg_bit(op->rn, &valid);
+            break;
+        default:
+            return false;
+    }
+    return valid;
+}
+
+/**
+ * True if 'block' branches back to its own start and an iteration leaves
+ * the registers exactly as the previous one did, given unchanged memory:
+ * no instruction stores, and no register the loop writes is read before
+ * the same iteration has written it. A byte load into half a register keeps
+ * the other half, which only matters if another instruction changes it.
+ */
+bool is_idle_loop(const BasicBlock *block) {
+    if (block->op_count == 0 || !block->has_taken_exit || block->taken_pc != block->start_pc) {
+        return false;
+    }
+
+    uint32_t reads, writes, written = 0, fully_written = 0;
+    bool partial;
+    for (uint16_t i = 0; i < block->op_count; i++) {
+        if (!op_registers(&block->ops[i], &reads, &writes, &partial)) {
+            return false;
+        }
+        written |= writes;
+        if (!partial) {
+            fully_written |= writes;
+        }
+    }
+
+    uint32_t defined = 0;
+    for (uint16_t i = 0; i < block->op_count; i++) {
+        op_registers(&block->ops[i], &reads, &writes, &partial);
+        if (partial) {
+            reads &= fully_written;
+        }
+        if (reads & written & ~defined) {
+            return false;  // Carries a value from the previous iteration
+        }
+        defined |= writes;
+    }
+    return true;
+}
+
+/**
+ * Called with the PC back at the start of an idle loop that has just run
+ * once and takes 'loop_cycles' cycles and 'loop_instructions' instructions
+ * per iteration. Waits until an interrupt is enqueued, a stop is requested
+ * or a run limit would be reached, then advances the counters by the whole
+ * iterations that fit in the time waited. Unthrottled, there is no time to
+ * account for, so the CPU skips straight to a run limit if there is one.
+ */
+void idle_wait(CPUState *state, uint32_t loop_cycles, uint32_t loop_instructions) {
+    InterruptQueue *queue = state->i_queue;
+    if (loop_cycles == 0 || is_cpu_stop_requested(state)) {
+        return;
+    }
+    // Read before checking the queue, so an interrupt enqueued from here on ends the wait.
+    uint32_t seen = __atomic_load_n(&queue->enqueued, __ATOMIC_ACQUIRE);
+    if (state->enable_mask_interrupts && __atomic_load_n(&queue->count, __ATOMIC_RELAXED) != 0) {
+        return;  // The core takes it before the next iteration.
+    }
+
+    uint64_t horizon = clock_limit_horizon(state);
+    uint64_t room = horizon > state->cycles ? (horizon - state->cycles) / loop_cycles : 0;
+    if (room == 0) {
+        return;
+    }
+
+    uint64_t iterations;
+    if (clock_is_paced(state)) {
+        if (horizon != UINT64_MAX) {
+            struct timespec deadline;
+            clock_time_at(state, state->cycles + room * loop_cycles, &deadline);
+            wait_for_interrupt_event(state, seen, &deadline);
+        } else {
+            wait_for_interrupt_event(state, seen, NULL);
+        }
+        uint64_t due = clock_cycles_now(state);
+        iterations = due > state->cycles ? (due - state->cycles) / loop_cycles : 0;
+        if (iterations > room) {
+            iterations = room;
+        }
+    } else if (horizon != UINT64_MAX) {
+        iterations = room;
+    } else {
+        wait_for_interrupt_event(state, seen, NULL);
+        iterations = 0;
+    }
+
+    state->cycles += iterations * loop_cycles;
+    state->instructions += iterations * loop_instructions;
+    state->idle_cycles += iterations * loop_cycles;
+}
@@ -3,6 +3,8 @@
 //
 #include "main.h"
 
+#include <strings.h>
+
 #define MAX_LINE_LENGTH 256
 
 // Helper function to trim leading/trailing whitespace
@@ -26,8 +28,49 @@ PageType parse_page_type(const char *type_str) {
     return UNKNOWN_TYPE;
 }
 
-// Main INI file parser function
-int parse_ini_file(const char *filename, MemoryConfig *config) {
+// Parse a clock frequency such as "1000000", "8M" or "32768" into Hz
+static uint64_t parse_frequency(const char *value) {
+    char *end;
+    uint64_t frequency = strtoull(value, &end, 0);
+    switch (toupper((unsigned char) *end)) {
+        case 'K': frequency *= 1000ull; break;
+        case 'M': frequency *= 1000000ull; break;
+        case 'G': frequency *= 1000000000ull; break;
+        default: break;
+    }
+    return frequency;
+}
+
+static bool parse_bool(const char *value) {
+    return strcmp(value, "1") == 0 || strcasecmp(value, "true") == 0 ||
+           strcasecmp(value, "yes") == 0 || strcasecmp(value, "on") == 0;
+}
+
+// Key-value pair within the [Emulator] section
+static void parse_emulator_key(const char *key, const char *value, MemoryConfig *config, ClockConfig *clock) {
+    if (strcmp(key, "memory_backend") == 0) {
+        if (strcasecmp(value, "flat") == 0) {
+            config->backend = MEMORY_FLAT;
+        } else if (strcasecmp(value, "paged") == 0) {
+            config->backend = MEMORY_PAGED;
+        } else {
+            fprintf(stderr, "Unknown memory backend: %s (expected paged or flat)\n", value);
+        }
+    } else if (strcmp(key, "frequency") == 0) {
+        clock->frequency_hz = parse_frequency(value);
+    } else if (strcmp(key, "unthrottled") == 0) {
+        clock->unthrottled = parse_bool(value);
+    } else if (strcmp(key, "batch_cycles") == 0) {
+        clock->batch_cycles = strtoul(value, NULL, 0);
+    } else {
+        fprintf(stderr, "Unknown key: %s\n", key);
+    }
+}
+
+// Main INI file parser function. Every section describes a memory region,
+// except [Emulator], which configures the clock and the memory backend.
+// The memory configuration is only replaced if the whole file is valid.
+int parse_ini_file(const char *filename, MemoryConfig *config, ClockConfig *clock) {
     FILE *file = fopen(filename, "r");
     if (!file) {
         perror("Error opening file");
@@ -36,13 +79,10 @@ int parse_ini_file(const char *filename, MemoryConfig *config) {
 
     char line[MAX_LINE_LENGTH];
     MemorySection *current_section = NULL;
-    memset(config, 0, sizeof(MemoryConfig)); // Clear memory
-    for (int i = 0; i < MAX_SECTIONS; i++) { // Assuming MAX_SECTIONS is defined
-        config->sections[i].type = USABLE_MEMORY; // Default type
-        config->sections[i].start_address = 0; // Default start address
-        config->sections[i].page_count = 0; // Default page count
-        config->sections[i].device[0] = '\0'; // Default empty device
-    }
+    bool in_emulator_section = false;
+    MemoryConfig parsed;
+    memset(&parsed, 0, sizeof(MemoryConfig));
+    clock_default_config(clock);
 
     while (fgets(line, sizeof(line), file)) {
         char *trimmed_line = trim_whitespace(line);
@@ -58,28 +98,40 @@ int parse_ini_file(const char *filename, MemoryConfig *config) {
             if (!end) {
                 fprintf(stderr, "Malformed section header: %s\n", trimmed_line);
                 fclose(file);
+                free_memory_config(&parsed);
                 return -1;
             }
             *end = '\0';
-            current_section = &config->sections[config->section_count++];
+            in_emulator_section = strcasecmp(trimmed_line + 1, "Emulator") == 0;
+            if (in_emulator_section) {
+                current_section = NULL;
+                continue;
+            }
+            current_section = add_memory_section(&parsed);
+            if (!current_section) {
+                fclose(file);
+                free_memory_config(&parsed);
+                return -1;
+            }
             strncpy(current_section->section_name, trimmed_line + 1, sizeof(current_section->section_name) - 1);
             current_section->section_name[sizeof(current_section->section_name) - 1] = '\0';
             current_section->type = UNKNOWN_TYPE;
-            current_section->page_count = 0;
-            current_section->device[0] = '\0';
-        } else if (current_section) {
+        } else if (current_section || in_emulator_section) {
             // Key-value pair within a section
             char *equals = strchr(trimmed_line, '=');
             if (!equals) {
                 fprintf(stderr, "Malformed key-value pair: %s\n", trimmed_line);
                 fclose(file);
+                free_memory_config(&parsed);
                 return -1;
             }
             *equals = '\0';
             char *key = trim_whitespace(trimmed_line);
             char *value = trim_whitespace(equals + 1);
 
-            if (strcmp(key, "type") == 0) {
+            if (in_emulator_section) {
+                parse_emulator_key(key, value, &parsed, clock);
+            } else if (strcmp(key, "type") == 0) {
                 current_section->type = parse_page_type(value);
             } else if (strcmp(key, "start_address") == 0) {
                 current_section->start_address = strtoul(value, NULL, 0);
@@ -95,5 +147,11 @@ int parse_ini_file(const char *filename, MemoryConfig *config) {
     }
 
     fclose(file);
+    if (!compile_memory_map(&parsed)) {
+        free_memory_config(&parsed);
+        return -1;
+    }
+    free_memory_config(config);
+    *config = parsed;
     return 0;
 }
@@ -67,8 +67,14 @@ InterruptQueue* init_interrupt_queue(void) {
     queue->head = 0;
     queue->tail = 0;
     queue->count = 0;
+    queue->enqueued = 0;
     pthread_mutex_init(&queue->mutex, NULL);
-    pthread_cond_init(&queue->cond, NULL);
+    // Waits are timed against CLOCK_MONOTONIC, like the guest clock.
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&queue->cond, &attr);
+    pthread_condattr_destroy(&attr);
     return queue;
 }
 
@@ -83,7 +89,8 @@ bool enqueue_interrupt(InterruptQueue *queue, uint8_t irq) {
     queue->queue[queue->tail] = irq;
     queue->tail = (queue->tail + 1) % IRQ_QUEUE_SIZE;
     queue->count++;
-    // Signal any thread waiting in the WFI instruction
+    queue->enqueued++;
+    // Signal a CPU waiting in wfi or in an idle loop
     pthread_cond_signal(&queue->cond);
     pthread_mutex_unlock(&queue->mutex);
     return true;
@@ -118,3 +125,62 @@ bool is_interrupt_queue_full(InterruptQueue *queue) {
     pthread_mutex_unlock(&queue->mutex);
     return full;
 }
+
+/* The earlier of 'deadline' (NULL for none) and one poll interval from now. */
+static void next_wakeup(const struct timespec *deadline, struct timespec *wakeup) {
+    clock_gettime(CLOCK_MONOTONIC, wakeup);
+    wakeup->tv_nsec += WFI_POLL_INTERVAL_MS * 1000000L;
+    if (wakeup->tv_nsec >= 1000000000L) {
+        wakeup->tv_sec++;
+        wakeup->tv_nsec -= 1000000000L;
+    }
+    if (deadline && (deadline->tv_sec < wakeup->tv_sec ||
+                     (deadline->tv_sec == wakeup->tv_sec && deadline->tv_nsec < wakeup->tv_nsec))) {
+        *wakeup = *deadline;
+    }
+}
+
+static bool deadline_passed(const struct timespec *deadline) {
+    if (!deadline) {
+        return false;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > deadline->tv_sec ||
+           (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+/**
+ * Block a CPU executing wfi until an interrupt is pending. Returns false,
+ * leaving the interrupt unserviced, if a stop was requested meanwhile; the
+ * wait wakes every WFI_POLL_INTERVAL_MS to notice requests made from signal
+ * handlers, which cannot signal the condition variable.
+ */
+bool wait_for_interrupt(CPUState *state) {
+    InterruptQueue *queue = state->i_queue;
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0 && !is_cpu_stop_requested(state)) {
+        struct timespec wakeup;
+        next_wakeup(NULL, &wakeup);
+        pthread_cond_timedwait(&queue->cond, &queue->mutex, &wakeup);
+    }
+    bool pending = queue->count != 0;
+    pthread_mutex_unlock(&queue->mutex);
+    return pending;
+}
+
+/**
+ * Block a CPU spinning in an idle loop until an interrupt is enqueued after
+ * 'seen' (an earlier value of queue->enqueued), a stop is requested or the
+ * CLOCK_MONOTONIC time 'deadline' passes. A NULL deadline waits without one.
+ */
+void wait_for_interrupt_event(CPUState *state, uint32_t seen, const struct timespec *deadline) {
+    InterruptQueue *queue = state->i_queue;
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->enqueued == seen && !is_cpu_stop_requested(state) && !deadline_passed(deadline)) {
+        struct timespec wakeup;
+        next_wakeup(deadline, &wakeup);
+        pthread_cond_timedwait(&queue->cond, &queue->mutex, &wakeup);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+}
@@ -0,0 +1,418 @@
+//
+// jit_x86_64.c
+// Dynamic binary translator from hot NeoCore basic blocks to x86-64.
+//
+// Register-only instructions (ALU ops, the register forms of mov, umull,
+// smull and the branches) are emitted as native code. Everything that
+// touches memory, MMIO or the stack calls back into execute_decoded() so
+// read*/write*, pushStack and popStack stay the single source of truth.
+// Blocks ending in hlt or wfi are left to the interpreter.
+//
+// Generated functions follow the SysV ABI: rdi = CPUState *, eax = next PC.
+// rbx holds the CPUState, r12 the register file and r13 the PC pointer.
+//
+
+#include "main.h"
+#include <stddef.h>
+
+#if defined(__x86_64__)
+
+#define RAX 0
+#define RCX 1
+#define RDX 2
+
+// Worst-case bytes emitted for one guest instruction, plus prologue/epilogue.
+#define JIT_MAX_OP_BYTES 64
+#define JIT_FRAME_BYTES 64
+
+typedef struct {
+    uint8_t *cursor;
+} Emitter;
+
+static inline void emit8(Emitter *e, uint8_t value) {
+    *e->cursor++ = value;
+}
+
+static inline void emit32(Emitter *e, uint32_t value) {
+    memcpy(e->cursor, &value, sizeof(value));
+    e->cursor += sizeof(value);
+}
+
+static inline void emit64(Emitter *e, uint64_t value) {
+    memcpy(e->cursor, &value, sizeof(value));
+    e->cursor += sizeof(value);
+}
+
+static inline void emit_bytes(Emitter *e, const uint8_t *bytes, size_t count) {
+    memcpy(e->cursor, bytes, count);
+    e->cursor += count;
+}
+
+// movzx r32, word [r12 + reg*2]
+static void emit_load_reg(Emitter *e, uint8_t dst, uint8_t guest_reg) {
+    emit_bytes(e, (const uint8_t[]) {0x41, 0x0F, 0xB7, (uint8_t) (0x80 | (dst << 3) | 4), 0x24}, 5);
+    emit32(e, guest_reg * sizeof(uint16_t));
+}
+
+// movsx r32, word [r12 + reg*2]
+static void emit_load_reg_signed(Emitter *e, uint8_t dst, uint8_t guest_reg) {
+    emit_bytes(e, (const uint8_t[]) {0x41, 0x0F, 0xBF, (uint8_t) (0x80 | (dst << 3) | 4), 0x24}, 5);
+    emit32(e, guest_reg * sizeof(uint16_t));
+}
+
+// mov word [r12 + reg*2], r16
+static void emit_store_reg(Emitter *e, uint8_t src, uint8_t guest_reg) {
+    emit_bytes(e, (const uint8_t[]) {0x66, 0x41, 0x89, (uint8_t) (0x80 | (src << 3) | 4), 0x24}, 5);
+    emit32(e, guest_reg * sizeof(uint16_t));
+}
+
+// mov word [r12 + reg*2], imm16
+static void emit_store_reg_imm(Emitter *e, uint8_t guest_reg, uint16_t value) {
+    emit_bytes(e, (const uint8_t[]) {0x66, 0x41, 0xC7, 0x84, 0x24}, 5);
+    emit32(e, guest_reg * sizeof(uint16_t));
+    emit8(e, value & 0xFF);
+    emit8(e, value >> 8);
+}
+
+// mov r32, imm32
+static void emit_mov_imm(Emitter *e, uint8_t dst, uint32_t value) {
+    emit8(e, (uint8_t) (0xB8 + dst));
+    emit32(e, value);
+}
+
+// mov dword [r13], imm32 -- publish the guest PC before calling a helper
+static void emit_store_pc(Emitter *e, uint32_t pc) {
+    emit_bytes(e, (const uint8_t[]) {0x41, 0xC7, 0x45, 0x00}, 4);
+    emit32(e, pc);
+}
+
+static void emit_epilogue(Emitter *e) {
+    // pop r13; pop r12; pop rbx; ret
+    emit_bytes(e, (const uint8_t[]) {0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3}, 6);
+}
+
+// Return the PC the interpreter left in *state->pc.
+static void emit_exit_current_pc(Emitter *e) {
+    emit_bytes(e, (const uint8_t[]) {0x41, 0x8B, 0x45, 0x00}, 4);  // mov eax, [r13]
+    emit_epilogue(e);
+}
+
+static void emit_exit_to(Emitter *e, uint32_t pc) {
+    emit_mov_imm(e, RAX, pc);
+    emit_epilogue(e);
+}
+
+// mov rdi, rbx; [mov rsi, imm64 | mov esi, imm32]; mov rax, imm64; call rax
+static void emit_call(Emitter *e, uint64_t function, uint64_t second_arg, bool wide_arg) {
+    emit_bytes(e, (const uint8_t[]) {0x48, 0x89, 0xDF}, 3);
+    if (wide_arg) {
+        emit_bytes(e, (const uint8_t[]) {0x48, 0xBE}, 2);
+        emit64(e, second_arg);
+    } else {
+        emit8(e, 0xBE);
+        emit32(e, (uint32_t) second_arg);
+    }
+    emit_bytes(e, (const uint8_t[]) {0x48, 0xB8}, 2);
+    emit64(e, function);
+    emit_bytes(e, (const uint8_t[]) {0xFF, 0xD0}, 2);
+}
+
+/* Interpreter callback; returns true if the instruction invalidated cached code. */
+static bool jit_interpret(CPUState *state, const DecodedInstruction *insn) {
+    uint32_t generation = state->block_cache->generation;
+    execute_decoded(state, insn);
+    return state->block_cache->generation != generation;
+}
+
+static void emit_interpret(Emitter *e, uint32_t pc, const DecodedInstruction *insn) {
+    emit_store_pc(e, pc);
+    emit_call(e, (uint64_t) (uintptr_t) jit_interpret, (uint64_t) (uintptr_t) insn, true);
+    // test al, al; jz +10 (skip the early-exit sequence below)
+    emit_bytes(e, (const uint8_t[]) {0x84, 0xC0, 0x74, 0x0A}, 4);
+    emit_exit_current_pc(e);
+}
+
+/* ALU: eax = a, ecx = b; leaves the 32-bit result in eax. */
+static void emit_alu_op(Emitter *e, uint8_t opcode) {
+    switch (opcode) {
+        case OP_ADD: emit_bytes(e, (const uint8_t[]) {0x01, 0xC8}, 2); break;        // add eax, ecx
+        case OP_SUB:
+            // Saturate at zero like alu_sub(): xor edx, edx; sub eax, ecx; cmovb eax, edx
+            emit_bytes(e, (const uint8_t[]) {0x31, 0xD2, 0x29, 0xC8, 0x0F, 0x42, 0xC2}, 7);
+            break;
+        case OP_MUL: emit_bytes(e, (const uint8_t[]) {0x0F, 0xAF, 0xC1}, 3); break;  // imul eax, ecx
+        case OP_AND: emit_bytes(e, (const uint8_t[]) {0x21, 0xC8}, 2); break;        // and eax, ecx
+        case OP_OR:  emit_bytes(e, (const uint8_t[]) {0x09, 0xC8}, 2); break;        // or eax, ecx
+        case OP_XOR: emit_bytes(e, (const uint8_t[]) {0x31, 0xC8}, 2); break;        // xor eax, ecx
+        case OP_LSH: emit_bytes(e, (const uint8_t[]) {0xD3, 0xE0}, 2); break;        // shl eax, cl
+        case OP_RSH: emit_bytes(e, (const uint8_t[]) {0xD3, 0xE8}, 2); break;        // shr eax, cl
+        default: break;
+    }
+}
+
+static void emit_alu(Emitter *e, const DecodedInstruction *insn) {
+    switch (insn->specifier) {
+        case 0x00:
+            emit_load_reg(e, RAX, insn->rd);
+            emit_mov_imm(e, RCX, insn->immediate);
+            break;
+        case 0x01:
+            emit_load_reg(e, RAX, insn->rn);
+            emit_load_reg(e, RCX, insn->rd);
+            break;
+        default:
+            emit_call(e, (uint64_t) (uintptr_t) get_memory, insn->norm_address, false);
+            emit_bytes(e, (const uint8_t[]) {0x0F, 0xB6, 0xC8}, 3);  // movzx ecx, al
+            emit_load_reg(e, RAX, insn->rd);
+            break;
+    }
+    emit_alu_op(e, insn->opcode);
+
+    // Flags are lazy: keep the full result, bro derives V from it.
+    emit_bytes(e, (const uint8_t[]) {0x89, 0x83}, 2);            // mov [rbx + flags_result], eax
+    emit32(e, offsetof(CPUState, flags_result));
+    emit_store_reg(e, RAX, insn->rd);
+}
+
+static void emit_multiply_long(Emitter *e, const DecodedInstruction *insn, bool is_signed) {
+    if (is_signed) {
+        emit_load_reg_signed(e, RAX, insn->rd);
+        emit_load_reg_signed(e, RCX, insn->mull_rn);
+    } else {
+        emit_load_reg(e, RAX, insn->rd);
+        emit_load_reg(e, RCX, insn->mull_rn);
+    }
+    emit_bytes(e, (const uint8_t[]) {0x0F, 0xAF, 0xC1}, 3);      // imul eax, ecx
+    emit_store_reg(e, RAX, insn->rd);
+    emit_bytes(e, (const uint8_t[]) {0xC1, is_signed ? 0xF8 : 0xE8, 16}, 3);  // sar/shr eax, 16
+    emit_store_reg(e, RAX, insn->rn1);
+}
+
+/* Conditional exit: eax = condition ? label : fallthrough. */
+static void emit_conditional_exit(Emitter *e, uint8_t cmov_opcode, uint32_t taken, uint32_t fallthrough) {
+    emit_mov_imm(e, RAX, fallthrough);
+    emit_mov_imm(e, RDX, taken);
+    emit_bytes(e, (const uint8_t[]) {0x0F, cmov_opcode, 0xC2}, 3);  // cmovcc eax, edx
+    emit_epilogue(e);
+}
+
+static void emit_compare_branch(Emitter *e, const DecodedInstruction *insn, uint32_t pc) {
+    uint8_t cmov_opcode;
+    switch (insn->opcode) {
+        case OP_BE:  cmov_opcode = 0x44; break;  // cmove
+        case OP_BNE: cmov_opcode = 0x45; break;  // cmovne
+        case OP_BLT: cmov_opcode = 0x42; break;  // cmovb
+        default:     cmov_opcode = 0x47; break;  // cmova
+    }
+    emit_load_reg(e, RAX, insn->rd);
+    emit_load_reg(e, RCX, insn->rn);
+    emit_bytes(e, (const uint8_t[]) {0x39, 0xC8}, 2);            // cmp eax, ecx
+    emit_conditional_exit(e, cmov_opcode, insn->label, pc + insn->length);
+}
+
+/*
+ * True if the register operands native code addresses directly lie in the
+ * 16-entry register file. Only the fields each handler reads as registers
+ * are checked; in the other forms the same bytes are immediates, addresses
+ * or label bytes. Instructions run through emit_interpret() need no check.
+ */
+static bool has_native_registers(const DecodedInstruction *insn) {
+    uint8_t handler = insn->handler;
+    if (handler >= HANDLER_ADD_IMM && handler <= HANDLER_RSH_MEM) {
+        bool register_form = (handler - HANDLER_ADD_IMM) % 3 == 1;
+        return insn->rd < 16 && (!register_form || insn->rn < 16);
+    }
+    switch (handler) {
+        case HANDLER_MOV_IMM:
+            return insn->rd < 16;
+        case HANDLER_MOV_IMM32:
+        case HANDLER_MOV_REG:
+        case HANDLER_BE:
+        case HANDLER_BNE:
+        case HANDLER_BLT:
+        case HANDLER_BGT:
+            return insn->rd < 16 && insn->rn < 16;
+        case HANDLER_UMULL:
+        case HANDLER_SMULL:
+            return insn->rd < 16 && insn->rn1 < 16 && insn->mull_rn < 16;
+        default:
+            return true;
+    }
+}
+
+/* Returns false if the block contains something the JIT refuses to translate. */
+static bool is_translatable(const BasicBlock *block) {
+    for (uint16_t i = 0; i < block->op_count; i++) {
+        const DecodedInstruction *insn = &block->ops[i];
+        if (insn->opcode == OP_HLT || insn->opcode == OP_WFI || !has_native_registers(insn)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+JitCompiler* create_jit_compiler(void) {
+    JitCompiler *jit = calloc(1, sizeof(JitCompiler));
+    if (!jit) {
+        fprintf(stderr, "Failed to allocate memory for JitCompiler.\n");
+        exit(EXIT_FAILURE);
+    }
+    jit->buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->buffer == MAP_FAILED) {
+        perror("JIT: mmap code buffer");
+        free(jit);
+        return NULL;
+    }
+    jit->capacity = JIT_BUFFER_SIZE;
+    return jit;
+}
+
+void free_jit_compiler(JitCompiler *jit) {
+    if (!jit) {
+        return;
+    }
+    munmap(jit->buffer, jit->capacity);
+    free(jit);
+}
+
+/* Throw away all generated code; only called between blocks. */
+static void reset_jit_buffer(CPUState *state) {
+    BlockCache *cache = state->block_cache;
+    for (size_t i = 0; i < BLOCK_CACHE_BUCKETS; i++) {
+        for (BasicBlock *block = cache->buckets[i]; block; block = block->hash_next) {
+            block->jit_code = NULL;
+        }
+    }
+    state->jit->used = 0;
+}
+
+/**
+ * Translate 'block' into native code. On success block->jit_code is set;
+ * otherwise block->jit_failed is set and the block stays interpreted.
+ */
+bool jit_compile_block(CPUState *state, BasicBlock *block) {
+    JitCompiler *jit = state->jit;
+    if (!jit || !is_translatable(block)) {
+        block->jit_failed = true;
+        return false;
+    }
+
+    size_t worst_case = JIT_FRAME_BYTES + (size_t) block->op_count * JIT_MAX_OP_BYTES;
+    if (jit->used + worst_case > jit->capacity) {
+        reset_jit_buffer(state);
+    }
+
+    uint8_t *start = jit->buffer + jit->used;
+    if (mprotect(jit->buffer, jit->capacity, PROT_READ | PROT_WRITE) != 0) {
+        perror("JIT: mprotect RW");
+        block->jit_failed = true;
+        return false;
+    }
+
+    Emitter e = { .cursor = start };
+    // push rbx; push r12; push r13; mov rbx, rdi
+    emit_bytes(&e, (const uint8_t[]) {0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xFB}, 8);
+    emit_bytes(&e, (const uint8_t[]) {0x4C, 0x8B, 0xA3}, 3);     // mov r12, [rbx + reg]
+    emit32(&e, offsetof(CPUState, reg));
+    emit_bytes(&e, (const uint8_t[]) {0x4C, 0x8B, 0xAB}, 3);     // mov r13, [rbx + pc]
+    emit32(&e, offsetof(CPUState, pc));
+
+    uint32_t pc = block->start_pc;
+    bool terminated = false;
+    for (uint16_t i = 0; i < block->op_count; i++) {
+        const DecodedInstruction *insn = &block->ops[i];
+        switch (insn->handler) {
+            case HANDLER_NOP:
+                break;
+            case HANDLER_ADD_IMM: case HANDLER_ADD_REG: case HANDLER_ADD_MEM:
+            case HANDLER_SUB_IMM: case HANDLER_SUB_REG: case HANDLER_SUB_MEM:
+            case HANDLER_MUL_IMM: case HANDLER_MUL_REG: case HANDLER_MUL_MEM:
+            case HANDLER_AND_IMM: case HANDLER_AND_REG: case HANDLER_AND_MEM:
+            case HANDLER_OR_IMM:  case HANDLER_OR_REG:  case HANDLER_OR_MEM:
+            case HANDLER_XOR_IMM: case HANDLER_XOR_REG: case HANDLER_XOR_MEM:
+            case HANDLER_LSH_IMM: case HANDLER_LSH_REG: case HANDLER_LSH_MEM:
+            case HANDLER_RSH_IMM: case HANDLER_RSH_REG: case HANDLER_RSH_MEM:
+                emit_alu(&e, insn);
+                break;
+            case HANDLER_MOV_IMM:
+                emit_store_reg_imm(&e, insn->rd, insn->immediate);
+                break;
+            case HANDLER_MOV_IMM32:
+                emit_store_reg_imm(&e, insn->rd, (uint16_t) (insn->offset >> 16));
+                emit_store_reg_imm(&e, insn->rn, (uint16_t) insn->offset);
+                break;
+            case HANDLER_MOV_REG:
+                emit_load_reg(&e, RAX, insn->rd);
+                emit_store_reg(&e, RAX, insn->rn);
+                break;
+            case HANDLER_UMULL:
+                emit_multiply_long(&e, insn, false);
+                break;
+            case HANDLER_SMULL:
+                emit_multiply_long(&e, insn, true);
+                break;
+            case HANDLER_B:
+                emit_exit_to(&e, insn->label);
+                terminated = true;
+                break;
+            case HANDLER_BE:
+            case HANDLER_BNE:
+            case HANDLER_BLT:
+            case HANDLER_BGT:
+                emit_compare_branch(&e, insn, pc);
+                terminated = true;
+                break;
+            case HANDLER_BRO:
+                emit_bytes(&e, (const uint8_t[]) {0x81, 0xBB}, 2);        // cmp dword [rbx + flags_result], 0xFFFF
+                emit32(&e, offsetof(CPUState, flags_result));
+                emit32(&e, UINT16_MAX);
+                emit_conditional_exit(&e, 0x47, insn->label, pc + insn->length);  // cmova
+                terminated = true;
+                break;
+            case HANDLER_JSR:
+            case HANDLER_RTS:
+                // Stack helpers set the PC themselves.
+                emit_interpret(&e, pc, insn);
+                emit_exit_current_pc(&e);
+                terminated = true;
+                break;
+            default:
+                // Memory, MMIO, stack and interrupt-mask instructions.
+                emit_interpret(&e, pc, insn);
+                break;
+        }
+        pc += insn->length;
+    }
+    if (!terminated) {
+        emit_exit_to(&e, block->end_pc);
+    }
+
+    jit->used += (size_t) (e.cursor - start);
+    if (mprotect(jit->buffer, jit->capacity, PROT_READ | PROT_EXEC) != 0) {
+        perror("JIT: mprotect RX");
+        exit(EXIT_FAILURE);
+    }
+    __builtin___clear_cache((char *) start, (char *) e.cursor);
+
+    block->jit_code = (NativeBlockFn) (uintptr_t) start;
+    jit->compiled_blocks++;
+    return true;
+}
+
+#else
+
+JitCompiler* create_jit_compiler(void) {
+    fprintf(stderr, "JIT is only available on x86-64 hosts; using the interpreter.\n");
+    return NULL;
+}
+
+void free_jit_compiler(__attribute__((unused)) JitCompiler *jit) {
+}
+
+bool jit_compile_block(__attribute__((unused)) CPUState *state, BasicBlock *block) {
+    block->jit_failed = true;
+    return false;
+}
+
+#endif
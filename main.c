@@ -9,7 +9,13 @@
 
 #define SOCKET_PATH "/tmp/emulator.sock"
 
+// CPU paused by Ctrl+C; request_cpu_stop() only does atomic stores.
+static CPUState *sigint_cpu = NULL;
+
 void sigintHandler(__attribute__((unused)) int signal) {
+    if (sigint_cpu) {
+        request_cpu_stop(sigint_cpu);
+    }
     fflush(stdout);
 }
 
@@ -22,13 +28,24 @@ typedef struct {
 
 void command_start(AppState *appState, __attribute__((unused)) const char *args);
 void command_stop(AppState *appState, __attribute__((unused)) const char *args);
+void command_resume(AppState *appState, __attribute__((unused)) const char *args);
+void command_step(AppState *appState, const char *args);
+void command_run_until(AppState *appState, const char *args);
 void command_program(AppState *appState, const char *args);
 void command_flash(AppState *appState, const char *args);
 void command_help(__attribute__((unused)) AppState *appState, __attribute__((unused)) const char *args);
 void command_exit(__attribute__((unused)) AppState *appState, __attribute__((unused)) const char *args);
 void command_interrupt(AppState *appState, const char *args);
+void command_blocks(AppState *appState, const char *args);
+void command_fusions(AppState *appState, const char *args);
+void command_reclaim(AppState *appState, const char *args);
+void command_checkpoint(AppState *appState, const char *args);
+void command_restore(AppState *appState, const char *args);
+bool load_program_file(AppState *appState);
+int run_headless(AppState *appState);
 void load_config(AppState *appState, const char *filename);
 void display_config(const MemoryConfig *config);
+void display_clock_config(const ClockConfig *clock);
 
 // Command to preview current memory configuration
 void command_view_config(AppState *appState, __attribute__((unused)) const char *args);
@@ -39,12 +56,21 @@ void command_reload_config(AppState *appState, const char *args);
 const Command COMMANDS[] = {
         {"start", command_start},
         {"stop", command_stop},
+        {"pause", command_stop},
+        {"resume", command_resume},
+        {"step", command_step},
+        {"run_until", command_run_until},
         {"program", command_program},
         {"flash", command_flash},
         {"help", command_help},
         {"h", command_help},
         {"exit", command_exit},
         {"interrupt", command_interrupt},
+        {"blocks", command_blocks},
+        {"fusions", command_fusions},
+        {"reclaim", command_reclaim},
+        {"checkpoint", command_checkpoint},
+        {"restore", command_restore},
         {"config_show", command_view_config},
         {"config", command_reload_config},
         {NULL, NULL}
@@ -59,7 +85,22 @@ AppState *new_app_state(void) {
     appState->emulator_running = mmap(NULL, 1, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
     *appState->emulator_running = 0;
     appState->emulator_thread = 0;
-    appState->state->page_table = create_page_table();
+    // Builds with a statically recompiled image run it on the block core by default.
+    appState->core = registered_aot_image() ? CORE_BLOCK : CORE_SWITCH;
+    appState->jit_enabled = true;
+    appState->translation_cache_enabled = true;
+    appState->translation_cache_file = NULL;
+    appState->program_file = NULL;
+    appState->flash_file = NULL;
+    appState->program_size = 0;
+    appState->flash_size = 0;
+    appState->headless = false;
+    appState->emulator_thread_joinable = false;
+    appState->last_stop = STOP_NONE;
+    page_arena_init(&appState->state->page_arena);
+    appState->state->page_table = create_page_table(&appState->state->page_arena);
+    appState->state->decode_cache = create_decode_cache();
+    appState->state->block_cache = create_block_cache();
     appState->state->i_vector_table = init_interrupt_vector_table();
     appState->state->i_queue = init_interrupt_queue();
     appState->state->uart = calloc(1, sizeof(UART));
@@ -74,18 +115,35 @@ AppState *new_app_state(void) {
     return appState;
 }
 
+static void join_emulator_thread(AppState *appState);
+void cleanup_emulator(void *arg);
+
 void free_app_state(AppState *appState) {
     if (*(appState->emulator_running) != 0) {
-        pthread_cancel(appState->emulator_thread);
-        pthread_join(appState->emulator_thread, NULL);
+        request_cpu_stop(appState->state);
+    }
+    join_emulator_thread(appState);
+    if (appState->state->uart && appState->state->uart->running) {
+        cleanup_emulator(appState);
     }
     munmap(appState->emulator_running, 1);
     munmap(appState->state->reg, 16 * sizeof(uint16_t));
     free(appState->state->i_vector_table);
     free(appState->state->i_queue);
     free(appState->state->uart);
+    free(appState->state->decode_cache);
+    free_block_cache(appState->state->block_cache);
+    free_jit_compiler(appState->state->jit);
+    release_boot_image(appState->state);
+    free(appState->translation_cache_file);
+    free(appState->program_file);
+    free(appState->flash_file);
     free(appState->state->pc);
+    stack_engine_reset(appState->state);
+    discard_checkpoint(appState->state);
     free_all_pages(appState->state->page_table);
+    page_arena_destroy(&appState->state->page_arena);
+    free_memory_config(&appState->state->memory_config);
     munmap(appState->state, sizeof(CPUState));
     // if (appState->gui_pid) {
     //     munmap(appState->gui_shm, sizeof(gui_process_shm_t));
@@ -106,61 +164,157 @@ void cleanup_emulator(void *arg) {
     }
 }
 
-void* emulator_thread_func(void* arg) {
-    AppState *appState = (AppState*) arg;
-    // Set cancellation type to asynchronous
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
-    // Start the UART thread if a UART instance is present.
-    if (appState->state->uart) {
+// Start the UART thread if a UART instance is present and it is not running yet.
+static void start_uart(AppState *appState) {
+    if (appState->state->uart && !appState->state->uart->running) {
         appState->state->uart->running = true;
         if (pthread_create(&appState->state->uart_thread, NULL, uart_start, appState) != 0) {
             perror("Failed to create UART thread");
+            appState->state->uart->running = false;
         }
     }
+}
 
-    // Register cleanup handler to ensure the UART thread is stopped on cancellation.
-    pthread_cleanup_push(cleanup_emulator, appState);
-
-    // Start the emulator main loop.
-    start(appState);
+static void report_stop(AppState *appState, const char *prefix, StopReason reason) {
+    printf("%s: %s at PC 0x%08x\n", prefix, stop_reason_name(reason), *(appState->state->pc));
+    fflush(stdout);
+}
 
-    // If start() returns normally, pop and execute cleanup handler.
-    pthread_cleanup_pop(1);
+// Both run on the emulator thread. The CPU stops cooperatively (see
+// control.c), so the thread always returns here with a consistent state.
+void* emulator_thread_func(void* arg) {
+    AppState *appState = (AppState*) arg;
+    appState->last_stop = start(appState);
+    report_stop(appState, "Emulator stopped", appState->last_stop);
+    *(appState->emulator_running) = 0;
+    return NULL;
+}
 
+void* resume_thread_func(void* arg) {
+    AppState *appState = (AppState*) arg;
+    appState->last_stop = run_cpu(appState);
+    report_stop(appState, "Emulator stopped", appState->last_stop);
     *(appState->emulator_running) = 0;
-    pthread_exit(NULL);
+    return NULL;
+}
+
+// Reap the emulator thread once it has returned or been asked to stop.
+static void join_emulator_thread(AppState *appState) {
+    if (appState->emulator_thread_joinable) {
+        pthread_join(appState->emulator_thread, NULL);
+        appState->emulator_thread_joinable = false;
+    }
+}
+
+static void spawn_emulator_thread(AppState *appState, void *(*func)(void *)) {
+    join_emulator_thread(appState);
+    // Clear a stale request first so the new run cannot stop immediately.
+    __atomic_store_n(&appState->state->stop_requested, 0, __ATOMIC_SEQ_CST);
+    start_uart(appState);
+
+    *(appState->emulator_running) = 1;
+    if (pthread_create(&appState->emulator_thread, NULL, func, appState) != 0) {
+        perror("Failed to create emulator thread");
+        *(appState->emulator_running) = 0;
+        return;
+    }
+    appState->emulator_thread_joinable = true;
+}
+
+// True if the CPU may run from where it is: started and not halted or faulted.
+static bool can_continue(AppState *appState) {
+    return appState->state->pc != NULL &&
+           appState->last_stop != STOP_HALT && appState->last_stop != STOP_FAULT;
 }
 
 void command_start(AppState *appState, __attribute__((unused)) const char *args){
     if (*(appState->emulator_running) == 0) {
-        pthread_t emulator_thread;
-        *(appState->emulator_running) = 1;
-        if(pthread_create(&emulator_thread, NULL, emulator_thread_func, appState) != 0) {
-            perror("Failed to create emulator thread");
-            *(appState->emulator_running) = 0;
-            return;
-        }
-        appState->emulator_thread = emulator_thread;
+        spawn_emulator_thread(appState, emulator_thread_func);
     } else {
         printf("Emulator already running.\n");
     }
 }
 
+// stop and pause: the CPU finishes its current block and can be resumed.
 void command_stop(AppState *appState, __attribute__((unused)) const char *args) {
     if (*(appState->emulator_running) == 0) {
         printf("Emulator is not running.\n");
         return;
     }
+    request_cpu_stop(appState->state);
+    join_emulator_thread(appState);
+}
+
+void command_resume(AppState *appState, __attribute__((unused)) const char *args) {
+    if (*(appState->emulator_running) != 0) {
+        printf("Emulator already running.\n");
+        return;
+    }
+    if (!can_continue(appState)) {
+        printf("Nothing to resume; use start.\n");
+        return;
+    }
+    spawn_emulator_thread(appState, resume_thread_func);
+}
 
-    if (pthread_cancel(appState->emulator_thread) == 0) {
-        // The cancel operation was successful
-        printf("Emulator successfully stopped.\n");
-        *(appState->emulator_running) = 0;
+/**
+ * Check that the REPL may run the CPU itself (step, run_until), resetting it
+ * first if it has not been started. These run on the REPL thread; Ctrl+C
+ * stops them.
+ */
+static bool prepare_direct_run(AppState *appState) {
+    if (*(appState->emulator_running) != 0) {
+        printf("Emulator is running; pause it first.\n");
+        return false;
+    }
+    join_emulator_thread(appState);
+    if (appState->state->pc == NULL) {
+        reset_cpu(appState);
+    } else if (!can_continue(appState)) {
+        printf("CPU %s; use start.\n", stop_reason_name(appState->last_stop));
+        return false;
+    }
+    start_uart(appState);
+    return true;
+}
+
+void command_step(AppState *appState, const char *args) {
+    uint64_t count = 1;
+    if (args != NULL && *args != '\0') {
+        count = strtoull(args, NULL, 0);
+    }
+    if (!prepare_direct_run(appState)) {
+        return;
+    }
+    appState->last_stop = step_cpu(appState, count);
+    report_stop(appState, "Stopped", appState->last_stop);
+}
+
+void command_run_until(AppState *appState, const char *args) {
+    char what[16];
+    char number[32];
+    char *endptr = number;
+    unsigned long long value = 0;
+    if (args != NULL && sscanf(args, "%15s %31s", what, number) == 2) {
+        value = strtoull(number, &endptr, 0);
+    }
+    if (endptr == number || *endptr != '\0' ||
+        (strcmp(what, "pc") != 0 && strcmp(what, "cycles") != 0)) {
+        printf("Usage: run_until pc <address> | run_until cycles <count>\n");
+        return;
+    }
+    if (!prepare_direct_run(appState)) {
+        return;
+    }
+    if (strcmp(what, "pc") == 0) {
+        appState->last_stop = run_until_pc(appState, (uint32_t) value);
     } else {
-        // An error occurred during the cancel operation
-        perror("Error stopping emulator");
+        appState->last_stop = run_until_cycles(appState, (uint64_t) value);
     }
+    report_stop(appState, "Stopped", appState->last_stop);
+    printf("Instructions: %llu, cycles: %llu\n",
+           (unsigned long long) appState->state->instructions,
+           (unsigned long long) appState->state->cycles);
 }
 
 void execute_command(AppState *appState, const char *command, const char *args) {
@@ -183,33 +337,70 @@ int main(int argc, char *argv[]) {
     // Set the SIGINT (Ctrl+C) signal handler to sigintHandler
     signal(SIGINT, sigintHandler);
     AppState *appState = new_app_state();
+    sigint_cpu = appState->state;
     char *config_file = "config.ini";
     // Parse arguments
     int opt;
-    while ((opt = getopt(argc, argv, "p:m:c:")) != -1) {
+    while ((opt = getopt(argc, argv, "p:m:c:e:JTrn:k:")) != -1) {
         switch (opt) {
             case 'p':
-                appState->program_file = optarg;
+                appState->program_file = strdup(optarg);
                 break;
             case 'm':
-                appState->flash_file = optarg;
+                appState->flash_file = strdup(optarg);
                 break;
             case 'c':
                 config_file = optarg;
                 break;
+            case 'e':
+                if (strcmp(optarg, "switch") == 0) {
+                    appState->core = CORE_SWITCH;
+                } else if (strcmp(optarg, "threaded") == 0) {
+                    appState->core = CORE_THREADED;
+                } else if (strcmp(optarg, "block") == 0) {
+                    appState->core = CORE_BLOCK;
+                } else {
+                    fprintf(stderr, "Unknown execution core: %s (expected switch, threaded or block)\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'J':
+                appState->jit_enabled = false;
+                break;
+            case 'T':
+                appState->translation_cache_enabled = false;
+                break;
+            case 'r':
+                appState->headless = true;
+                break;
+            case 'n':
+                appState->state->instruction_limit = strtoull(optarg, NULL, 0);
+                break;
+            case 'k':
+                appState->state->cycle_limit = strtoull(optarg, NULL, 0);
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-p program_file] [-m flash_file] [-c config_file]\n", argv[0]);
+                fprintf(stderr, "Usage: %s [-p program_file] [-m flash_file] [-c config_file] [-e switch|threaded|block] [-J] [-T] [-r] [-n max_instructions] [-k max_cycles]\n", argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
 
+    // The block core compiles hot blocks to native code unless -J was given.
+    if (appState->core == CORE_BLOCK && appState->jit_enabled) {
+        appState->state->jit = create_jit_compiler();
+    }
+
     load_config(appState, config_file);
+    if (!load_program_file(appState)) {
+        free_app_state(appState);
+        return EXIT_FAILURE;
+    }
 
-    uint8_t *program_memory;
-    appState->program_size = load_program(appState->program_file, &program_memory);
-    initialize_page_table(appState->state, program_memory, appState->program_size);
-    free(program_memory);
-    printf("Loaded program %lu bytes\n", appState->program_size);
+    if (appState->headless) {
+        int status = run_headless(appState);
+        free_app_state(appState);
+        return status;
+    }
 
     char input[MAX_INPUT_LENGTH];
     while(1) {
@@ -257,12 +448,75 @@ void command_interrupt(AppState *appState, const char *args) {
     }
 }
 
+void command_blocks(AppState *appState, const char *args) {
+    size_t top_n = 10;
+    if (args != NULL && *args != '\0') {
+        top_n = strtoul(args, NULL, 0);
+    }
+    print_block_stats(appState->state, top_n);
+}
+
+void command_fusions(AppState *appState, const char *args) {
+    size_t top_n = 10;
+    if (args != NULL && *args != '\0') {
+        top_n = strtoul(args, NULL, 0);
+    }
+    print_fusion_stats(appState->state, top_n);
+}
+
+void command_reclaim(AppState *appState, __attribute__((unused)) const char *args) {
+    if (*(appState->emulator_running) != 0) {
+        printf("Emulator is running; pause it first.\n");
+        return;
+    }
+    join_emulator_thread(appState);
+    ReclaimStats stats = { 0 };
+    reclaim_guest_memory(appState->state, &stats);
+    printf("Reclaimed %zu zero pages and %zu duplicate pages (%zu KiB released)\n",
+           stats.zero_pages, stats.merged_pages, stats.released_bytes / 1024);
+}
+
+void command_checkpoint(AppState *appState, __attribute__((unused)) const char *args) {
+    if (*(appState->emulator_running) != 0) {
+        printf("Emulator is running; pause it first.\n");
+        return;
+    }
+    join_emulator_thread(appState);
+    if (take_checkpoint(appState->state)) {
+        printf("Checkpoint taken at PC 0x%08x.\n", appState->state->pc ? *appState->state->pc : 0);
+    }
+}
+
+void command_restore(AppState *appState, __attribute__((unused)) const char *args) {
+    if (*(appState->emulator_running) != 0) {
+        printf("Emulator is running; pause it first.\n");
+        return;
+    }
+    join_emulator_thread(appState);
+    size_t restored_pages = 0;
+    if (!restore_checkpoint(appState->state, &restored_pages)) {
+        printf("No checkpoint to restore; use checkpoint first.\n");
+        return;
+    }
+    // The CPU is back where it was paused, so it can be resumed or stepped.
+    appState->last_stop = STOP_REQUESTED;
+    printf("Restored checkpoint at PC 0x%08x (%zu pages).\n", *appState->state->pc, restored_pages);
+}
+
 void command_help(__attribute__((unused)) AppState *appState, __attribute__((unused)) const char *args) {
     printf("Commands:\n");
     printf("start - start emulator\n");
-    printf("stop - stop emulator \n");
+    printf("stop or pause - stop emulator after the current block\n");
+    printf("resume - continue a paused emulator\n");
+    printf("step [n] - execute n instructions (default 1)\n");
+    printf("run_until pc <addr> | cycles <n> - run until the PC or cycle count is reached\n");
     printf("program <filename> - load program\n");
     printf("flash <filename> - load flash\n");
+    printf("blocks [n] - show the n hottest basic blocks\n");
+    printf("fusions [n] - show fused pair counts and the n hottest instruction pairs\n");
+    printf("reclaim - share zero and duplicate guest pages and release their memory\n");
+    printf("checkpoint - save the CPU, device and memory state\n");
+    printf("restore - go back to the last checkpoint\n");
     printf("ctl_l or ctl_listen- start listening for connections on Unix socket\n");
     printf("help or h - display this help message\n");
     // printf("exit - exit the program\n");
@@ -271,22 +525,132 @@ void command_help(__attribute__((unused)) AppState *appState, __attribute__((unu
     // kill(appState->gui_pid, SIGUSR1);
 }
 
-void command_program(AppState *appState, __attribute__((unused)) const char *args){
-    appState->program_file = (char*) args;
-    uint8_t *program_memory;
-    appState->program_size = load_program(appState->program_file, &program_memory);
-    initialize_page_table(appState->state, program_memory, appState->program_size);
-    free(program_memory);
+void command_program(AppState *appState, const char *args){
+    if (args == NULL || *args == '\0') {
+        printf("Usage: program <filename>\n");
+        return;
+    }
+    // Loading rebuilds the memory the CPU is running from.
+    if (*(appState->emulator_running) != 0) {
+        printf("Emulator is running; pause it first.\n");
+        return;
+    }
+    join_emulator_thread(appState);
+    // Kept for later reloads; 'args' points into the input line.
+    char *previous = appState->program_file;
+    appState->program_file = strdup(args);
+    if (load_program_file(appState)) {
+        free(previous);
+    } else {
+        free(appState->program_file);
+        appState->program_file = previous;
+    }
+}
+
+// Load appState->program_file, if set, into the boot sector and
+// appState->flash_file, if set, into flash, then warm the caches from the
+// program's translation cache. If either file cannot be read, memory is left
+// as it was and false is returned.
+bool load_program_file(AppState *appState) {
+    ProgramImage image = { .data = NULL, .size = 0, .fd = -1 };
+    ProgramImage flash;
+    if (appState->program_file && !load_program(appState->program_file, &image)) {
+        fprintf(stderr, "Could not read program %s\n", appState->program_file);
+        return false;
+    }
+    if (appState->flash_file && !load_program(appState->flash_file, &flash)) {
+        fprintf(stderr, "Could not read flash image %s\n", appState->flash_file);
+        unload_program(&image);
+        return false;
+    }
+    appState->program_size = image.size;
+    appState->flash_size = appState->flash_file ? flash.size : 0;
+    initialize_page_table(appState->state, &image, appState->flash_file ? &flash : NULL);
+    unload_program(&image);
+    if (appState->flash_file) {
+        unload_program(&flash);
+        printf("Loaded flash %lu bytes\n", appState->flash_size);
+    }
     printf("Loaded program %lu bytes\n", appState->program_size);
+
+    free(appState->translation_cache_file);
+    appState->translation_cache_file = NULL;
+    if (appState->translation_cache_enabled) {
+        appState->translation_cache_file = translation_cache_path(appState->program_file);
+        load_translation_cache(appState->state, appState->translation_cache_file);
+    }
+    return true;
+}
+
+// Memory is rebuilt from scratch, as on power-up, with the current program.
+void command_flash(AppState *appState, const char *args){
+    if (args == NULL || *args == '\0') {
+        printf("Usage: flash <filename>\n");
+        return;
+    }
+    if (*(appState->emulator_running) != 0) {
+        printf("Emulator is running; pause it first.\n");
+        return;
+    }
+    join_emulator_thread(appState);
+    char *previous = appState->flash_file;
+    appState->flash_file = strdup(args);
+    if (load_program_file(appState)) {
+        free(previous);
+    } else {
+        free(appState->flash_file);
+        appState->flash_file = previous;
+    }
+}
+
+static int stop_exit_status(StopReason reason) {
+    switch (reason) {
+        case STOP_HALT:              return EXIT_HALTED;
+        case STOP_INSTRUCTION_LIMIT:
+        case STOP_CYCLE_LIMIT:
+        case STOP_REQUESTED:         return EXIT_LIMIT_REACHED;
+        default:                     return EXIT_FAULT;
+    }
 }
 
-void command_flash(__attribute__((unused)) AppState *appState, __attribute__((unused)) const char *args){
-//    const char* filename = args;
+/**
+ * Run the loaded program on the calling thread until it halts, faults or
+ * reaches the -n/-k limit or Ctrl+C stops it, print a throughput report and
+ * return the process exit status (EXIT_HALTED, EXIT_FAULT or
+ * EXIT_LIMIT_REACHED).
+ */
+int run_headless(AppState *appState) {
+    if (appState->program_size == 0) {
+        fprintf(stderr, "Error: -r needs a program to run (-p)\n");
+        return EXIT_FAILURE;
+    }
+    CPUState *state = appState->state;
+
+    start_uart(appState);
+    struct timespec started, stopped;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    StopReason reason = start(appState);
+    clock_gettime(CLOCK_MONOTONIC, &stopped);
+    cleanup_emulator(appState);
+
+    double seconds = (double) (stopped.tv_sec - started.tv_sec) +
+                     (double) (stopped.tv_nsec - started.tv_nsec) / 1e9;
+    printf("Stopped: %s at PC 0x%08x\n", stop_reason_name(reason), *(state->pc));
+    printf("Instructions retired: %llu\n", (unsigned long long) state->instructions);
+    printf("Cycles: %llu\n", (unsigned long long) state->cycles);
+    printf("Idle cycles skipped: %llu\n", (unsigned long long) state->idle_cycles);
+    printf("Wall time: %.3f s\n", seconds);
+    printf("MIPS: %.2f\n", seconds > 0 ? (double) state->instructions / seconds / 1e6 : 0.0);
+    printf("Peak pages: %zu (%zu KiB)\n", state->page_table->peak_page_count,
+           state->page_table->peak_page_count * PAGE_SIZE / 1024);
+    fflush(stdout);
+    return stop_exit_status(reason);
 }
 
 // Function to load the configuration file into appState
+
 void load_config(AppState *appState, const char *filename) {
-    if (parse_ini_file(filename, &appState->state->memory_config) == 0) {
+    if (parse_ini_file(filename, &appState->state->memory_config, &appState->state->clock.config) == 0) {
         printf("Configuration loaded from %s\n", filename);
     } else {
         fprintf(stderr, "Error: Could not load configuration from %s\n", filename);
@@ -296,6 +660,7 @@ void load_config(AppState *appState, const char *filename) {
 // Function to display the current configuration
 void display_config(const MemoryConfig *config) {
     printf("Current Memory Configuration:\n");
+    printf("Backend: %s\n", config->backend == MEMORY_FLAT ? "flat" : "paged");
     for (size_t i = 0; i < config->section_count; i++) {
         printf("Section: %s\n", config->sections[i].section_name);
         printf("  Type: %d\n", config->sections[i].type);
@@ -307,12 +672,35 @@ void display_config(const MemoryConfig *config) {
     }
 }
 
+void display_clock_config(const ClockConfig *clock) {
+    printf("Clock:\n");
+    printf("  Frequency: %llu Hz\n", (unsigned long long) clock->frequency_hz);
+    printf("  Unthrottled: %s\n", clock->unthrottled ? "yes" : "no");
+    printf("  Batch Cycles: %u\n", clock->batch_cycles);
+}
+
 void command_view_config(AppState *appState, __attribute__((unused)) const char *args) {
     display_config(&appState->state->memory_config);
+    display_clock_config(&appState->state->clock.config);
 }
 
 void command_reload_config(AppState *appState, const char *args) {
-    if (parse_ini_file(args, &appState->state->memory_config) == 0) {
+    if (args == NULL || *args == '\0') {
+        printf("Usage: config <filename>\n");
+        return;
+    }
+    // The memory map, TLB and stack engine are rebuilt under the CPU otherwise.
+    if (*(appState->emulator_running) != 0) {
+        printf("Emulator is running; pause it first.\n");
+        return;
+    }
+    join_emulator_thread(appState);
+    if (parse_ini_file(args, &appState->state->memory_config, &appState->state->clock.config) == 0) {
+        // Re-anchor the pacing schedule at the new frequency.
+        clock_reset(appState->state);
+        // Page attributes and the stack section come from the memory sections.
+        tlb_flush(appState->state);
+        stack_engine_reset(appState->state);
         printf("Configuration reloaded from %s\n", args);
     } else {
         printf("Error: Could not reload configuration from %s\n", args);
@@ -13,35 +13,140 @@
 // ----------------------------
 
 // Initialization and Start
-int start(AppState *appState);
-int parse_ini_file(const char *filename, MemoryConfig *config);
+StopReason start(AppState *appState);
+void reset_cpu(AppState *appState);
+StopReason run_cpu(AppState *appState);
+int parse_ini_file(const char *filename, MemoryConfig *config, ClockConfig *clock);
+
+// Run Control
+void request_cpu_stop(CPUState *state);
+bool is_cpu_stop_requested(CPUState *state);
+StopReason step_cpu(AppState *appState, uint64_t count);
+StopReason run_until_cycles(AppState *appState, uint64_t cycles);
+StopReason run_until_pc(AppState *appState, uint32_t pc);
+const char* stop_reason_name(StopReason reason);
 
 // CPU Execution and Memory Operations
-bool execute_instruction(CPUState *state);
+StopReason execute_instruction(CPUState *state);
+bool execute_decoded(CPUState *state, const DecodedInstruction *insn);
+bool service_pending_interrupt(CPUState *state);
+StopReason run_threaded(CPUState *state);
+bool run_block_ops(CPUState *state, const BasicBlock *block, uint16_t *ops_run);
 void increment_pc(CPUState *state, uint8_t opcode, uint8_t specifier);
-
-// ALU Operations
-void add(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2, uint8_t mode);
-void subtract(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2, uint8_t mode);
-void multiply(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2, uint8_t mode);
-void left_shift(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2, uint8_t mode);
-void right_shift(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2, uint8_t mode);
-void bitwise_and(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2, uint8_t mode);
-void bitwise_or(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2, uint8_t mode);
-void bitwise_xor(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2, uint8_t mode);
-
+uint8_t get_instruction_length(uint8_t opcode, uint8_t specifier);
+
+// Clock Model
+uint8_t handler_cycle_count(uint8_t handler);
+void clock_default_config(ClockConfig *config);
+void clock_reset(CPUState *state);
+StopReason clock_sync(CPUState *state);
+bool clock_is_paced(const CPUState *state);
+uint64_t clock_limit_horizon(const CPUState *state);
+void clock_time_at(const CPUState *state, uint64_t cycles, struct timespec *out);
+uint64_t clock_cycles_now(const CPUState *state);
+
+// Idle Loops
+bool is_idle_loop(const BasicBlock *block);
+void idle_wait(CPUState *state, uint32_t loop_cycles, uint32_t loop_instructions);
+
+// Decoded Instruction Cache
+DecodeCache* create_decode_cache(void);
+void decode_instruction(const uint8_t *bytes, DecodedInstruction *out);
+const char* handler_name(uint8_t handler);
+const DecodedInstruction* fetch_decoded(CPUState *state, uint32_t pc);
+void invalidate_decoded_range(CPUState *state, uint32_t address, size_t length);
+void invalidate_code_range(CPUState *state, uint32_t address, size_t length);
+void flush_decode_cache(CPUState *state);
+
+// Basic Block Cache
+BlockCache* create_block_cache(void);
+BasicBlock* lookup_block(CPUState *state, uint32_t pc);
+BasicBlock* find_block(const BlockCache *cache, uint32_t pc);
+BasicBlock* install_block(CPUState *state, uint32_t pc, const DecodedInstruction *ops, uint16_t op_count);
+void chain_block(BasicBlock *from, bool taken, BasicBlock *to);
+void invalidate_block_range(CPUState *state, uint32_t address, size_t length);
+void flush_block_cache(CPUState *state);
+void free_block_cache(BlockCache *cache);
+void print_block_stats(CPUState *state, size_t top_n);
+StopReason run_blocks(CPUState *state);
+
+// Superinstructions
+void fuse_block_ops(DecodedInstruction *ops, uint16_t op_count);
+void execute_fused(CPUState *state, const DecodedInstruction *first);
+void print_fusion_stats(CPUState *state, size_t top_n);
+
+// Persistent Translation Cache
+bool save_translation_cache(CPUState *state, const char *path);
+size_t load_translation_cache(CPUState *state, const char *path);
+char* translation_cache_path(const char *program_file);
+
+// JIT Compiler (x86-64 hosts only)
+JitCompiler* create_jit_compiler(void);
+void free_jit_compiler(JitCompiler *jit);
+bool jit_compile_block(CPUState *state, BasicBlock *block);
+
+// Ahead-of-Time Translations (see aot/neocore_aot.c)
+void register_aot_image(const AotImage *image);
+const AotImage* registered_aot_image(void);
+void attach_aot_image(CPUState *state);
+void detach_aot_image(CPUState *state);
+NativeBlockFn lookup_aot_block(CPUState *state, uint32_t pc, uint32_t end_pc);
+
+// ALU Operations (the per-opcode kernels live in alu.h)
 void umull(uint16_t *rd, uint16_t *rn1, const uint16_t *rn);
 void smull(uint16_t *rd, uint16_t *rn1, const uint16_t *rn);
 
+// Software TLB
+uint8_t* tlb_fill(CPUState *state, TlbEntry *set, uint32_t address, bool allocate_if_unallocated, uint8_t *attributes);
+void tlb_evict_page(CPUState *state, uint32_t page);
+void tlb_flush_writes(CPUState *state);
+void tlb_flush(CPUState *state);
+
+// Dirty page tracking
+size_t collect_dirty_pages(CPUState *state, void (*visit)(uint32_t page, void *context), void *context);
+void clear_dirty_pages(CPUState *state);
+
+// Checkpoints
+bool take_checkpoint(CPUState *state);
+bool restore_checkpoint(CPUState *state, size_t *restored_pages);
+void discard_checkpoint(CPUState *state);
+void preserve_checkpoint_page(CPUState *state, uint32_t page);
+
 // Page Table Management
-PageTable* create_page_table(void);
+PageTable* create_page_table(PageArena *arena);
 PageTableEntry* allocate_page(PageTable *table, uint32_t page_index);
+bool add_image_mapping(PageTable *table, uint8_t *base, size_t size);
+void map_page(PageTable *table, uint32_t page_index, uint8_t *data);
+bool is_page_allocated(const PageTable *table, uint32_t page_index);
+bool validate_page_table(PageTable *table);
+void release_page(CPUState *state, uint32_t page_index);
+uint8_t* translate_address(CPUState *state, uint32_t address, bool allocate_if_unallocated);
 uint8_t* get_memory_ptr(CPUState *state, uint32_t address, bool allocate_if_unallocated);
 uint8_t get_memory(CPUState *state, uint32_t address);
 void set_memory(CPUState *state, uint32_t address, uint8_t value);
 void bulk_copy_memory(CPUState *state, uint32_t address, const uint8_t *buffer, size_t length);
 void free_all_pages(PageTable* table);
-void initialize_page_table(CPUState *state, uint8_t *boot_sector_buffer, size_t boot_size);
+void count_allocated_pages(PageTable *table, size_t count);
+PageTable* create_flat_page_table(PageArena *arena);
+void page_arena_init(PageArena *arena);
+uint8_t* page_arena_alloc_frame(PageArena *arena);
+void page_arena_free_frame(PageArena *arena, uint8_t *frame);
+void page_arena_release_frame(PageArena *arena, uint8_t *frame);
+PageTableLeaf* page_arena_alloc_leaf(PageArena *arena);
+void page_arena_free_leaf(PageArena *arena, PageTableLeaf *leaf);
+void page_arena_trim(PageArena *arena);
+void page_arena_destroy(PageArena *arena);
+bool is_flat_page_committed(const PageTable *table, uint32_t page);
+bool flat_commit_pages(PageTable *table, uint32_t first_page, uint32_t count);
+bool flat_map_file(PageTable *table, uint32_t first_page, uint32_t count, int fd);
+void flat_decommit_page(PageTable *table, uint32_t page);
+void free_flat_memory(PageTable *table);
+void reclaim_guest_memory(CPUState *state, ReclaimStats *stats);
+void initialize_page_table(CPUState *state, const ProgramImage *program, const ProgramImage *flash);
+void record_boot_image(CPUState *state, uint32_t load_address, const uint8_t *image, size_t size);
+void release_boot_image(CPUState *state);
+void mark_boot_image_written(CPUState *state, uint32_t address, size_t length);
+bool is_boot_image_range_clean(const CPUState *state, uint32_t start, uint32_t end);
 
 void setupMmap(CPUState *state, size_t program_size);
 
@@ -49,6 +154,11 @@ void setupMmap(CPUState *state, size_t program_size);
 void mmuControl(CPUState *state, uint8_t value);
 void pushStack(CPUState *state, uint8_t value);
 uint8_t popStack(CPUState *state, uint8_t *out);
+void pushStack16(CPUState *state, uint16_t value);
+bool popStack16(CPUState *state, uint16_t *out);
+void pushStack32(CPUState *state, uint32_t value);
+bool popStack32(CPUState *state, uint32_t *out);
+void stack_engine_reset(CPUState *state);
 
 // ----------------------------
 // Interrupt Management
@@ -66,12 +176,16 @@ bool enqueue_interrupt(InterruptQueue *queue, uint8_t irq);
 bool dequeue_interrupt(InterruptQueue *queue, uint8_t *irq);
 bool is_interrupt_queue_empty(InterruptQueue *queue);
 bool is_interrupt_queue_full(InterruptQueue *queue);
+bool wait_for_interrupt(CPUState *state);
+void wait_for_interrupt_event(CPUState *state, uint32_t seen, const struct timespec *deadline);
 
 // ----------------------------
 // Utility Functions
 // ----------------------------
 uint8_t count_leading_zeros(uint8_t x);
-size_t load_program(const char *filename, uint8_t **buffer);
+bool load_program(const char *filename, ProgramImage *image);
+void unload_program(ProgramImage *image);
+uint64_t hash_bytes(const uint8_t *data, size_t length);
 
 void mov(CPUState *state,
          uint8_t rd,
@@ -82,6 +196,11 @@ void mov(CPUState *state,
          uint32_t offset,
          uint8_t specifier);
 void memory_write_trigger(CPUState *state, uint32_t address, uint32_t value);
+bool memory_read_trigger(CPUState *state, uint32_t address, uint32_t *value);
+void mmio_interrupt(CPUState *state, uint8_t irq);
+bool register_mmio_device_type(const MmioDeviceType *type);
+const MmioDeviceType* find_mmio_device_type(const char *name);
+void register_builtin_devices(void);
 uint8_t read8(CPUState* state, uint32_t address);
 uint16_t read16(CPUState* state, uint32_t address);
 uint32_t read32(CPUState* state, uint32_t address);
@@ -89,4 +208,11 @@ void write8(CPUState* state, uint32_t address, uint8_t value);
 void write16(CPUState* state, uint32_t address, uint16_t value);
 void write32(CPUState* state, uint32_t address, uint32_t value);
 
+// Memory Map
+bool compile_memory_map(MemoryConfig *config);
+const PageAttributes* lookup_page_attributes(const MemoryConfig *config, uint32_t address);
+MemorySection* add_memory_section(MemoryConfig *config);
+void free_memory_map(MemoryMap *map);
+void free_memory_config(MemoryConfig *config);
+
 #endif // INC_16_BIT_CPU_EMULATOR_MAIN_H
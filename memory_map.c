@@ -0,0 +1,189 @@
+//
+// memory_map.c
+// Compiles the parsed memory sections into a per-page attribute table.
+//
+// parse_ini_file() leaves the sections in file order. compile_memory_map()
+// sorts them, rejects anything that does not describe a sane address space
+// (unknown types, unaligned or empty sections, sections running past 4 GiB,
+// overlaps) and records the type, permissions and device of every page they
+// cover. A lookup is then two array indexings, with the same directory and
+// leaf split as the page table; leaves exist only where some section does.
+// Each MMIO section also gets an instance of its device type, which the
+// pages of the section refer to by index.
+//
+
+#include "main.h"
+
+// Pages outside every section behave as plain memory, as they always have.
+static const PageAttributes unmapped_page = {
+    .type = USABLE_MEMORY,
+    .flags = PAGE_ATTR_RAM | PAGE_ATTR_READ | PAGE_ATTR_WRITE | PAGE_ATTR_EXEC,
+    .device = 0,
+    .section = NO_SECTION,
+};
+
+static int compare_sections(const void *a, const void *b) {
+    const MemorySection *left = a;
+    const MemorySection *right = b;
+    if (left->start_address != right->start_address) {
+        return left->start_address < right->start_address ? -1 : 1;
+    }
+    return 0;
+}
+
+static uint64_t section_end(const MemorySection *section) {
+    return (uint64_t) section->start_address + (uint64_t) section->page_count * PAGE_SIZE;
+}
+
+static bool validate_section(const MemorySection *section) {
+    if (section->type == UNKNOWN_TYPE) {
+        fprintf(stderr, "Section %s: unknown or missing type\n", section->section_name);
+        return false;
+    }
+    if (section->page_count == 0) {
+        fprintf(stderr, "Section %s: page_count must be at least 1\n", section->section_name);
+        return false;
+    }
+    if (section->start_address & (PAGE_SIZE - 1)) {
+        fprintf(stderr, "Section %s: start_address 0x%X is not page aligned\n",
+                section->section_name, section->start_address);
+        return false;
+    }
+    if (section_end(section) > (uint64_t) NUM_PAGES * PAGE_SIZE) {
+        fprintf(stderr, "Section %s: extends past the end of the address space\n", section->section_name);
+        return false;
+    }
+    if (section->type == MMIO_PAGE && !find_mmio_device_type(section->device)) {
+        fprintf(stderr, "[WARN] Section %s: unknown device '%s', mapping it as plain memory\n",
+                section->section_name, section->device);
+    }
+    return true;
+}
+
+static uint8_t section_flags(PageType type) {
+    switch (type) {
+        case MMIO_PAGE:
+            return PAGE_ATTR_MMIO | PAGE_ATTR_READ | PAGE_ATTR_WRITE;
+        default:
+            return PAGE_ATTR_RAM | PAGE_ATTR_READ | PAGE_ATTR_WRITE | PAGE_ATTR_EXEC;
+    }
+}
+
+static bool add_mmio_device(MemoryMap *map, const MmioDeviceType *type, const MemorySection *section) {
+    if (map->device_count == UINT16_MAX) {
+        fprintf(stderr, "Section %s: too many MMIO devices\n", section->section_name);
+        return false;
+    }
+    MmioDevice *devices = realloc(map->devices, (map->device_count + 1) * sizeof(MmioDevice));
+    if (!devices) {
+        fprintf(stderr, "Memory allocation failed for MMIO devices.\n");
+        return false;
+    }
+    map->devices = devices;
+    map->devices[map->device_count++] = (MmioDevice) {
+        .type = type,
+        .base = section->start_address,
+        .size = section->page_count * PAGE_SIZE,
+    };
+    return true;
+}
+
+/**
+ * Sort and validate config->sections and build config->map from them.
+ * Returns false, with the reason printed, if the sections are unusable.
+ */
+bool compile_memory_map(MemoryConfig *config) {
+    free_memory_map(&config->map);
+    qsort(config->sections, config->section_count, sizeof(MemorySection), compare_sections);
+
+    for (size_t i = 0; i < config->section_count; i++) {
+        const MemorySection *section = &config->sections[i];
+        if (!validate_section(section)) {
+            return false;
+        }
+        if (i > 0 && section_end(&config->sections[i - 1]) > section->start_address) {
+            fprintf(stderr, "Section %s overlaps section %s\n",
+                    section->section_name, config->sections[i - 1].section_name);
+            return false;
+        }
+    }
+
+    MemoryMap *map = &config->map;
+    for (size_t i = 0; i < config->section_count; i++) {
+        const MemorySection *section = &config->sections[i];
+        PageAttributes attributes = {
+            .type = (uint8_t) section->type,
+            .flags = section_flags(section->type),
+            .device = 0,
+            .section = (uint32_t) i,
+        };
+        const MmioDeviceType *device_type =
+            section->type == MMIO_PAGE ? find_mmio_device_type(section->device) : NULL;
+        if (device_type) {
+            if (!add_mmio_device(map, device_type, section)) {
+                free_memory_map(map);
+                return false;
+            }
+            attributes.device = (uint16_t) map->device_count;
+        }
+        uint32_t first_page = section->start_address >> PAGE_SHIFT;
+        for (uint32_t page = first_page; page < first_page + section->page_count; page++) {
+            PageAttributeLeaf **leaf = &map->directory[page >> PAGE_TABLE_LEAF_BITS];
+            if (!*leaf) {
+                *leaf = calloc(1, sizeof(PageAttributeLeaf));
+                if (!*leaf) {
+                    fprintf(stderr, "Memory allocation failed for memory map.\n");
+                    free_memory_map(map);
+                    return false;
+                }
+            }
+            (*leaf)->entries[page & (PAGE_TABLE_LEAF_ENTRIES - 1)] = attributes;
+        }
+    }
+    return true;
+}
+
+/* Attributes of the page holding 'address'; never NULL. */
+const PageAttributes* lookup_page_attributes(const MemoryConfig *config, uint32_t address) {
+    uint32_t page = address >> PAGE_SHIFT;
+    const PageAttributeLeaf *leaf = config->map.directory[page >> PAGE_TABLE_LEAF_BITS];
+    if (!leaf) {
+        return &unmapped_page;
+    }
+    const PageAttributes *attributes = &leaf->entries[page & (PAGE_TABLE_LEAF_ENTRIES - 1)];
+    return attributes->flags ? attributes : &unmapped_page;
+}
+
+/* Room for one more section, or NULL if it cannot be allocated. */
+MemorySection* add_memory_section(MemoryConfig *config) {
+    if (config->section_count == config->section_capacity) {
+        size_t capacity = config->section_capacity ? config->section_capacity * 2 : 8;
+        MemorySection *sections = realloc(config->sections, capacity * sizeof(MemorySection));
+        if (!sections) {
+            fprintf(stderr, "Memory allocation failed for memory sections.\n");
+            return NULL;
+        }
+        config->sections = sections;
+        config->section_capacity = capacity;
+    }
+    MemorySection *section = &config->sections[config->section_count++];
+    memset(section, 0, sizeof(MemorySection));
+    return section;
+}
+
+void free_memory_map(MemoryMap *map) {
+    for (uint32_t dir = 0; dir < PAGE_DIRECTORY_ENTRIES; dir++) {
+        free(map->directory[dir]);
+        map->directory[dir] = NULL;
+    }
+    free(map->devices);
+    map->devices = NULL;
+    map->device_count = 0;
+}
+
+/* Release the sections and the map, leaving an empty configuration. */
+void free_memory_config(MemoryConfig *config) {
+    free_memory_map(&config->map);
+    free(config->sections);
+    memset(config, 0, sizeof(MemoryConfig));
+}
@@ -1,67 +1,96 @@
 //
-// Created by dulat on 2/17/23.
+// mmu.c
+// MMIO device registry and access dispatch.
 //
-// Prevents compilation errors with a dummy function or variable.
+// Device types (peripherals.c) are registered by name. compile_memory_map()
+// looks the name of each MMIO section up once and creates an instance, so
+// the page attribute table says which instance, if any, owns a page. An
+// access to an MMIO page then finds its device with the same O(1) lookup
+// and its register by offset. Accesses to RAM never get here: the TLB
+// caches PAGE_ATTR_MMIO and the accessors only call in when it is set.
+//
+
 #include "main.h"
-#include <arpa/inet.h>
 
-#include "uart.h"
+#include <strings.h>
 
-void memory_write_trigger(CPUState *state, uint32_t address, uint32_t value) {
-    MemoryConfig *config = &state->memory_config;
-    size_t lo = 0;
-    size_t hi = config->section_count;
-    MemorySection *section = NULL;
+static const MmioDeviceType *device_types[MAX_MMIO_DEVICE_TYPES];
+static size_t device_type_count;
+static bool builtin_devices_registered;
+
+/* Make 'type' available to device = <name> sections. Returns false if the registry is full. */
+bool register_mmio_device_type(const MmioDeviceType *type) {
+    if (device_type_count == MAX_MMIO_DEVICE_TYPES) {
+        fprintf(stderr, "Cannot register MMIO device type %s: registry full\n", type->name);
+        return false;
+    }
+    device_types[device_type_count++] = type;
+    return true;
+}
+
+const MmioDeviceType* find_mmio_device_type(const char *name) {
+    if (!builtin_devices_registered) {
+        builtin_devices_registered = true;
+        register_builtin_devices();
+    }
+    for (size_t i = 0; i < device_type_count; i++) {
+        if (strcasecmp(device_types[i]->name, name) == 0) {
+            return device_types[i];
+        }
+    }
+    return NULL;
+}
 
-    // Binary search to find the section with the highest start_address <= address.
-    // We use [lo, hi) as our search interval.
-    while (lo < hi) {
-        size_t mid = lo + (hi - lo) / 2;
-        if (config->sections[mid].start_address <= address) {
-            section = &config->sections[mid];
-            lo = mid + 1;
-        } else {
-            hi = mid;
+/* The device instance owning 'address' and the register it names, if any allows 'access'. */
+static const MmioRegister* find_register(const CPUState *state, uint32_t address, uint8_t access,
+                                         const MmioDevice **device) {
+    const MemoryMap *map = &state->memory_config.map;
+    const PageAttributes *page = lookup_page_attributes(&state->memory_config, address);
+    if (page->device == 0) {
+        return NULL;
+    }
+    *device = &map->devices[page->device - 1];
+    const MmioDeviceType *type = (*device)->type;
+    uint32_t offset = address - (*device)->base;
+    for (size_t i = 0; i < type->register_count; i++) {
+        if (type->registers[i].offset == offset && (type->registers[i].access & access)) {
+            return &type->registers[i];
         }
     }
+    return NULL;
+}
 
-    // Check if we found a section and if the address is within its bounds.
-    if (section != NULL) {
-        // uint32_t sec_start = section->start_address;
-        uint32_t sec_end = section->start_address + section->page_count * PAGE_SIZE;
-        if (address < sec_end) {
-            if ((section->type == BOOT_SECTOR) || (section->type == USABLE_MEMORY)) {
-                return; // normal write – no trigger
-            } else if (section->type == MMIO_PAGE) {
-                // Handle writes that trigger an action
-                if (strcmp(section->device, "UART") == 0) {
-                    if (address == 0x10000) {
-                        uart_write(state->uart, (uint8_t)value);
-                    }
-                }
-                if (strcmp(section->device, "PIC") == 0) {
-                    if (address == 0x20004) {
-                        // Read the base address of the IVT and its length
-                        uint32_t ivt_base = read32(state, 0x20000);
-                        uint8_t ivt_length = (uint8_t) value;
-                        printf("Loading IVT at address %08x, length %02x\n", ivt_base, ivt_length);
+/**
+ * Called for loads from MMIO pages. Returns true with the register's value
+ * in 'value' if 'address' is a readable device register; otherwise the
+ * load reads the page like plain memory.
+ */
+bool memory_read_trigger(CPUState *state, uint32_t address, uint32_t *value) {
+    const MmioDevice *device;
+    const MmioRegister *reg = find_register(state, address, PAGE_ATTR_READ, &device);
+    if (!reg || !device->type->read) {
+        return false;
+    }
+    *value = device->type->read(state, device, reg);
+    return true;
+}
 
-                        // Cast the base address to a pointer to uint32_t since each entry is 32-bit
-                        uint32_t *ivt_entries = (uint32_t*) get_memory_ptr(state, ivt_base, false);
+/* Called after a store into an MMIO page has updated the page. */
+void memory_write_trigger(CPUState *state, uint32_t address, uint32_t value) {
+    const MmioDevice *device;
+    const MmioRegister *reg = find_register(state, address, PAGE_ATTR_WRITE, &device);
+    if (reg && device->type->write) {
+        device->type->write(state, device, reg, value);
+    }
+}
 
-                        // Populate the IVT using the provided function
-                        for (uint8_t source = 0; source < ivt_length; source++) {
-                            uint32_t handler_address = ivt_entries[source];
-                            handler_address = ntohl(handler_address);
-                            if (register_interrupt_vector(state->i_vector_table, source, handler_address)) {
-                                printf("Registered interrupt vector for source %u: handler=0x%08x\n", source, handler_address);
-                            } else {
-                                printf("Error: Failed to register interrupt vector for source %u\n", source);
-                            }
-                        }
-                    }
-                }
-            }
+/* Let every device raising 'irq' update its registers as the interrupt is serviced. */
+void mmio_interrupt(CPUState *state, uint8_t irq) {
+    const MemoryMap *map = &state->memory_config.map;
+    for (size_t i = 0; i < map->device_count; i++) {
+        const MmioDeviceType *type = map->devices[i].type;
+        if (type->irq == irq && type->interrupt) {
+            type->interrupt(state, &map->devices[i]);
         }
     }
 }
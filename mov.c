@@ -2,6 +2,14 @@
 // Created by Dulat S on 2/6/25.
 //
 #include "main.h"
+#include "tlb.h"
+#include "guest_memory.h"
+#include "dirty_pages.h"
+
+/* Value of a device register at 'address', if it is one; see memory_read_trigger(). */
+static inline bool read_device_register(CPUState* state, uint8_t attributes, uint32_t address, uint32_t* value) {
+    return __builtin_expect(attributes & PAGE_ATTR_MMIO, 0) && memory_read_trigger(state, address, value);
+}
 
 /**
  * read8 - Reads an 8-bit value from memory.
@@ -11,14 +19,48 @@
  * @return        The 8-bit value read (or 0 if the address is invalid).
  */
 uint8_t read8(CPUState* state, uint32_t address) {
-    uint8_t* ptr = get_memory_ptr(state, address, false);
+    uint8_t attributes;
+    uint8_t* ptr = tlb_translate(state, state->tlb.data, address, false, &attributes);
     if (ptr == NULL) {
         // Address not allocated. In a real emulator, you might signal an error.
         return 0;
     }
+    uint32_t value;
+    if (read_device_register(state, attributes, address, &value)) {
+        return (uint8_t) value;
+    }
     return *ptr;
 }
 
+/*
+ * Accesses that straddle two pages, one byte at a time; each byte is
+ * translated (and reported if unmapped) on its own, as read8() does.
+ */
+static __attribute__((noinline)) uint32_t read_split(CPUState* state, uint32_t address, uint32_t size) {
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        value = (value << 8) | read8(state, address + i);
+    }
+    return value;
+}
+
+static __attribute__((noinline)) void write_split(CPUState* state, uint32_t address, uint32_t size, uint32_t value) {
+    uint8_t mmio = 0;
+    for (uint32_t i = 0; i < size; i++) {
+        uint8_t attributes;
+        uint8_t* ptr = tlb_translate(state, state->tlb.write, address + i, true, &attributes);
+        if (ptr) {
+            *ptr = (uint8_t) (value >> (8 * (size - 1 - i)));
+            mark_address_dirty(state, address + i);
+            mmio |= attributes & PAGE_ATTR_MMIO;
+        }
+    }
+    invalidate_code_range(state, address, size);
+    if (mmio) {
+        memory_write_trigger(state, address, value);
+    }
+}
+
 /**
  * read16 - Reads a 16-bit big-endian value from memory.
  *
@@ -27,12 +69,19 @@ uint8_t read8(CPUState* state, uint32_t address) {
  * @return        The 16-bit value read.
  */
 uint16_t read16(CPUState* state, uint32_t address) {
-    uint8_t* ptr = get_memory_ptr(state, address, false);
+    if (__builtin_expect(!fits_in_page(address, 2), 0)) {
+        return (uint16_t) read_split(state, address, 2);
+    }
+    uint8_t attributes;
+    uint8_t* ptr = tlb_translate(state, state->tlb.data, address, false, &attributes);
     if (ptr == NULL) {
         return 0;
     }
-    // Combine two bytes into a 16-bit value (big-endian).
-    return ((uint16_t)ptr[0] << 8) | ptr[1];
+    uint32_t value;
+    if (read_device_register(state, attributes, address, &value)) {
+        return (uint16_t) value;
+    }
+    return load_be16(ptr);
 }
 
 /**
@@ -43,14 +92,19 @@ uint16_t read16(CPUState* state, uint32_t address) {
  * @return        The 32-bit value read.
  */
 uint32_t read32(CPUState* state, uint32_t address) {
-    uint8_t* ptr = get_memory_ptr(state, address, false);
+    if (__builtin_expect(!fits_in_page(address, 4), 0)) {
+        return read_split(state, address, 4);
+    }
+    uint8_t attributes;
+    uint8_t* ptr = tlb_translate(state, state->tlb.data, address, false, &attributes);
     if (ptr == NULL) {
         return 0;
     }
-    return ((uint32_t)ptr[0] << 24) |
-           ((uint32_t)ptr[1] << 16) |
-           ((uint32_t)ptr[2] << 8)  |
-           ptr[3];
+    uint32_t value;
+    if (read_device_register(state, attributes, address, &value)) {
+        return value;
+    }
+    return load_be32(ptr);
 }
 
 /**
@@ -61,11 +115,16 @@ uint32_t read32(CPUState* state, uint32_t address) {
  * @param value   The 8-bit value to write.
  */
 void write8(CPUState* state, uint32_t address, uint8_t value) {
-    uint8_t* ptr = get_memory_ptr(state, address, true);
+    uint8_t attributes;
+    uint8_t* ptr = tlb_translate(state, state->tlb.write, address, true, &attributes);
     if (ptr) {
         *ptr = value;
+        mark_address_dirty(state, address);
+        invalidate_code_range(state, address, 1);
         // Call trigger with the 8-bit value promoted to 32 bits.
-        memory_write_trigger(state, address, (uint32_t)value);
+        if (attributes & PAGE_ATTR_MMIO) {
+            memory_write_trigger(state, address, (uint32_t)value);
+        }
     }
 }
 
@@ -77,11 +136,19 @@ void write8(CPUState* state, uint32_t address, uint8_t value) {
  * @param value   The 16-bit value to write.
  */
 void write16(CPUState* state, uint32_t address, uint16_t value) {
-    uint8_t* ptr = get_memory_ptr(state, address, true);
+    if (__builtin_expect(!fits_in_page(address, 2), 0)) {
+        write_split(state, address, 2, value);
+        return;
+    }
+    uint8_t attributes;
+    uint8_t* ptr = tlb_translate(state, state->tlb.write, address, true, &attributes);
     if (ptr) {
-        ptr[0] = (value >> 8) & 0xFF;  // Most-significant byte
-        ptr[1] = value & 0xFF;         // Least-significant byte
-        memory_write_trigger(state, address, (uint32_t)value);
+        store_be16(ptr, value);
+        mark_address_dirty(state, address);
+        invalidate_code_range(state, address, 2);
+        if (attributes & PAGE_ATTR_MMIO) {
+            memory_write_trigger(state, address, (uint32_t)value);
+        }
     }
 }
 
@@ -93,13 +160,19 @@ void write16(CPUState* state, uint32_t address, uint16_t value) {
  * @param value   The 32-bit value to write.
  */
 void write32(CPUState* state, uint32_t address, uint32_t value) {
-    uint8_t* ptr = get_memory_ptr(state, address, true);
+    if (__builtin_expect(!fits_in_page(address, 4), 0)) {
+        write_split(state, address, 4, value);
+        return;
+    }
+    uint8_t attributes;
+    uint8_t* ptr = tlb_translate(state, state->tlb.write, address, true, &attributes);
     if (ptr) {
-        ptr[0] = (value >> 24) & 0xFF; // Byte 3: Most-significant
-        ptr[1] = (value >> 16) & 0xFF; // Byte 2
-        ptr[2] = (value >> 8)  & 0xFF; // Byte 1
-        ptr[3] = value & 0xFF;         // Byte 0: Least-significant
-        memory_write_trigger(state, address, value);
+        store_be32(ptr, value);
+        mark_address_dirty(state, address);
+        invalidate_code_range(state, address, 4);
+        if (attributes & PAGE_ATTR_MMIO) {
+            memory_write_trigger(state, address, value);
+        }
     }
 }
 
@@ -6,215 +6,135 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include "main.h"
-
-// -----------------------------------------------------------------------------
-// Configuration
-// -----------------------------------------------------------------------------
-#define PAGE_SHIFT 12               // Log2 of PAGE_SIZE
+#include "tlb.h"
+#include "dirty_pages.h"
 
 // -----------------------------------------------------------------------------
 // Page Table Management
 // -----------------------------------------------------------------------------
-PageTable* create_page_table(void) {
-    PageTable* table = (PageTable*)malloc(sizeof(PageTable));
-    if (!table) {
-        fprintf(stderr, "Failed to allocate memory for PageTable.\n");
-        exit(EXIT_FAILURE);
-    }
-    table->head       = NULL;
-    table->tail       = NULL;
-    table->page_count = 0;
-    return table;
+// The 20-bit page index is split into a directory index (high bits) and a
+// leaf index (low bits). Leaves are allocated the first time a page in their
+// range is, so a lookup is two array indexings whatever the number of pages.
+static inline uint32_t directory_index(uint32_t page_index) {
+    return page_index >> PAGE_TABLE_LEAF_BITS;
 }
 
-PageTableEntry* allocate_page(PageTable* table, uint32_t page_index) {
-    PageTableEntry* new_page = (PageTableEntry*)malloc(sizeof(PageTableEntry));
-    if (!new_page) {
-        fprintf(stderr, "Memory allocation failed for PageTableEntry.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    new_page->page_data = (uint8_t*)calloc(PAGE_SIZE, sizeof(uint8_t));
-    if (!new_page->page_data) {
-        fprintf(stderr, "Memory allocation failed for page data.\n");
-        free(new_page);
-        exit(EXIT_FAILURE);
-    }
-
-    new_page->is_allocated = true;
-    new_page->page_index   = page_index;
-    new_page->next         = NULL;
-    new_page->prev         = table->tail;
+static inline uint32_t leaf_index(uint32_t page_index) {
+    return page_index & (PAGE_TABLE_LEAF_ENTRIES - 1);
+}
 
-    if (table->tail) {
-        table->tail->next = new_page;
-    } else {
-        table->head = new_page;
+void count_allocated_pages(PageTable* table, size_t count) {
+    table->page_count += count;
+    if (table->page_count > table->peak_page_count) {
+        table->peak_page_count = table->page_count;
     }
-    table->tail = new_page;
-    table->page_count++;
-
-    return new_page;
 }
 
-// -----------------------------------------------------------------------------
-// Helper: Allocate a new page without linking it into the list
-// -----------------------------------------------------------------------------
-static inline PageTableEntry* allocate_new_page(uint32_t page_index) {
-    PageTableEntry* new_page = (PageTableEntry*)malloc(sizeof(PageTableEntry));
-    if (!new_page) {
-        fprintf(stderr, "Memory allocation failed for PageTableEntry.\n");
-        exit(EXIT_FAILURE);
-    }
-    new_page->page_data = (uint8_t*)calloc(PAGE_SIZE, sizeof(uint8_t));
-    if (!new_page->page_data) {
-        fprintf(stderr, "Memory allocation failed for page data.\n");
-        free(new_page);
+PageTable* create_page_table(PageArena* arena) {
+    PageTable* table = (PageTable*)calloc(1, sizeof(PageTable));
+    if (!table) {
+        fprintf(stderr, "Failed to allocate memory for PageTable.\n");
         exit(EXIT_FAILURE);
     }
-    new_page->is_allocated = true;
-    new_page->page_index   = page_index;
-    new_page->next         = NULL;
-    new_page->prev         = NULL;
-    return new_page;
+    table->arena = arena;
+    return table;
 }
 
 // -----------------------------------------------------------------------------
-// Refactored: Find or Allocate Page with Correct Sorted Insertion
+// Find or Allocate Page: O(1) radix lookup, allocating the leaf and the page
+// data on first use when asked to.
 // -----------------------------------------------------------------------------
 static inline PageTableEntry* find_or_allocate_page(PageTable* table,
                                                     uint32_t page_index,
                                                     bool allocate_if_unallocated)
 {
-    // If the table is empty, allocate a new page and set as head and tail.
-    if (!table->head) {
-        if (allocate_if_unallocated) {
-            PageTableEntry* new_page = allocate_new_page(page_index);
-            table->head = table->tail = new_page;
-            table->page_count = 1;
-            return new_page;
-        }
-        return NULL;
+    PageTableLeaf* leaf = table->directory[directory_index(page_index)];
+    if (!leaf) {
+        if (!allocate_if_unallocated) return NULL;
+        leaf = page_arena_alloc_leaf(table->arena);
+        table->directory[directory_index(page_index)] = leaf;
+        table->leaf_count++;
     }
 
-    // Decide search direction and record it.
-    bool search_from_head = ((page_index - table->head->page_index) <
-                             (table->tail->page_index - page_index));
-
-    if (search_from_head) {
-        // Search from head: find first node with page_index >= target.
-        PageTableEntry* current = table->head;
-        while (current && current->page_index < page_index) {
-            current = current->next;
-        }
-        if (current && current->page_index == page_index) {
-            return current;  // Found the page.
-        }
+    PageTableEntry* page = &leaf->entries[leaf_index(page_index)];
+    if (!page->is_allocated) {
         if (!allocate_if_unallocated) return NULL;
+        page->page_data = page_arena_alloc_frame(table->arena);
+        page->is_allocated = true;
+        page->page_index   = page_index;
+        count_allocated_pages(table, 1);
+    }
+    return page;
+}
 
-        // Allocate new page.
-        PageTableEntry* new_page = allocate_new_page(page_index);
-        // Determine insertion point.
-        if (current == table->head) {
-            // Insert at the beginning.
-            new_page->next = table->head;
-            table->head->prev = new_page;
-            table->head = new_page;
-        } else if (current == NULL) {
-            // Target is greater than all nodes; insert at tail.
-            new_page->prev = table->tail;
-            table->tail->next = new_page;
-            table->tail = new_page;
-        } else {
-            // Insert before the 'current' node.
-            new_page->next = current;
-            new_page->prev = current->prev;
-            if (current->prev) {
-                current->prev->next = new_page;
-            }
-            current->prev = new_page;
-        }
-        table->page_count++;
-        return new_page;
-
-    } else {
-        // Search from tail: find the last node with page_index <= target.
-        PageTableEntry* current = table->tail;
-        while (current && current->page_index > page_index) {
-            current = current->prev;
-        }
-        if (current && current->page_index == page_index) {
-            return current;  // Found the page.
-        }
-        if (!allocate_if_unallocated) return NULL;
+/* Return the entry for 'page_index', allocating the page if it is not yet. */
+PageTableEntry* allocate_page(PageTable* table, uint32_t page_index) {
+    return find_or_allocate_page(table, page_index, true);
+}
 
-        // Allocate new page.
-        PageTableEntry* new_page = allocate_new_page(page_index);
-        // Determine insertion point.
-        if (current == table->tail) {
-            // Insert at the end.
-            new_page->prev = table->tail;
-            table->tail->next = new_page;
-            table->tail = new_page;
-        } else if (current == NULL) {
-            // Target is less than all nodes; insert at head.
-            new_page->next = table->head;
-            table->head->prev = new_page;
-            table->head = new_page;
-        } else {
-            // Insert after 'current'.
-            new_page->next = current->next;
-            new_page->prev = current;
-            if (current->next) {
-                current->next->prev = new_page;
-            }
-            current->next = new_page;
-        }
-        table->page_count++;
-        return new_page;
+/**
+ * Hand the host mapping [base, base + size) to the table, which unmaps it in
+ * free_all_pages(). Returns false if it cannot be recorded.
+ */
+bool add_image_mapping(PageTable* table, uint8_t* base, size_t size) {
+    ImageMapping* mappings = realloc(table->image_mappings,
+                                     (table->image_mapping_count + 1) * sizeof(ImageMapping));
+    if (!mappings) {
+        fprintf(stderr, "Memory allocation failed for image mappings.\n");
+        return false;
     }
+    table->image_mappings = mappings;
+    table->image_mappings[table->image_mapping_count++] = (ImageMapping) { .base = base, .size = size };
+    return true;
 }
 
-bool has_cycle(PageTable *table) {
-    if (!table || !table->head) {
-        return false;
+/**
+ * Install 'data' as the frame of an unallocated page. The frame is not the
+ * arena's, so it must lie in a mapping passed to add_image_mapping().
+ */
+void map_page(PageTable* table, uint32_t page_index, uint8_t* data) {
+    PageTableLeaf* leaf = table->directory[directory_index(page_index)];
+    if (!leaf) {
+        leaf = page_arena_alloc_leaf(table->arena);
+        table->directory[directory_index(page_index)] = leaf;
+        table->leaf_count++;
     }
-    PageTableEntry *slow = table->head;
-    PageTableEntry *fast = table->head;
-    while (fast && fast->next) {
-        slow = slow->next;
-        fast = fast->next->next;
-        if (slow == fast) {
+    PageTableEntry* page = &leaf->entries[leaf_index(page_index)];
+    page->page_data = data;
+    page->is_allocated = true;
+    page->page_index = page_index;
+    count_allocated_pages(table, 1);
+}
+
+static bool is_image_frame(const PageTable* table, const uint8_t* frame) {
+    for (size_t i = 0; i < table->image_mapping_count; i++) {
+        const ImageMapping* mapping = &table->image_mappings[i];
+        if (frame >= mapping->base && frame < mapping->base + mapping->size) {
             return true;
         }
     }
     return false;
 }
-bool validate_list(PageTable *table) {
+
+bool validate_page_table(PageTable *table) {
     if (!table) {
         fprintf(stderr, "PageTable is NULL\n");
         return false;
     }
 
-    // Check for cycle first.
-    if (has_cycle(table)) {
-        fprintf(stderr, "Cycle detected in the page table!\n");
-        return false;
-    }
-
-    // Check next/prev consistency and count nodes.
     size_t count = 0;
-    PageTableEntry *current = table->head;
-    PageTableEntry *prev = NULL;
-    while (current) {
-        // Verify that the current node's previous pointer is as expected.
-        if (current->prev != prev) {
-            fprintf(stderr, "List corruption: inconsistent prev pointer at page index %u\n", current->page_index);
-            return false;
+    for (uint32_t dir = 0; dir < PAGE_DIRECTORY_ENTRIES; dir++) {
+        PageTableLeaf *leaf = table->directory[dir];
+        if (!leaf) continue;
+        for (uint32_t i = 0; i < PAGE_TABLE_LEAF_ENTRIES; i++) {
+            PageTableEntry *page = &leaf->entries[i];
+            if (!page->is_allocated) continue;
+            if (page->page_index != ((dir << PAGE_TABLE_LEAF_BITS) | i) || !page->page_data) {
+                fprintf(stderr, "Page table corruption at page index %u\n", page->page_index);
+                return false;
+            }
+            count++;
         }
-        prev = current;
-        current = current->next;
-        count++;
     }
 
     if (count != table->page_count) {
@@ -223,48 +143,127 @@ bool validate_list(PageTable *table) {
     }
     return true;
 }
+
 void dump_page_table(PageTable *table) {
-    PageTableEntry *current = table->head;
-    while (current) {
-        printf("Node %p: page_index=%u, prev=%p, next=%p\n",
-               (void*)current, current->page_index,
-               (void*)current->prev, (void*)current->next);
-        current = current->next;
+    for (uint32_t dir = 0; dir < PAGE_DIRECTORY_ENTRIES; dir++) {
+        PageTableLeaf *leaf = table->directory[dir];
+        if (!leaf) continue;
+        for (uint32_t i = 0; i < PAGE_TABLE_LEAF_ENTRIES; i++) {
+            if (leaf->entries[i].is_allocated) {
+                printf("Page %u: address=0x%08x, data=%p\n", leaf->entries[i].page_index,
+                       leaf->entries[i].page_index << PAGE_SHIFT, (void*)leaf->entries[i].page_data);
+            }
+        }
+    }
+}
+
+
+/* True if 'page_index' has memory behind it, with either backend. */
+bool is_page_allocated(const PageTable* table, uint32_t page_index) {
+    if (table->flat_base) {
+        return is_flat_page_committed(table, page_index);
     }
+    const PageTableLeaf* leaf = table->directory[directory_index(page_index)];
+    return leaf && leaf->entries[leaf_index(page_index)].is_allocated;
 }
 
+/**
+ * Take 'page_index' out of the table again, so that accesses to it fault as
+ * they did before it was allocated. Its frame goes back to the arena unless
+ * it is shared or belongs to an image mapping.
+ */
+void release_page(CPUState* state, uint32_t page_index) {
+    PageTable* table = state->page_table;
+    if (table->flat_base) {
+        flat_decommit_page(table, page_index);
+    } else {
+        PageTableLeaf* leaf = table->directory[directory_index(page_index)];
+        PageTableEntry* page = leaf ? &leaf->entries[leaf_index(page_index)] : NULL;
+        if (!page || !page->is_allocated) {
+            return;
+        }
+        if (!page->is_shared && !is_image_frame(table, page->page_data)) {
+            page_arena_free_frame(table->arena, page->page_data);
+        }
+        memset(page, 0, sizeof(PageTableEntry));
+        table->page_count--;
+    }
+    tlb_evict_page(state, page_index);
+}
 
 // -----------------------------------------------------------------------------
 // 8-Bit (Byte) Access
 // -----------------------------------------------------------------------------
+/*
+ * Give a page that shares a read-only frame (see paging_reclaim.c) its own
+ * copy before it is written. Reads and fetches may still have the shared
+ * frame cached, so those translations are dropped; the shared frame itself
+ * is released by the next reclaim pass once nothing refers to it.
+ */
+static void unshare_page(CPUState* state, PageTableEntry* page) {
+    uint8_t* frame = page_arena_alloc_frame(state->page_table->arena);
+    memcpy(frame, page->page_data, PAGE_SIZE);
+    page->page_data = frame;
+    page->is_shared = false;
+    tlb_evict_page(state, page->page_index);
+}
+
 /**
- * Returns a pointer to the single byte at 'address'.
- * If 'allocate_if_unallocated' is true, the page is allocated if needed.
+ * Returns a pointer to the single byte at 'address', walking the page table.
+ * If 'allocate_if_unallocated' is true, the pointer is for writing: the page
+ * is allocated if needed and never a shared frame.
  * Returns NULL on error/invalid access.
  */
-uint8_t* get_memory_ptr(CPUState* state, uint32_t address, bool allocate_if_unallocated)
+uint8_t* translate_address(CPUState* state, uint32_t address, bool allocate_if_unallocated)
 {
     uint32_t page_index = address >> PAGE_SHIFT;           // which page
     uint32_t offset     = address & (PAGE_SIZE - 1);       // byte offset
 
+    PageTable* table = state->page_table;
+    if (table->flat_base) {
+        // Flat backend: committed pages are at their guest address.
+        if (!is_flat_page_committed(table, page_index) &&
+            !(allocate_if_unallocated && flat_commit_pages(table, page_index, 1))) {
+            fprintf(stderr, "Memory access violation at address 0x%08x\n", address);
+            return NULL;
+        }
+        return table->flat_base + address;
+    }
+
     PageTableEntry* page = find_or_allocate_page(state->page_table, page_index, allocate_if_unallocated);
     if (!page || !page->is_allocated) {
         fprintf(stderr, "Memory access violation at address 0x%08x\n", address);
         return NULL;
     }
+    if (__builtin_expect(page->is_shared, 0) && allocate_if_unallocated) {
+        unshare_page(state, page);
+    }
     return page->page_data + offset;
 }
 
+/* translate_address() through the data TLB, or its write set when allocating. */
+uint8_t* get_memory_ptr(CPUState* state, uint32_t address, bool allocate_if_unallocated)
+{
+    uint8_t attributes;
+    TlbEntry* set = allocate_if_unallocated ? state->tlb.write : state->tlb.data;
+    return tlb_translate(state, set, address, allocate_if_unallocated, &attributes);
+}
+
 /**
- * Read a single byte (8 bits) from memory.
+ * Read a single byte (8 bits) from memory, or from a device register.
  * Returns 0 on error/invalid.
  */
 uint8_t get_memory(CPUState* state, uint32_t address) {
-    uint8_t* mem_ptr = get_memory_ptr(state, address, false);
+    uint8_t attributes;
+    uint8_t* mem_ptr = tlb_translate(state, state->tlb.data, address, false, &attributes);
     if (!mem_ptr) {
         // handle error
         return 0;
     }
+    uint32_t value;
+    if (__builtin_expect(attributes & PAGE_ATTR_MMIO, 0) && memory_read_trigger(state, address, &value)) {
+        return (uint8_t) value;
+    }
     return *mem_ptr;
 }
 
@@ -279,40 +278,33 @@ void set_memory(CPUState* state, uint32_t address, uint8_t value) {
         return;
     }
     *mem_ptr = value;
+    mark_address_dirty(state, address);
+    invalidate_code_range(state, address, 1);
 }
 
-// static void free_page(PageTable* table, PageTableEntry* page) {
-//     if (!page || !page->is_allocated) return;
-//
-//     free(page->page_data);
-//     page->page_data = NULL;
-//     page->is_allocated = false;
-//
-//     if (page->prev) {
-//         page->prev->next = page->next;
-//     } else {
-//         table->head = page->next;
-//     }
-//     if (page->next) {
-//         page->next->prev = page->prev;
-//     } else {
-//         table->tail = page->prev;
-//     }
-//     table->page_count--;
-//     free(page);
-// }
-
+/* Free the table; its pages and leaves go back to the arena for the next one. */
 void free_all_pages(PageTable* table) {
-    PageTableEntry* current = table->head;
-    // Use table->page_count to control the loop.
-    for (size_t i = 0; i < table->page_count && current != NULL; i++) {
-        if (current->is_allocated && current->page_data) {
-            free(current->page_data);
+    if (table->flat_base) {
+        free_flat_memory(table);
+    }
+    for (uint32_t dir = 0; dir < PAGE_DIRECTORY_ENTRIES; dir++) {
+        PageTableLeaf* leaf = table->directory[dir];
+        if (!leaf) continue;
+        for (uint32_t i = 0; i < PAGE_TABLE_LEAF_ENTRIES; i++) {
+            const PageTableEntry* page = &leaf->entries[i];
+            if (page->is_allocated && !page->is_shared && !is_image_frame(table, page->page_data)) {
+                page_arena_free_frame(table->arena, page->page_data);
+            }
         }
-        PageTableEntry* temp = current;
-        current = current->next;
-        free(temp);
+        page_arena_free_leaf(table->arena, leaf);
+    }
+    for (size_t i = 0; i < table->shared_frame_count; i++) {
+        page_arena_free_frame(table->arena, table->shared_frames[i]);
     }
+    free(table->shared_frames);
+    for (size_t i = 0; i < table->image_mapping_count; i++) {
+        munmap(table->image_mappings[i].base, table->image_mappings[i].size);
+    }
+    free(table->image_mappings);
     free(table);
 }
-
@@ -0,0 +1,154 @@
+//
+// paging_arena.c
+// Slab allocator for guest page data and page table leaves.
+//
+// Every CPU owns one arena, which outlives the page tables built on it.
+// Blocks are carved in order from PAGE_SLAB_SIZE anonymous mappings. A
+// freed block goes on its slab's free stack, so loading a new program reuses
+// the previous program's pages without going back to the OS. Once the new
+// image is in place, page_arena_trim() hands the memory of slabs that are
+// still completely unused back with madvise(MADV_DONTNEED). The mapping is
+// kept and reads as zero afterwards, so the slab is carved again from the
+// start without another mmap(). Single frames can be given back the same
+// way with page_arena_release_frame(); the free stack lives outside the
+// blocks, so a released frame takes no memory until it is handed out again.
+//
+
+#include "main.h"
+
+static void pool_init(SlabPool *pool, size_t block_size) {
+    pool->slabs = NULL;
+    pool->block_size = (block_size + PAGE_SIZE - 1) & ~(size_t) (PAGE_SIZE - 1);
+    pool->blocks_per_slab = (uint32_t) (PAGE_SLAB_SIZE / pool->block_size);
+    if (pool->blocks_per_slab == 0) {
+        pool->blocks_per_slab = 1;
+    }
+}
+
+static PageSlab* pool_add_slab(SlabPool *pool) {
+    PageSlab *slab = calloc(1, sizeof(PageSlab));
+    if (!slab) {
+        fprintf(stderr, "Memory allocation failed for page slab.\n");
+        exit(EXIT_FAILURE);
+    }
+    void *base = mmap(NULL, pool->block_size * pool->blocks_per_slab, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        perror("Failed to map page slab");
+        exit(EXIT_FAILURE);
+    }
+    slab->free_blocks = malloc(pool->blocks_per_slab * sizeof(void *));
+    if (!slab->free_blocks) {
+        fprintf(stderr, "Memory allocation failed for page slab.\n");
+        exit(EXIT_FAILURE);
+    }
+    slab->base = base;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    return slab;
+}
+
+/* A zeroed block, from a free stack if any slab has one, else carved fresh. */
+static void* pool_alloc(SlabPool *pool) {
+    PageSlab *slab;
+    for (slab = pool->slabs; slab; slab = slab->next) {
+        if (slab->free_count > 0) {
+            void *block = slab->free_blocks[--slab->free_count];
+            slab->live++;
+            memset(block, 0, pool->block_size);
+            return block;
+        }
+    }
+    for (slab = pool->slabs; slab; slab = slab->next) {
+        if (slab->carved < pool->blocks_per_slab) {
+            break;
+        }
+    }
+    if (!slab) {
+        slab = pool_add_slab(pool);
+    }
+    // Never handed out since mapping or trimming, so still zero.
+    void *block = slab->base + (size_t) slab->carved * pool->block_size;
+    slab->carved++;
+    slab->live++;
+    return block;
+}
+
+static void pool_free(SlabPool *pool, void *block) {
+    size_t slab_size = pool->block_size * pool->blocks_per_slab;
+    for (PageSlab *slab = pool->slabs; slab; slab = slab->next) {
+        if ((uint8_t *) block >= slab->base && (uint8_t *) block < slab->base + slab_size) {
+            slab->free_blocks[slab->free_count++] = block;
+            slab->live--;
+            return;
+        }
+    }
+    fprintf(stderr, "Freed block %p does not belong to the page arena\n", block);
+}
+
+static void pool_trim(SlabPool *pool) {
+    for (PageSlab *slab = pool->slabs; slab; slab = slab->next) {
+        if (slab->live != 0 || slab->carved == 0) {
+            continue;
+        }
+        if (madvise(slab->base, (size_t) slab->carved * pool->block_size, MADV_DONTNEED) != 0) {
+            perror("Failed to release page slab");
+            continue;
+        }
+        slab->carved = 0;
+        slab->free_count = 0;
+    }
+}
+
+static void pool_destroy(SlabPool *pool) {
+    PageSlab *slab = pool->slabs;
+    while (slab) {
+        PageSlab *next = slab->next;
+        munmap(slab->base, pool->block_size * pool->blocks_per_slab);
+        free(slab->free_blocks);
+        free(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+}
+
+void page_arena_init(PageArena *arena) {
+    pool_init(&arena->frames, PAGE_SIZE);
+    pool_init(&arena->leaves, sizeof(PageTableLeaf));
+}
+
+uint8_t* page_arena_alloc_frame(PageArena *arena) {
+    return pool_alloc(&arena->frames);
+}
+
+void page_arena_free_frame(PageArena *arena, uint8_t *frame) {
+    pool_free(&arena->frames, frame);
+}
+
+/* Free 'frame' and give its memory back to the OS until it is reused. */
+void page_arena_release_frame(PageArena *arena, uint8_t *frame) {
+    // Only fails for hosts with pages larger than PAGE_SIZE; the frame is
+    // then simply kept.
+    madvise(frame, PAGE_SIZE, MADV_DONTNEED);
+    pool_free(&arena->frames, frame);
+}
+
+PageTableLeaf* page_arena_alloc_leaf(PageArena *arena) {
+    return pool_alloc(&arena->leaves);
+}
+
+void page_arena_free_leaf(PageArena *arena, PageTableLeaf *leaf) {
+    pool_free(&arena->leaves, leaf);
+}
+
+/* Give the memory of every slab with no block in use back to the OS. */
+void page_arena_trim(PageArena *arena) {
+    pool_trim(&arena->frames);
+    pool_trim(&arena->leaves);
+}
+
+/* Unmap every slab. Page tables built on the arena must be freed first. */
+void page_arena_destroy(PageArena *arena) {
+    pool_destroy(&arena->frames);
+    pool_destroy(&arena->leaves);
+}
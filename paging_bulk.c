@@ -1,4 +1,5 @@
 #include "main.h"
+#include "dirty_pages.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -98,6 +99,23 @@ void bulk_copy_memory(CPUState *state, uint32_t address, const uint8_t *buffer,
     uint32_t end_address   = address + length;
     size_t   buffer_offset = 0;
 
+    // Any cached decode of the destination range is now stale.
+    invalidate_code_range(state, address, length);
+
+    PageTable *table = state->page_table;
+    if (table->flat_base && length > 0) {
+        // Flat backend: the range is contiguous once its pages are committed.
+        uint32_t first_page = address >> PAGE_SHIFT;
+        uint32_t last_page = (uint32_t) (address + length - 1) >> PAGE_SHIFT;
+        if (!flat_commit_pages(table, first_page, last_page - first_page + 1)) {
+            fprintf(stderr, "Failed to get memory pointer at address 0x%08x\n", address);
+            return;
+        }
+        memcpy_simd(table->flat_base + address, buffer, length);
+        mark_range_dirty(state, address, length);
+        return;
+    }
+
     while (address < end_address) {
         // Calculate offset within the current page
         uint32_t offset_in_page = address & (PAGE_SIZE - 1);
@@ -121,6 +139,7 @@ void bulk_copy_memory(CPUState *state, uint32_t address, const uint8_t *buffer,
 
         // Copy chunk using our 8-bit SIMD memcpy
         memcpy_simd(mem_ptr, buffer + buffer_offset, bytes_to_write);
+        mark_address_dirty(state, address);
 
         // Update for next iteration
         address       += bytes_to_write;
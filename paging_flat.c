@@ -0,0 +1,122 @@
+//
+// paging_flat.c
+// Flat memory backend: the whole 32-bit guest address space as one host
+// mapping.
+//
+// The 4 GiB are reserved once with PROT_NONE and MAP_NORESERVE, which costs
+// address space but no memory. A page is committed with mprotect() the first
+// time it would have been allocated by the paged backend, so both backends
+// map the same pages and report the same access violations. A guest address
+// is then simply an offset from flat_base, and any committed range is
+// contiguous in host memory. The pages of a boot image are instead mapped
+// from the program file, copy-on-write.
+//
+
+#include "main.h"
+
+#define FLAT_SPACE_SIZE ((size_t) NUM_PAGES * PAGE_SIZE)
+
+/**
+ * Create a page table using the flat backend. Returns NULL if the address
+ * space cannot be reserved (e.g. on a 32-bit host or under a tight
+ * RLIMIT_AS), so the caller can fall back to the paged backend.
+ */
+PageTable* create_flat_page_table(PageArena *arena) {
+    PageTable *table = create_page_table(arena);
+    table->flat_committed = calloc(NUM_PAGES / 8, 1);
+    if (!table->flat_committed) {
+        fprintf(stderr, "Memory allocation failed for flat memory page bitmap.\n");
+        free(table);
+        return NULL;
+    }
+    void *base = mmap(NULL, FLAT_SPACE_SIZE, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        perror("Failed to reserve flat guest address space");
+        free(table->flat_committed);
+        free(table);
+        return NULL;
+    }
+    table->flat_base = base;
+    return table;
+}
+
+bool is_flat_page_committed(const PageTable *table, uint32_t page) {
+    return (table->flat_committed[page >> 3] >> (page & 7)) & 1;
+}
+
+/**
+ * Make 'count' pages from 'first_page' accessible; pages read as zero until
+ * written. Returns false if the host refuses to commit them.
+ */
+bool flat_commit_pages(PageTable *table, uint32_t first_page, uint32_t count) {
+    uint32_t page = first_page;
+    uint32_t end = first_page + count;
+    while (page < end) {
+        if (is_flat_page_committed(table, page)) {
+            page++;
+            continue;
+        }
+        // Commit the run of uncommitted pages starting here with one call.
+        uint32_t run_end = page + 1;
+        while (run_end < end && !is_flat_page_committed(table, run_end)) {
+            run_end++;
+        }
+        if (mprotect(table->flat_base + (size_t) page * PAGE_SIZE,
+                     (size_t) (run_end - page) * PAGE_SIZE, PROT_READ | PROT_WRITE) != 0) {
+            perror("Failed to commit flat guest memory");
+            return false;
+        }
+        for (uint32_t p = page; p < run_end; p++) {
+            table->flat_committed[p >> 3] |= (uint8_t) (1u << (p & 7));
+        }
+        count_allocated_pages(table, run_end - page);
+        page = run_end;
+    }
+    return true;
+}
+
+/**
+ * Map the first 'count' pages of the file 'fd' copy-on-write at
+ * 'first_page', which must not be committed yet. Returns false if the host
+ * refuses, e.g. when its pages are larger than PAGE_SIZE and the address is
+ * not aligned to one.
+ */
+bool flat_map_file(PageTable *table, uint32_t first_page, uint32_t count, int fd) {
+    void *address = table->flat_base + (size_t) first_page * PAGE_SIZE;
+    if (mmap(address, (size_t) count * PAGE_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        perror("Failed to map program into flat guest memory");
+        // Put the reservation back so the range can still be committed.
+        mmap(address, (size_t) count * PAGE_SIZE, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+        return false;
+    }
+    for (uint32_t p = first_page; p < first_page + count; p++) {
+        table->flat_committed[p >> 3] |= (uint8_t) (1u << (p & 7));
+    }
+    count_allocated_pages(table, count);
+    return true;
+}
+
+/* Make a committed page inaccessible again and drop its contents. */
+void flat_decommit_page(PageTable *table, uint32_t page) {
+    if (!is_flat_page_committed(table, page)) {
+        return;
+    }
+    // Mapping over the page replaces file-backed pages as well.
+    if (mmap(table->flat_base + (size_t) page * PAGE_SIZE, PAGE_SIZE, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        perror("Failed to decommit flat guest memory");
+        return;
+    }
+    table->flat_committed[page >> 3] &= (uint8_t) ~(1u << (page & 7));
+    table->page_count--;
+}
+
+void free_flat_memory(PageTable *table) {
+    munmap(table->flat_base, FLAT_SPACE_SIZE);
+    free(table->flat_committed);
+    table->flat_base = NULL;
+    table->flat_committed = NULL;
+}
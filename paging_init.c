@@ -13,19 +13,112 @@ static inline size_t get_section_size_in_bytes(const MemorySection *section) {
 }
 
 /**
- * Initialize the page table and load the boot sector into memory (in bytes).
- * All 16-bit logic is removed; everything is handled as 8-bit.
+ * Back 'section' with an image file without reading it: the image pages are
+ * mapped copy-on-write, the rest of the section is anonymous memory that
+ * reads as zero, and the host allocates a page only once it is touched.
+ * Clean image pages stay in the host page cache, so every emulator process
+ * running the same image shares them and holds only the pages it wrote.
+ * Returns false if the mapping cannot be made, in which case nothing has
+ * been installed.
  */
-void initialize_page_table(CPUState *state, uint8_t *boot_sector_buffer, size_t boot_size) {
+static bool map_image_section(PageTable *table, const MemorySection *section, const ProgramImage *image) {
+    uint32_t first_page = section->start_address >> PAGE_SHIFT;
+    uint32_t image_pages = (uint32_t) ((image->size + PAGE_SIZE - 1) / PAGE_SIZE);
+
+    if (table->flat_base) {
+        if (image_pages > 0 && !flat_map_file(table, first_page, image_pages, image->fd)) {
+            return false;
+        }
+        // Committed flat pages take no memory until they are touched.
+        return flat_commit_pages(table, first_page + image_pages, section->page_count - image_pages);
+    }
+
+    size_t section_size_bytes = get_section_size_in_bytes(section);
+    uint8_t *base = mmap(NULL, section_size_bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        perror("Failed to map image section");
+        return false;
+    }
+    if (image_pages > 0 &&
+        mmap(base, (size_t) image_pages * PAGE_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, image->fd, 0) == MAP_FAILED) {
+        perror("Failed to map image file");
+        munmap(base, section_size_bytes);
+        return false;
+    }
+    if (!add_image_mapping(table, base, section_size_bytes)) {
+        munmap(base, section_size_bytes);
+        return false;
+    }
+    for (uint32_t page = 0; page < section->page_count; page++) {
+        map_page(table, first_page + page, base + (size_t) page * PAGE_SIZE);
+    }
+    return true;
+}
+
+/**
+ * Place 'image' at the start of 'section', mapped where the host allows it
+ * and copied otherwise. Returns false if it does not fit.
+ */
+static bool load_image_section(CPUState *state, const MemorySection *section, const ProgramImage *image) {
+    // Calculate how many bytes this section can hold
+    size_t section_size_bytes = get_section_size_in_bytes(section);
+
+    // If the image is larger than this section, error out
+    if (image->size > section_size_bytes) {
+        fprintf(stderr,
+                "[ERROR] %s: image size (%zu bytes) exceeds section size (%zu bytes)\n",
+                section->section_name, image->size, section_size_bytes);
+        return false;
+    }
+
+    if (!map_image_section(state->page_table, section, image)) {
+        // Copy the image instead; fresh pages are already zero, so the
+        // rest of the section only has to be allocated.
+        bulk_copy_memory(state, section->start_address, image->data, image->size);
+        uint32_t image_pages = (uint32_t) ((image->size + PAGE_SIZE - 1) / PAGE_SIZE);
+        for (uint32_t page = image_pages; page < section->page_count; page++) {
+            get_memory_ptr(state, section->start_address + page * PAGE_SIZE, true);
+        }
+    }
+    return true;
+}
+
+/**
+ * Initialize the page table and load the program into the boot sector and
+ * the flash image, if any ('flash' may be NULL), into the flash sections.
+ * Images are mapped rather than copied where the host allows it, so loading
+ * costs little more than the pages the program goes on to touch.
+ */
+void initialize_page_table(CPUState *state, const ProgramImage *program, const ProgramImage *flash) {
+    // A checkpoint describes the memory being thrown away.
+    discard_checkpoint(state);
     if (state->page_table) {
         free_all_pages(state->page_table);
     }
 
     MemoryConfig *mem_config = &state->memory_config;
 
-    // Create the page table
-    PageTable *page_table = create_page_table();
+    // Decoded instructions and blocks refer to the old image
+    flush_decode_cache(state);
+    flush_block_cache(state);
+    release_boot_image(state);
+
+    // Create the page table; cached translations point into the old one
+    PageTable *page_table = NULL;
+    if (mem_config->backend == MEMORY_FLAT) {
+        page_table = create_flat_page_table(&state->page_arena);
+        if (!page_table) {
+            fprintf(stderr, "[WARN] Falling back to the paged memory backend.\n");
+        }
+    }
+    if (!page_table) {
+        page_table = create_page_table(&state->page_arena);
+    }
     state->page_table = page_table;
+    tlb_flush(state);
+    stack_engine_reset(state);
 
     // Go through each memory section
     for (size_t i = 0; i < mem_config->section_count; ++i) {
@@ -33,51 +126,27 @@ void initialize_page_table(CPUState *state, uint8_t *boot_sector_buffer, size_t
 
         switch (section->type) {
             case BOOT_SECTOR: {
-                // Calculate how many bytes this BOOT_SECTOR can hold
-                size_t section_size_bytes = get_section_size_in_bytes(section);
-
-                // If the boot file is larger than this section, error out
-                if (boot_size > section_size_bytes) {
-                    fprintf(stderr,
-                            "[ERROR] Boot file size (%zu bytes) exceeds boot sector size (%zu bytes)\n",
-                            boot_size, section_size_bytes);
+                if (!load_image_section(state, section, program)) {
                     return; // or handle as needed
                 }
 
-                // Copy the entire boot sector in a single byte-based operation
-                bulk_copy_memory(
-                    state,
-                    section->start_address,              // destination (in CPU memory)
-                    boot_sector_buffer,                  // source (host buffer)
-                    boot_size                            // number of BYTES to copy
-                );
-
-                // If boot file is smaller than the section, pad the remainder with zeros
-                size_t remainder_bytes = section_size_bytes - boot_size;
-                if (remainder_bytes > 0) {
-                    // Allocate a temporary zero-filled buffer
-                    uint8_t *zero_buffer = (uint8_t *)calloc(remainder_bytes, sizeof(uint8_t));
-                    if (!zero_buffer) {
-                        fprintf(stderr, "[ERROR] Unable to allocate zero buffer for padding.\n");
-                        return;
-                    }
-
-                    // Copy zeros to the remainder of the BOOT_SECTOR
-                    bulk_copy_memory(
-                        state,
-                        section->start_address + (uint32_t)boot_size,
-                        zero_buffer,
-                        remainder_bytes
-                    );
-
-                    // Clean up
-                    free(zero_buffer);
+                // Start tracking writes only now that the image is in place
+                record_boot_image(state, section->start_address, program->data, program->size);
+                attach_aot_image(state);
+                break;
+            }
+
+            case FLASH: {
+                // Without a flash image the section is plain memory.
+                if (flash && flash->size > 0) {
+                    load_image_section(state, section, flash);
                 }
                 break;
             }
 
-            case STACK: {
-                // For each page in the STACK section, call get_memory_ptr on one byte
+            case STACK:
+            case MMIO_PAGE: {
+                // For each page in the STACK or MMIO section, call get_memory_ptr on one byte
                 for (unsigned int page = 0; page < section->page_count; ++page) {
                     // Calculate the start address for the current page
                     unsigned int address = section->start_address + (page * PAGE_SIZE);
@@ -88,12 +157,82 @@ void initialize_page_table(CPUState *state, uint8_t *boot_sector_buffer, size_t
             }
             // You can add similar logic for these if needed
             case USABLE_MEMORY:
-            case MMIO_PAGE:
-            case FLASH:
             case UNKNOWN_TYPE:
             default:
                 // No special handling in this example
                 break;
         }
     }
+
+    // Dirty tracking starts from the memory as loaded.
+    clear_dirty_pages(state);
+
+    // The new image reused freed pages first; return slabs it did not need.
+    page_arena_trim(&state->page_arena);
+}
+
+/**
+ * Remember which image now occupies the boot sector. Translations of the
+ * image (built in or loaded from disk) are only used for pages that have
+ * not been written since.
+ */
+void record_boot_image(CPUState *state, uint32_t load_address, const uint8_t *image, size_t size) {
+    release_boot_image(state);
+    if (size == 0) {
+        return;
+    }
+    size_t page_count = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    state->boot_image.dirty_pages = calloc((page_count + 7) / 8, 1);
+    if (!state->boot_image.dirty_pages) {
+        fprintf(stderr, "[ERROR] Unable to allocate boot image page bitmap.\n");
+        return;
+    }
+    state->boot_image.hash = hash_bytes(image, size);
+    state->boot_image.load_address = load_address;
+    state->boot_image.size = (uint32_t) size;
+}
+
+void release_boot_image(CPUState *state) {
+    detach_aot_image(state);
+    free(state->boot_image.dirty_pages);
+    memset(&state->boot_image, 0, sizeof(BootImage));
+}
+
+/* Called for every guest write; marks the boot image pages it touches. */
+void mark_boot_image_written(CPUState *state, uint32_t address, size_t length) {
+    BootImage *image = &state->boot_image;
+    if (image->size == 0 || length == 0) {
+        return;
+    }
+    uint64_t start = address;
+    uint64_t end = start + length;
+    uint64_t image_end = (uint64_t) image->load_address + image->size;
+    if (end <= image->load_address || start >= image_end) {
+        return;
+    }
+    if (start < image->load_address) start = image->load_address;
+    if (end > image_end) end = image_end;
+
+    uint32_t first_page = (uint32_t) ((start - image->load_address) / PAGE_SIZE);
+    uint32_t last_page  = (uint32_t) ((end - 1 - image->load_address) / PAGE_SIZE);
+    for (uint32_t page = first_page; page <= last_page; page++) {
+        image->dirty_pages[page >> 3] |= (uint8_t) (1u << (page & 7));
+    }
+}
+
+/* True if [start, end) lies inside the boot image and none of it was written since load. */
+bool is_boot_image_range_clean(const CPUState *state, uint32_t start, uint32_t end) {
+    const BootImage *image = &state->boot_image;
+    if (image->size == 0 || start >= end || start < image->load_address ||
+        (uint64_t) end > (uint64_t) image->load_address + image->size) {
+        return false;
+    }
+    uint32_t first_page = (start - image->load_address) / PAGE_SIZE;
+    uint32_t last_page  = (end - 1 - image->load_address) / PAGE_SIZE;
+    for (uint32_t page = first_page; page <= last_page; page++) {
+        if ((image->dirty_pages[page >> 3] >> (page & 7)) & 1) {
+            return false;
+        }
+    }
+    return true;
 }
@@ -0,0 +1,312 @@
+//
+// paging_reclaim.c
+// On-demand reclamation of guest memory: zero pages and duplicate pages.
+//
+// Pages are allocated on first write and otherwise kept until the page
+// table goes, so a long run accumulates pages that are all zero (cleared
+// buffers, stack pages) or identical to one another. A reclaim pass points
+// every all-zero page at one read-only zero frame and every set of identical
+// pages at a single frame, and releases the frames that are no longer needed
+// to the OS. Shared pages are marked is_shared; the first write to one gives
+// it a private copy again (see translate_address()).
+//
+// Frames merged by a pass are owned by the table (shared_frames). Writes do
+// not keep reference counts; each pass recounts the references instead,
+// frees frames nothing points at any more and hands frames left with a
+// single user back to it.
+//
+// With the flat backend, pages cannot be redirected. All-zero resident pages
+// are released in place with madvise(MADV_DONTNEED) and read back as zero, and
+// the reserved space is offered to the kernel's same-page merging
+// (MADV_MERGEABLE), which takes care of duplicates where it is enabled.
+// Pages of image sections and MMIO pages are left alone with both backends.
+//
+
+#include "main.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386) || defined(_M_IX86)
+    #define PLATFORM_X86
+    #include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+    #define PLATFORM_ARM
+    #include <arm_neon.h>
+#endif
+
+// Shared by every all-zero page of every table; never written.
+static const uint8_t zero_frame[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+/* True if the PAGE_SIZE bytes at 'page' are all zero. */
+static bool is_zero_page(const uint8_t *page) {
+#if defined(PLATFORM_X86)
+    // OR the page together 128 bytes at a time and stop at the first non-zero block.
+    for (size_t i = 0; i < PAGE_SIZE; i += 128) {
+        __m256i acc = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i *) (page + i)),
+                            _mm256_loadu_si256((const __m256i *) (page + i + 32))),
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i *) (page + i + 64)),
+                            _mm256_loadu_si256((const __m256i *) (page + i + 96))));
+        if (!_mm256_testz_si256(acc, acc)) {
+            return false;
+        }
+    }
+    return true;
+#elif defined(PLATFORM_ARM)
+    for (size_t i = 0; i < PAGE_SIZE; i += 64) {
+        uint8x16_t acc = vorrq_u8(vorrq_u8(vld1q_u8(page + i), vld1q_u8(page + i + 16)),
+                                  vorrq_u8(vld1q_u8(page + i + 32), vld1q_u8(page + i + 48)));
+        if (vmaxvq_u8(acc) != 0) {
+            return false;
+        }
+    }
+    return true;
+#else
+    uint64_t acc = 0;
+    for (size_t i = 0; i < PAGE_SIZE; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, page + i, sizeof(word));
+        acc |= word;
+    }
+    return acc == 0;
+#endif
+}
+
+static uint64_t hash_page(const uint8_t *page) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < PAGE_SIZE; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, page + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+// One distinct page content seen during a pass.
+typedef struct {
+    uint8_t *frame;             // NULL for an empty slot
+    uint64_t hash;
+    PageTableEntry *owner;      // Last page found using the frame
+    uint32_t references;        // Pages using the frame
+    bool shared;                // Frame is (or will be) in table->shared_frames
+} FrameRecord;
+
+typedef struct {
+    FrameRecord *records;
+    size_t mask;                // Slot count - 1, a power of two
+} FrameIndex;
+
+/* The record for 'frame' if it was added, else the record of an identical frame, else an empty slot. */
+static FrameRecord* find_frame(FrameIndex *index, const uint8_t *frame, uint64_t hash) {
+    for (size_t slot = hash & index->mask;; slot = (slot + 1) & index->mask) {
+        FrameRecord *record = &index->records[slot];
+        if (!record->frame || record->frame == frame ||
+            (record->hash == hash && memcmp(record->frame, frame, PAGE_SIZE) == 0)) {
+            return record;
+        }
+    }
+}
+
+static bool is_reclaimable(const PageTable *table, const MemoryConfig *config,
+                           const PageTableEntry *page) {
+    if (lookup_page_attributes(config, page->page_index << PAGE_SHIFT)->flags & PAGE_ATTR_MMIO) {
+        return false;
+    }
+    for (size_t i = 0; i < table->image_mapping_count; i++) {
+        const ImageMapping *mapping = &table->image_mappings[i];
+        if (page->page_data >= mapping->base && page->page_data < mapping->base + mapping->size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void for_each_page(PageTable *table, void (*visit)(PageTableEntry *, void *), void *context) {
+    for (uint32_t dir = 0; dir < PAGE_DIRECTORY_ENTRIES; dir++) {
+        PageTableLeaf *leaf = table->directory[dir];
+        if (!leaf) continue;
+        for (uint32_t i = 0; i < PAGE_TABLE_LEAF_ENTRIES; i++) {
+            if (leaf->entries[i].is_allocated) {
+                visit(&leaf->entries[i], context);
+            }
+        }
+    }
+}
+
+typedef struct {
+    CPUState *state;
+    FrameIndex index;
+    ReclaimStats *stats;
+} ReclaimPass;
+
+/* First walk: count the users of the frames merged by earlier passes. */
+static void count_shared_page(PageTableEntry *page, void *context) {
+    ReclaimPass *pass = context;
+    if (!page->is_shared || page->page_data == zero_frame) {
+        return;
+    }
+    uint64_t hash = hash_page(page->page_data);
+    FrameRecord *record = find_frame(&pass->index, page->page_data, hash);
+    if (!record->frame) {
+        *record = (FrameRecord) { .frame = page->page_data, .hash = hash, .shared = true };
+    } else if (record->frame != page->page_data) {
+        // A second merged frame with the same contents; fold it into the first.
+        page->page_data = record->frame;
+        pass->stats->merged_pages++;
+    }
+    record->owner = page;
+    record->references++;
+}
+
+/* Second walk: share the private pages that are zero or duplicates. */
+static void reclaim_private_page(PageTableEntry *page, void *context) {
+    ReclaimPass *pass = context;
+    PageTable *table = pass->state->page_table;
+    if (page->is_shared || !is_reclaimable(table, &pass->state->memory_config, page)) {
+        return;
+    }
+    if (is_zero_page(page->page_data)) {
+        page_arena_release_frame(table->arena, page->page_data);
+        page->page_data = (uint8_t *) zero_frame;
+        page->is_shared = true;
+        pass->stats->zero_pages++;
+        pass->stats->released_bytes += PAGE_SIZE;
+        return;
+    }
+    uint64_t hash = hash_page(page->page_data);
+    FrameRecord *record = find_frame(&pass->index, page->page_data, hash);
+    if (!record->frame) {
+        *record = (FrameRecord) { .frame = page->page_data, .hash = hash, .owner = page, .references = 1 };
+        return;
+    }
+    // Identical to a frame seen before: use that one.
+    page_arena_release_frame(table->arena, page->page_data);
+    page->page_data = record->frame;
+    page->is_shared = true;
+    record->owner->is_shared = true;
+    record->owner = page;
+    record->references++;
+    record->shared = true;
+    pass->stats->merged_pages++;
+    pass->stats->released_bytes += PAGE_SIZE;
+}
+
+/* Rebuild table->shared_frames from the records, releasing frames no page uses. */
+static void rebuild_shared_frames(ReclaimPass *pass) {
+    PageTable *table = pass->state->page_table;
+    size_t count = 0;
+    for (size_t slot = 0; slot <= pass->index.mask; slot++) {
+        const FrameRecord *record = &pass->index.records[slot];
+        count += record->frame && record->shared && record->references > 1;
+    }
+    uint8_t **frames = malloc((count ? count : 1) * sizeof(uint8_t *));
+    if (!frames) {
+        fprintf(stderr, "Memory allocation failed for shared frames.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t kept = 0;
+    for (size_t slot = 0; slot <= pass->index.mask; slot++) {
+        FrameRecord *record = &pass->index.records[slot];
+        if (!record->frame || !record->shared) {
+            continue;
+        }
+        if (record->references > 1) {
+            frames[kept++] = record->frame;
+        } else {
+            // Only one page is left on the frame; it is that page's own again.
+            record->owner->is_shared = false;
+        }
+    }
+
+    // Frames merged earlier that no page refers to any more.
+    for (size_t i = 0; i < table->shared_frame_count; i++) {
+        uint8_t *frame = table->shared_frames[i];
+        const FrameRecord *record = find_frame(&pass->index, frame, hash_page(frame));
+        if (record->frame != frame) {
+            page_arena_release_frame(table->arena, frame);
+            pass->stats->released_bytes += PAGE_SIZE;
+        }
+    }
+    free(table->shared_frames);
+    table->shared_frames = frames;
+    table->shared_frame_count = kept;
+}
+
+static void reclaim_paged_memory(CPUState *state, ReclaimStats *stats) {
+    PageTable *table = state->page_table;
+    size_t slots = 64;
+    while (slots < 2 * (table->page_count + table->shared_frame_count)) {
+        slots *= 2;
+    }
+    ReclaimPass pass = {
+        .state = state,
+        .index = { .records = calloc(slots, sizeof(FrameRecord)), .mask = slots - 1 },
+        .stats = stats,
+    };
+    if (!pass.index.records) {
+        fprintf(stderr, "Memory allocation failed for reclaim pass.\n");
+        return;
+    }
+    for_each_page(table, count_shared_page, &pass);
+    for_each_page(table, reclaim_private_page, &pass);
+    rebuild_shared_frames(&pass);
+    free(pass.index.records);
+}
+
+static bool is_image_section(const MemoryConfig *config, uint32_t address) {
+    const PageAttributes *attributes = lookup_page_attributes(config, address);
+    if (attributes->section == NO_SECTION) {
+        return false;
+    }
+    PageType type = config->sections[attributes->section].type;
+    return type == BOOT_SECTOR || type == FLASH;
+}
+
+static void reclaim_flat_memory(CPUState *state, ReclaimStats *stats) {
+    PageTable *table = state->page_table;
+    const MemoryConfig *config = &state->memory_config;
+    for (uint32_t first = 0; first < NUM_PAGES; first += 8) {
+        // Eight pages per bitmap byte; only those committed and resident can be released.
+#ifdef DARWIN
+        char resident[8];
+#else
+        unsigned char resident[8];
+#endif
+        if (table->flat_committed[first >> 3] == 0 ||
+            mincore(table->flat_base + (size_t) first * PAGE_SIZE, 8 * PAGE_SIZE, resident) != 0) {
+            continue;
+        }
+        for (uint32_t page = first; page < first + 8; page++) {
+            uint32_t address = page << PAGE_SHIFT;
+            if (!(resident[page - first] & 1) || !is_flat_page_committed(table, page) ||
+                is_image_section(config, address) ||
+                (lookup_page_attributes(config, address)->flags & PAGE_ATTR_MMIO)) {
+                continue;
+            }
+            uint8_t *data = table->flat_base + address;
+            if (is_zero_page(data) && madvise(data, PAGE_SIZE, MADV_DONTNEED) == 0) {
+                stats->zero_pages++;
+                stats->released_bytes += PAGE_SIZE;
+            }
+        }
+    }
+#ifdef MADV_MERGEABLE
+    // Fails harmlessly on kernels built without same-page merging.
+    madvise(table->flat_base, (size_t) NUM_PAGES * PAGE_SIZE, MADV_MERGEABLE);
+#endif
+}
+
+/**
+ * Run one reclaim pass over the current page table and add what it gave
+ * back to 'stats'. The CPU must not be running. Cached translations and the
+ * stack engine's pages are dropped, since they may point at released frames.
+ */
+void reclaim_guest_memory(CPUState *state, ReclaimStats *stats) {
+    if (state->page_table->flat_base) {
+        reclaim_flat_memory(state, stats);
+    } else {
+        reclaim_paged_memory(state, stats);
+    }
+    tlb_flush(state);
+    stack_engine_reset(state);
+}
@@ -1,5 +1,93 @@
 //
 // Created by dulat on 2/19/23.
 //
+// Built-in MMIO devices. Each is described once by an MmioDeviceType and
+// can be mapped at any page-aligned address with device = <name>.
+//
 
 #include "main.h"
+
+#include "uart.h"
+
+// -----------------------------------------------------------------------------
+// UART: a byte written to TX is transmitted; RX holds the last byte received,
+// latched as its receive interrupt is serviced.
+// -----------------------------------------------------------------------------
+enum { UART_REG_TX, UART_REG_RX };
+
+static const MmioRegister uart_registers[] = {
+    [UART_REG_TX] = { "TX", 0x00, 1, PAGE_ATTR_WRITE },
+    [UART_REG_RX] = { "RX", 0x01, 1, PAGE_ATTR_READ },
+};
+
+static uint32_t uart_register_read(CPUState *state, __attribute__((unused)) const MmioDevice *device,
+                                   __attribute__((unused)) const MmioRegister *reg) {
+    return state->uart->rx_reg;
+}
+
+static void uart_register_write(CPUState *state, __attribute__((unused)) const MmioDevice *device,
+                                __attribute__((unused)) const MmioRegister *reg, uint32_t value) {
+    uart_write(state->uart, (uint8_t) value);
+}
+
+static void uart_receive_interrupt(CPUState *state, __attribute__((unused)) const MmioDevice *device) {
+    uint8_t value;
+    if (uart_read(state->uart, &value)) {
+        state->uart->rx_reg = value;
+        printf("%02x\n", value);
+    }
+}
+
+static const MmioDeviceType uart_device = {
+    .name = "UART",
+    .registers = uart_registers,
+    .register_count = sizeof(uart_registers) / sizeof(uart_registers[0]),
+    .read = uart_register_read,
+    .write = uart_register_write,
+    .irq = UART_IRQ_RX,
+    .interrupt = uart_receive_interrupt,
+};
+
+// -----------------------------------------------------------------------------
+// PIC: writing the number of vectors to IVT_LOAD registers that many ISR
+// addresses from the big-endian table whose address is in IVT_BASE.
+// -----------------------------------------------------------------------------
+enum { PIC_REG_IVT_BASE, PIC_REG_IVT_LOAD };
+
+static const MmioRegister pic_registers[] = {
+    [PIC_REG_IVT_BASE] = { "IVT_BASE", 0x00, 4, 0 },  // Plain memory, read on IVT_LOAD
+    [PIC_REG_IVT_LOAD] = { "IVT_LOAD", 0x04, 1, PAGE_ATTR_WRITE },
+};
+
+static void pic_register_write(CPUState *state, const MmioDevice *device,
+                               __attribute__((unused)) const MmioRegister *reg, uint32_t value) {
+    // Read the base address of the IVT and its length
+    uint32_t ivt_base = read32(state, device->base + pic_registers[PIC_REG_IVT_BASE].offset);
+    uint8_t ivt_length = (uint8_t) value;
+    printf("Loading IVT at address %08x, length %02x\n", ivt_base, ivt_length);
+
+    // Each entry is a big-endian 32-bit address and the table may span pages
+    for (uint8_t source = 0; source < ivt_length; source++) {
+        uint32_t handler_address = read32(state, ivt_base + 4u * source);
+        if (register_interrupt_vector(state->i_vector_table, source, handler_address)) {
+            printf("Registered interrupt vector for source %u: handler=0x%08x\n", source, handler_address);
+        } else {
+            printf("Error: Failed to register interrupt vector for source %u\n", source);
+        }
+    }
+}
+
+static const MmioDeviceType pic_device = {
+    .name = "PIC",
+    .registers = pic_registers,
+    .register_count = sizeof(pic_registers) / sizeof(pic_registers[0]),
+    .read = NULL,
+    .write = pic_register_write,
+    .irq = -1,
+    .interrupt = NULL,
+};
+
+void register_builtin_devices(void) {
+    register_mmio_device_type(&uart_device);
+    register_mmio_device_type(&pic_device);
+}
@@ -0,0 +1,234 @@
+//
+// stack.c
+// Stack engine behind psh, pop, jsr, rts and interrupt entry.
+//
+// The first 4 bytes of the STACK section hold the stack pointer: the number
+// of bytes in use. The data area follows and grows upward. The first push
+// or pop after a page table is built resolves the section once, and each
+// page's host address is kept once it is first used, so a push or pop is
+// one bounds compare and a single load or store into the page. Pages are
+// resolved for writing, so they never point at a shared frame. Stores,
+// including those to the stack pointer, mark their page in the dirty bitmap.
+//
+// The stack pointer itself is read and written through the cached pointer
+// instead of being held in a register: guest code may load or store the
+// word with ordinary moves, and both sides must keep agreeing on it.
+//
+
+#include "main.h"
+#include "guest_memory.h"
+#include "dirty_pages.h"
+
+static const MemorySection* find_stack_section(const MemoryConfig *config) {
+    for (size_t i = 0; i < config->section_count; i++) {
+        if (config->sections[i].type == STACK) {
+            return &config->sections[i];
+        }
+    }
+    return NULL;
+}
+
+static __attribute__((noinline)) uint8_t* resolve_stack_page(CPUState *state, uint32_t page) {
+    StackEngine *stack = &state->stack;
+    stack->pages[page] = get_memory_ptr(state, stack->base + page * PAGE_SIZE, true);
+    if (!stack->pages[page]) {
+        fprintf(stderr, "Error: Unable to access stack memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    return stack->pages[page];
+}
+
+static inline uint8_t* stack_page(CPUState *state, uint32_t page) {
+    uint8_t *host = state->stack.pages[page];
+    return __builtin_expect(host != NULL, 1) ? host : resolve_stack_page(state, page);
+}
+
+/* Resolve the STACK section. Exits if it is unusable. */
+static void stack_engine_bind(CPUState *state) {
+    StackEngine *stack = &state->stack;
+    const MemorySection *section = find_stack_section(&state->memory_config);
+    if (!section) {
+        fprintf(stderr, "Error: Stack section not found in configuration.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint8_t **pages = calloc(section->page_count, sizeof(uint8_t *));
+    if (!pages) {
+        fprintf(stderr, "Memory allocation failed for stack pages.\n");
+        exit(EXIT_FAILURE);
+    }
+    stack->base = section->start_address;
+    stack->limit = section->page_count * PAGE_SIZE - 4;
+    stack->pages = pages;
+    stack->page_count = section->page_count;
+    stack->sp = (uint32_t *) stack_page(state, 0);
+    stack->bound = true;
+}
+
+/**
+ * Forget the resolved section. Called whenever the page table or the memory
+ * sections change; the next stack operation resolves them again.
+ */
+void stack_engine_reset(CPUState *state) {
+    StackEngine *stack = &state->stack;
+    free(stack->pages);
+    memset(stack, 0, sizeof(StackEngine));
+}
+
+static inline StackEngine* stack_engine(CPUState *state) {
+    if (__builtin_expect(!state->stack.bound, 0)) {
+        stack_engine_bind(state);
+    }
+    return &state->stack;
+}
+
+/* Host address of the data byte at 'offset'; the caller keeps it below 'limit'. */
+static inline uint8_t* stack_data(CPUState *state, uint32_t offset) {
+    offset += 4;
+    return stack_page(state, offset >> PAGE_SHIFT) + (offset & (PAGE_SIZE - 1));
+}
+
+/* As stack_data(), for a store: the page is marked as written. */
+static inline uint8_t* stack_data_for_write(CPUState *state, uint32_t offset) {
+    offset += 4;
+    mark_page_dirty(state, (state->stack.base >> PAGE_SHIFT) + (offset >> PAGE_SHIFT));
+    return stack_page(state, offset >> PAGE_SHIFT) + (offset & (PAGE_SIZE - 1));
+}
+
+/* Store the stack pointer word, which sits in the first page of the section. */
+static inline void set_stack_pointer(CPUState *state, uint32_t sp) {
+    *state->stack.sp = sp;
+    mark_page_dirty(state, state->stack.base >> PAGE_SHIFT);
+}
+
+/**
+ * Push a single byte onto the stack.
+ * The first 4 bytes of the stack section hold the current stack pointer.
+ * The stack grows upward (i.e. increasing offset from the start of the data area).
+ */
+void pushStack(CPUState *state, uint8_t value) {
+    StackEngine *stack = stack_engine(state);
+    uint32_t sp = *stack->sp;
+    if (sp >= stack->limit) {
+        fprintf(stderr, "Stack overflow: cannot push more data.\n");
+        exit(EXIT_FAILURE);
+    }
+    *stack_data_for_write(state, sp) = value;
+    set_stack_pointer(state, sp + 1);
+}
+
+/**
+ * Pop a single byte from the stack.
+ *
+ * @param state Pointer to the CPU state.
+ * @param out Pointer to a byte where the popped value will be stored.
+ * @return 1 if a byte was successfully popped, or 0 if the stack was empty.
+ */
+uint8_t popStack(CPUState *state, uint8_t *out) {
+    StackEngine *stack = stack_engine(state);
+    uint32_t sp = *stack->sp;
+    if (sp == 0) {
+        fprintf(stderr, "Stack underflow: no data to pop.\n");
+        return 0;
+    }
+    sp--;
+    if (sp < stack->limit) {
+        *out = *stack_data(state, sp);
+    } else {
+        // The guest moved the stack pointer past the section; follow it.
+        uint8_t *src = get_memory_ptr(state, stack->base + 4 + sp, false);
+        if (!src) {
+            fprintf(stderr, "Error: Unable to access memory for pop operation.\n");
+            return 0;
+        }
+        *out = *src;
+    }
+    set_stack_pointer(state, sp);
+    return 1;
+}
+
+/*
+ * Multi-byte pushes and pops. Values are stored least significant byte
+ * first, exactly as 'size' single-byte pushes would leave them. Anything
+ * the single compare rejects (overflow, underflow, a stack pointer the guest
+ * moved out of the section) takes the byte-at-a-time path, which reports it
+ * as before.
+ */
+static inline void push_stack_value(CPUState *state, uint32_t value, uint32_t size) {
+    StackEngine *stack = stack_engine(state);
+    uint32_t sp = *stack->sp;
+    if (__builtin_expect(sp > stack->limit - size, 0)) {
+        for (uint32_t i = 0; i < size; i++) {
+            pushStack(state, (uint8_t) (value >> (8 * i)));
+        }
+        return;
+    }
+    if (fits_in_page(sp + 4, size)) {
+        uint8_t *dest = stack_data_for_write(state, sp);
+        if (size == 2) {
+            store_le16(dest, (uint16_t) value);
+        } else {
+            store_le32(dest, value);
+        }
+    } else {
+        for (uint32_t i = 0; i < size; i++) {
+            *stack_data_for_write(state, sp + i) = (uint8_t) (value >> (8 * i));
+        }
+    }
+    set_stack_pointer(state, sp + size);
+}
+
+static inline bool pop_stack_value(CPUState *state, uint32_t *out, uint32_t size) {
+    StackEngine *stack = stack_engine(state);
+    uint32_t sp = *stack->sp;
+    // size <= sp <= limit, in one unsigned compare.
+    if (__builtin_expect(sp - size > stack->limit - size, 0)) {
+        uint32_t value = 0;
+        for (uint32_t i = 0; i < size; i++) {
+            uint8_t byte;
+            if (!popStack(state, &byte)) {
+                return false;
+            }
+            value = (value << 8) | byte;
+        }
+        *out = value;
+        return true;
+    }
+    sp -= size;
+    if (fits_in_page(sp + 4, size)) {
+        const uint8_t *src = stack_data(state, sp);
+        *out = size == 2 ? load_le16(src) : load_le32(src);
+    } else {
+        uint32_t value = 0;
+        for (uint32_t i = size; i-- > 0;) {
+            value = (value << 8) | *stack_data(state, sp + i);
+        }
+        *out = value;
+    }
+    set_stack_pointer(state, sp);
+    return true;
+}
+
+/* Push a 16-bit register the way psh does: low byte first. */
+void pushStack16(CPUState *state, uint16_t value) {
+    push_stack_value(state, value, 2);
+}
+
+/* Pop a 16-bit register the way pop does. Returns false on underflow. */
+bool popStack16(CPUState *state, uint16_t *out) {
+    uint32_t value;
+    if (!pop_stack_value(state, &value, 2)) {
+        return false;
+    }
+    *out = (uint16_t) value;
+    return true;
+}
+
+/* Push a 32-bit return address the way jsr and interrupt entry do: least significant byte first. */
+void pushStack32(CPUState *state, uint32_t value) {
+    push_stack_value(state, value, 4);
+}
+
+/* Pop a 32-bit return address the way rts does. Returns false on underflow. */
+bool popStack32(CPUState *state, uint32_t *out) {
+    return pop_stack_value(state, out, 4);
+}
@@ -0,0 +1,145 @@
+//
+// test_block_cache.c
+// Stores into cached code retire exactly the blocks they overlap, unhook
+// them from their chained neighbours, and are seen by every core, even at
+// the far end of a block of the longest instructions.
+//
+// Usage: test_block_cache <config.ini>
+//
+
+#include "test_harness.h"
+
+#define LONG_BLOCK_PC 0x100
+#define LONG_BLOCK_END (LONG_BLOCK_PC + BLOCK_MAX_OPS * MAX_INSTRUCTION_LENGTH)
+#define PATCHED_OP 60 // Starts more than BLOCK_MAX_OPS * 8 bytes into the block
+#define DATA_ADDRESS 0xF00
+
+/* Emit mov rd, rn, [rn + offset] (specifier 0x0E), one of the 9-byte instructions. */
+static size_t emit_long_mov(uint8_t *at, uint8_t rd, uint8_t rn, uint32_t offset) {
+    const uint8_t insn[MAX_INSTRUCTION_LENGTH] = {
+        0x0E, OP_MOV, rd, rn,
+        (uint8_t) (offset >> 24), (uint8_t) (offset >> 16), (uint8_t) (offset >> 8), (uint8_t) offset,
+        0x00,
+    };
+    memcpy(at, insn, sizeof(insn));
+    return sizeof(insn);
+}
+
+/*
+ * 0x000: mov r0,#0 ; mov r2,#0 ; mov r3,#1 ; mov r4,#5 ; b 0x100
+ * 0x100: BLOCK_MAX_OPS x mov r1, r0, [r0 + 0xF00]
+ *        be r2, r3, done ; mov r2,#1
+ *        mov [r0 + rd byte of op PATCHED_OP], r4.L ; b 0x100
+ * done:  hlt
+ * The first pass loads r1; the store then retargets op PATCHED_OP at r5,
+ * so the second pass must load r5 as well.
+ */
+static size_t build_long_block_program(uint8_t *program) {
+    const uint8_t prologue[] = {
+        0x00, OP_MOV, 0, 0x00, 0x00,
+        0x00, OP_MOV, 2, 0x00, 0x00,
+        0x00, OP_MOV, 3, 0x00, 0x01,
+        0x00, OP_MOV, 4, 0x00, 0x05,
+        0x00, OP_B, 0x00, 0x00, 0x01, 0x00,
+    };
+    const uint32_t patch = LONG_BLOCK_PC + PATCHED_OP * MAX_INSTRUCTION_LENGTH + 2;
+    const uint32_t done = LONG_BLOCK_END + 8 + 5 + 8 + 6;
+    const uint8_t epilogue[] = {
+        0x00, OP_BE, 2, 3, (uint8_t) (done >> 24), (uint8_t) (done >> 16), (uint8_t) (done >> 8), (uint8_t) done,
+        0x00, OP_MOV, 2, 0x00, 0x01,
+        0x0F, OP_MOV, 4, 0, (uint8_t) (patch >> 24), (uint8_t) (patch >> 16), (uint8_t) (patch >> 8), (uint8_t) patch,
+        0x00, OP_B, 0x00, 0x00, 0x01, 0x00,
+        0x00, OP_HLT,
+    };
+    memset(program, 0, DATA_ADDRESS + 4);
+    memcpy(program, prologue, sizeof(prologue));
+    size_t at = LONG_BLOCK_PC;
+    for (int i = 0; i < BLOCK_MAX_OPS; i++) {
+        at += emit_long_mov(program + at, 1, 0, DATA_ADDRESS);
+    }
+    memcpy(program + at, epilogue, sizeof(epilogue));
+    program[DATA_ADDRESS] = 0xAB;
+    program[DATA_ADDRESS + 1] = 0xCD;
+    return DATA_ADDRESS + 4;
+}
+
+/* The rewritten tail of a full block of 9-byte instructions runs on every core. */
+static bool check_long_block_store(const char *config, const char *core) {
+    static uint8_t program[DATA_ADDRESS + 4];
+    size_t size = build_long_block_program(program);
+    CPUState *state = create_test_cpu(config, program, size);
+    StopReason reason = run_test_core(state, core);
+    bool passed = reason == STOP_HALT && state->reg[1] == 0xABCD && state->reg[5] == 0xABCD;
+    printf("%s %-8s store into a long block: stop %d r1 0x%04x r5 0x%04x\n", passed ? "PASS" : "FAIL",
+           core, reason, state->reg[1], state->reg[5]);
+    return passed;
+}
+
+/* A write to the last byte of a full block of 9-byte instructions retires it. */
+static bool check_long_block_bound(const char *config) {
+    static uint8_t program[DATA_ADDRESS + 4];
+    size_t size = build_long_block_program(program);
+    CPUState *state = create_test_cpu(config, program, size);
+    BasicBlock *block = lookup_block(state, LONG_BLOCK_PC);
+    bool passed = block && block->op_count == BLOCK_MAX_OPS && block->end_pc == LONG_BLOCK_END;
+    invalidate_block_range(state, LONG_BLOCK_END - 1, 1);
+    passed &= find_block(state->block_cache, LONG_BLOCK_PC) == NULL;
+    return report(passed, "write to the last byte of a long block retires it");
+}
+
+/*
+ * 0x00: mov r1,#1 ; b 0x20
+ * 0x20: mov r2,#2 ; hlt
+ * 0x40: data
+ */
+static bool check_retire_and_unchain(const char *config) {
+    uint8_t program[0x44] = {
+        0x00, OP_MOV, 1, 0x00, 0x01,
+        0x00, OP_B, 0x00, 0x00, 0x00, 0x20,
+    };
+    const uint8_t target[] = {
+        0x00, OP_MOV, 2, 0x00, 0x02,
+        0x00, OP_HLT,
+    };
+    memcpy(program + 0x20, target, sizeof(target));
+    CPUState *state = create_test_cpu(config, program, sizeof(program));
+    BlockCache *cache = state->block_cache;
+    BasicBlock *first = lookup_block(state, 0x00);
+    BasicBlock *second = lookup_block(state, 0x20);
+    chain_block(first, true, second);
+    bool passed = true;
+
+    uint32_t generation = cache->generation;
+    invalidate_block_range(state, 0x40, 4);
+    passed &= report(find_block(cache, 0x00) == first && find_block(cache, 0x20) == second
+                     && first->taken == second && cache->generation == generation,
+                     "write next to code keeps every block");
+
+    invalidate_block_range(state, 0x1E, 2);
+    passed &= report(find_block(cache, 0x20) == second && cache->generation == generation,
+                     "write between blocks keeps every block");
+
+    invalidate_block_range(state, 0x26, 1);
+    passed &= report(find_block(cache, 0x20) == NULL && find_block(cache, 0x00) == first
+                     && first->taken == NULL && cache->block_count == 1
+                     && cache->generation != generation,
+                     "write into a block retires it and unchains its predecessor");
+
+    generation = cache->generation;
+    invalidate_block_range(state, 0x26, 1);
+    passed &= report(cache->generation == generation, "write to retired code retires nothing");
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <config.ini>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool passed = check_retire_and_unchain(argv[1]);
+    passed &= check_long_block_bound(argv[1]);
+    for (size_t i = 0; i < TEST_CORE_COUNT; i++) {
+        passed &= check_long_block_store(argv[1], test_cores[i]);
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,59 @@
+//
+// test_bro.c
+// bro falls through to the next instruction when V is clear and branches
+// when it is set, on every core.
+//
+// Usage: test_bro <config.ini>
+//
+
+#include "test_harness.h"
+
+// mov r1,#imm ; add r1,#1 ; bro 0x100 ; eni ; dsi ; mov r2,#7 ; hlt
+// and at 0x100: mov r2,#9 ; hlt
+static size_t build_program(uint8_t *program, uint16_t start) {
+    const uint8_t code[] = {
+        0x00, OP_MOV, 1, (uint8_t) (start >> 8), (uint8_t) start,
+        0x00, OP_ADD, 1, 0x00, 0x01,
+        0x00, OP_BRO, 0x00, 0x00, 0x01, 0x00,
+        0x00, OP_ENI,
+        0x00, OP_DSI,
+        0x00, OP_MOV, 2, 0x00, 0x07,
+        0x00, OP_HLT,
+    };
+    const uint8_t target[] = {
+        0x00, OP_MOV, 2, 0x00, 0x09,
+        0x00, OP_HLT,
+    };
+    memset(program, 0, 0x100 + sizeof(target));
+    memcpy(program, code, sizeof(code));
+    memcpy(program + 0x100, target, sizeof(target));
+    return 0x100 + sizeof(target);
+}
+
+/* Run the program with r1 starting at 'start' and check where it halted. */
+static bool check(const char *config, const char *core, uint16_t start, uint32_t halt_pc, uint16_t r2) {
+    uint8_t program[0x200];
+    size_t size = build_program(program, start);
+    CPUState *state = create_test_cpu(config, program, size);
+
+    StopReason reason = run_test_core(state, core);
+    bool passed = reason == STOP_HALT && *state->pc == halt_pc && state->reg[2] == r2;
+    printf("%s %-8s r1=0x%04x: stop %d pc 0x%08x r2 %u\n", passed ? "PASS" : "FAIL",
+           core, start, reason, *state->pc, state->reg[2]);
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <config.ini>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool passed = true;
+    for (size_t i = 0; i < TEST_CORE_COUNT; i++) {
+        // Untaken: falls through the 6-byte bro, eni and dsi to the hlt at 0x19.
+        passed &= check(argv[1], test_cores[i], 0x0001, 0x19, 7);
+        // Taken: 0xFFFF + 1 overflows, so bro jumps to 0x100.
+        passed &= check(argv[1], test_cores[i], 0xFFFF, 0x105, 9);
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
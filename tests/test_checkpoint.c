@@ -0,0 +1,78 @@
+//
+// test_checkpoint.c
+// Restoring a checkpoint puts back registers, written pages and the stack,
+// releases pages allocated since, and drops code decoded from the pages it
+// restores, so every run from the checkpoint behaves the same on every core.
+//
+// Usage: test_checkpoint <config.ini>
+//
+
+#include "test_harness.h"
+
+#define FRESH_ADDRESS 0x80000 // Outside every section: allocated by the first write
+
+// 0x00: mov r1,#0x0001 ; mov r3,#0x0009
+// 0x0A: mov [r0 + 0x0004], r3.L     patches the first mov to load 9
+// 0x12: mov [r0 + FRESH_ADDRESS], r3.L ; psh r3 ; hlt
+static const uint8_t program[] = {
+    0x00, OP_MOV, 1, 0x00, 0x01,
+    0x00, OP_MOV, 3, 0x00, 0x09,
+    0x0F, OP_MOV, 3, 0, 0x00, 0x00, 0x00, 0x04,
+    0x0F, OP_MOV, 3, 0, 0x00, 0x08, 0x00, 0x00,
+    0x00, OP_PSH, 3,
+    0x00, OP_HLT,
+};
+
+static bool check_run(CPUState *state, const char *core, int round) {
+    StopReason reason = run_test_core(state, core);
+    bool passed = reason == STOP_HALT && state->reg[1] == 1 && state->reg[3] == 9
+                  && get_memory(state, 4) == 9 && get_memory(state, FRESH_ADDRESS) == 9
+                  && *state->stack.sp == 2;
+    printf("%s %-8s run %d from the checkpoint: stop %d r1 %u\n", passed ? "PASS" : "FAIL",
+           core, round, reason, state->reg[1]);
+    return passed;
+}
+
+static bool check_restored(CPUState *state, size_t restored_pages, uint32_t stack_page) {
+    bool passed = restored_pages == 3 && *state->pc == 0 && state->reg[1] == 0 && state->reg[3] == 0
+                  && state->instructions == 0 && get_memory(state, 4) == 1
+                  && !is_page_allocated(state->page_table, FRESH_ADDRESS >> PAGE_SHIFT)
+                  && get_memory(state, stack_page << PAGE_SHIFT) == 0;
+    return report(passed, "restore puts back registers, code, stack and unallocated pages");
+}
+
+static bool check_core(const char *config, const char *core) {
+    CPUState *state = create_test_cpu(config, program, sizeof(program));
+    uint32_t stack_page = 0;
+    for (size_t i = 0; i < state->memory_config.section_count; i++) {
+        if (state->memory_config.sections[i].type == STACK) {
+            stack_page = state->memory_config.sections[i].start_address >> PAGE_SHIFT;
+        }
+    }
+    bool passed = report(!restore_checkpoint(state, NULL), "restore without a checkpoint fails");
+    passed &= report(take_checkpoint(state), "take a checkpoint");
+
+    for (int round = 1; round <= 3; round++) {
+        passed &= check_run(state, core, round);
+        // Cache the patched code, which the restore must drop.
+        lookup_block(state, 0);
+        size_t restored_pages = 0;
+        passed &= restore_checkpoint(state, &restored_pages);
+        passed &= check_restored(state, restored_pages, stack_page);
+    }
+    discard_checkpoint(state);
+    passed &= report(state->checkpoint == NULL && !restore_checkpoint(state, NULL), "discard drops the checkpoint");
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <config.ini>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool passed = true;
+    for (size_t i = 0; i < TEST_CORE_COUNT; i++) {
+        passed &= check_core(argv[1], test_cores[i]);
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
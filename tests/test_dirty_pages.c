@@ -0,0 +1,97 @@
+//
+// test_dirty_pages.c
+// The dirty page bitmap: every kind of write marks the pages it touches,
+// reads mark nothing, and a collection visits each page once in ascending
+// order and starts the next collection empty.
+//
+// Usage: test_dirty_pages <config.ini>
+//
+
+#include "test_harness.h"
+#include "dirty_pages.h"
+
+#define MAX_COLLECTED 64
+
+typedef struct {
+    uint32_t pages[MAX_COLLECTED];
+    size_t count;
+} Collected;
+
+static void collect_page(uint32_t page, void *context) {
+    Collected *collected = context;
+    if (collected->count < MAX_COLLECTED) {
+        collected->pages[collected->count] = page;
+    }
+    collected->count++;
+}
+
+static bool collects(CPUState *state, const uint32_t *expected, size_t count) {
+    Collected collected = {0};
+    size_t returned = collect_dirty_pages(state, collect_page, &collected);
+    if (returned != count || collected.count != count) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (collected.pages[i] != expected[i]) return false;
+    }
+    return true;
+}
+
+// mov r1,#0x77 ; mov [r0 + 0x5000], r1.L ; psh r1 ; hlt
+static const uint8_t program[] = {
+    0x00, OP_MOV, 1, 0x00, 0x77,
+    0x0F, OP_MOV, 1, 0, 0x00, 0x00, 0x50, 0x00,
+    0x00, OP_PSH, 1,
+    0x00, OP_HLT,
+};
+
+static bool check_accessors(const char *config) {
+    CPUState *state = create_test_cpu(config, program, sizeof(program));
+    clear_dirty_pages(state);
+    bool passed = true;
+
+    read8(state, 0x1000);
+    read32(state, 0x2FFE);
+    get_memory(state, 0x3000);
+    passed &= report(collect_dirty_pages(state, NULL, NULL) == 0, "reads mark nothing");
+
+    write8(state, 0x1000, 1);
+    write8(state, 0x1FFF, 1);
+    write32(state, 0x2FFE, 0x01020304);
+    set_memory(state, 0x9000, 1);
+    const uint8_t bytes[PAGE_SIZE + 2] = {0};
+    bulk_copy_memory(state, 0xA001, bytes, sizeof(bytes));
+    pushStack16(state, 0x1234);
+    mark_page_dirty(state, NUM_PAGES - 1);
+    const uint32_t expected[] = { 0x1, 0x2, 0x3, 0x9, 0xA, 0xB, 0x30, NUM_PAGES - 1 };
+    passed &= report(collects(state, expected, sizeof(expected) / sizeof(expected[0])),
+                     "writes mark each page they touch, collected in order");
+    passed &= report(collect_dirty_pages(state, NULL, NULL) == 0, "a collection clears the bitmap");
+
+    write8(state, 0x1000, 2);
+    clear_dirty_pages(state);
+    passed &= report(collect_dirty_pages(state, NULL, NULL) == 0, "clear_dirty_pages forgets every write");
+    return passed;
+}
+
+static bool check_core(const char *config, const char *core) {
+    CPUState *state = create_test_cpu(config, program, sizeof(program));
+    clear_dirty_pages(state);
+    StopReason reason = run_test_core(state, core);
+    const uint32_t expected[] = { 0x5, 0x30 };
+    bool passed = reason == STOP_HALT && collects(state, expected, sizeof(expected) / sizeof(expected[0]));
+    printf("%s %-8s stores from code mark their pages: stop %d\n", passed ? "PASS" : "FAIL", core, reason);
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <config.ini>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool passed = check_accessors(argv[1]);
+    for (size_t i = 0; i < TEST_CORE_COUNT; i++) {
+        passed &= check_core(argv[1], test_cores[i]);
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,83 @@
+//
+// test_harness.h
+// CPU setup shared by the regression tests: each test builds a program in
+// memory, boots it on a CPU laid out by the configuration the test was given
+// and runs it on one of the cores.
+//
+
+#ifndef NEOCORE_TEST_HARNESS_H
+#define NEOCORE_TEST_HARNESS_H
+
+#include "main.h"
+
+#define TEST_CORE_COUNT 4
+static const char *const test_cores[TEST_CORE_COUNT] = { "switch", "threaded", "block", "jit" };
+
+#define TEST_FILE_TEMPLATE "/tmp/neocore_test_XXXXXX"
+
+/* Write 'size' bytes to a new temporary file and store its name in 'path'. */
+static inline void write_test_file(char *path, const void *data, size_t size) {
+    strcpy(path, TEST_FILE_TEMPLATE);
+    int fd = mkstemp(path);
+    if (fd < 0 || write(fd, data, size) != (ssize_t) size) {
+        perror("cannot write test file");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+}
+
+/* Create a CPU with the memory map of 'config' and 'program' in its boot sector. */
+static inline CPUState* create_test_cpu(const char *config, const uint8_t *program, size_t size) {
+    char program_file[] = TEST_FILE_TEMPLATE;
+    write_test_file(program_file, program, size);
+
+    CPUState *state = calloc(1, sizeof(CPUState));
+    state->reg = calloc(REGISTER_COUNT, sizeof(uint16_t));
+    state->pc = calloc(1, sizeof(uint32_t));
+    page_arena_init(&state->page_arena);
+    state->page_table = create_page_table(&state->page_arena);
+    state->decode_cache = create_decode_cache();
+    state->block_cache = create_block_cache();
+    state->i_vector_table = init_interrupt_vector_table();
+    state->i_queue = init_interrupt_queue();
+    if (parse_ini_file(config, &state->memory_config, &state->clock.config) != 0) {
+        fprintf(stderr, "Cannot read %s\n", config);
+        exit(EXIT_FAILURE);
+    }
+    state->clock.config.unthrottled = true;
+    clock_reset(state);
+    ProgramImage image;
+    if (!load_program(program_file, &image)) {
+        exit(EXIT_FAILURE);
+    }
+    initialize_page_table(state, &image, NULL);
+    unload_program(&image);
+    unlink(program_file);
+    return state;
+}
+
+/* Run 'state' on 'core' until it stops. */
+static inline StopReason run_test_core(CPUState *state, const char *core) {
+    if (!strcmp(core, "threaded")) {
+        return run_threaded(state);
+    }
+    if (!strcmp(core, "block")) {
+        return run_blocks(state);
+    }
+    if (!strcmp(core, "jit")) {
+        state->jit = create_jit_compiler();
+        return run_blocks(state);
+    }
+    StopReason reason;
+    while ((reason = execute_instruction(state)) == STOP_NONE) {
+    }
+    return reason;
+}
+
+/* Print and return the outcome of one check. */
+static inline bool report(bool passed, const char *name) {
+    printf("%s %s\n", passed ? "PASS" : "FAIL", name);
+    return passed;
+}
+
+#endif // NEOCORE_TEST_HARNESS_H
@@ -0,0 +1,95 @@
+//
+// test_memory_map.c
+// Memory configurations are validated as a whole before they replace the
+// current one, and the compiled map gives every page the attributes of the
+// section holding it.
+//
+// Usage: test_memory_map <config.ini>
+//
+
+#include "test_harness.h"
+
+/* Parse 'text' into 'config' as parse_ini_file() would a file. */
+static bool parse_text(const char *text, MemoryConfig *config) {
+    char path[] = TEST_FILE_TEMPLATE;
+    write_test_file(path, text, strlen(text));
+    ClockConfig clock;
+    bool parsed = parse_ini_file(path, config, &clock) == 0;
+    unlink(path);
+    return parsed;
+}
+
+static bool check_rejected(MemoryConfig *config, const char *name, const char *text) {
+    size_t sections = config->section_count;
+    bool passed = !parse_text(text, config) && config->section_count == sections;
+    return report(passed, name);
+}
+
+static bool check_rejections(const char *config_file) {
+    MemoryConfig config;
+    memset(&config, 0, sizeof(config));
+    ClockConfig clock;
+    if (parse_ini_file(config_file, &config, &clock) != 0) {
+        return report(false, "the shipped configuration parses");
+    }
+    bool passed = true;
+    passed &= check_rejected(&config, "unaligned sections are rejected",
+        "[A]\ntype = usable_memory\nstart_address = 0x1800\npage_count = 1\n");
+    passed &= check_rejected(&config, "empty sections are rejected",
+        "[A]\ntype = usable_memory\nstart_address = 0x1000\npage_count = 0\n");
+    passed &= check_rejected(&config, "unknown types are rejected",
+        "[A]\ntype = rom\nstart_address = 0x1000\npage_count = 1\n");
+    passed &= check_rejected(&config, "sections past 4 GiB are rejected",
+        "[A]\ntype = usable_memory\nstart_address = 0xFFFFF000\npage_count = 2\n");
+    passed &= check_rejected(&config, "overlapping sections are rejected",
+        "[B]\ntype = usable_memory\nstart_address = 0x4000\npage_count = 4\n"
+        "[A]\ntype = boot_sector\nstart_address = 0x0000\npage_count = 5\n");
+    passed &= report(lookup_page_attributes(&config, 0x10000)->flags & PAGE_ATTR_MMIO,
+                     "a rejected file keeps the current map");
+    free_memory_config(&config);
+    return passed;
+}
+
+static bool check_lookups(void) {
+    MemoryConfig config;
+    memset(&config, 0, sizeof(config));
+    bool passed = parse_text(
+        "[Stack]\ntype = stack\nstart_address = 0x30000\npage_count = 2\n"
+        "[Uart]\ntype = mmio_page\nstart_address = 0x10000\npage_count = 1\ndevice = UART\n"
+        "[Boot]\ntype = boot_sector\nstart_address = 0x0\npage_count = 16\n"
+        "[Last]\ntype = usable_memory\nstart_address = 0xFFFFF000\npage_count = 1\n", &config);
+    passed &= report(passed && config.section_count == 4
+                     && config.sections[0].start_address == 0x0
+                     && config.sections[1].start_address == 0x10000
+                     && config.sections[2].start_address == 0x30000,
+                     "sections are sorted by start address");
+
+    const PageAttributes *boot = lookup_page_attributes(&config, 0xFFFF);
+    const PageAttributes *uart = lookup_page_attributes(&config, 0x10004);
+    const PageAttributes *stack = lookup_page_attributes(&config, 0x31000);
+    const PageAttributes *last = lookup_page_attributes(&config, 0xFFFFFFFF);
+    const PageAttributes *outside = lookup_page_attributes(&config, 0x20000);
+    passed &= report(boot->type == BOOT_SECTOR && boot->section == 0 && (boot->flags & PAGE_ATTR_EXEC)
+                     && (boot->flags & PAGE_ATTR_RAM) && boot->device == 0,
+                     "boot sector pages are executable RAM");
+    passed &= report(uart->type == MMIO_PAGE && uart->section == 1 && (uart->flags & PAGE_ATTR_MMIO)
+                     && !(uart->flags & PAGE_ATTR_EXEC) && uart->device == 1
+                     && config.map.device_count == 1 && config.map.devices[0].base == 0x10000,
+                     "MMIO pages refer to their device instance and are not executable");
+    passed &= report(stack->type == STACK && stack->section == 2 && last->section == 3,
+                     "every page of a section, up to the last page of memory, is mapped");
+    passed &= report(outside->section == NO_SECTION && (outside->flags & PAGE_ATTR_RAM),
+                     "pages outside every section are plain memory");
+    free_memory_config(&config);
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <config.ini>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool passed = check_rejections(argv[1]);
+    passed &= check_lookups();
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,122 @@
+//
+// test_mmio.c
+// The MMIO device registry: a registered device type can be mapped by name
+// any number of times, each instance sees its own base address, register
+// accesses reach the callbacks from every core, and the rest of the page
+// and plain RAM stay ordinary memory.
+//
+// Usage: test_mmio
+//
+
+#include "test_harness.h"
+
+#define COUNTER_IRQ 5
+#define FIRST_BASE 0x40000
+#define SECOND_BASE 0x41000
+
+static const char config[] =
+    "[BootSector]\ntype = boot_sector\nstart_address = 0x0\npage_count = 1\n"
+    "[First]\ntype = mmio_page\nstart_address = 0x40000\npage_count = 1\ndevice = counter\n"
+    "[Second]\ntype = mmio_page\nstart_address = 0x41000\npage_count = 1\ndevice = COUNTER\n";
+
+enum { COUNTER_REG_VALUE, COUNTER_REG_STORE };
+
+static const MmioRegister counter_registers[] = {
+    [COUNTER_REG_VALUE] = { "VALUE", 0x00, 4, PAGE_ATTR_READ },
+    [COUNTER_REG_STORE] = { "STORE", 0x08, 1, PAGE_ATTR_WRITE },
+};
+
+static uint32_t last_base;
+static uint32_t last_value;
+static unsigned writes;
+static unsigned interrupts;
+
+static uint32_t counter_read(__attribute__((unused)) CPUState *state, const MmioDevice *device,
+                             __attribute__((unused)) const MmioRegister *reg) {
+    return 0xC0DE0000 | (device->base >> 12);
+}
+
+static void counter_write(__attribute__((unused)) CPUState *state, const MmioDevice *device,
+                          __attribute__((unused)) const MmioRegister *reg, uint32_t value) {
+    last_base = device->base;
+    last_value = value;
+    writes++;
+}
+
+static void counter_interrupt(__attribute__((unused)) CPUState *state,
+                              __attribute__((unused)) const MmioDevice *device) {
+    interrupts++;
+}
+
+static const MmioDeviceType counter_device = {
+    .name = "Counter",
+    .registers = counter_registers,
+    .register_count = sizeof(counter_registers) / sizeof(counter_registers[0]),
+    .read = counter_read,
+    .write = counter_write,
+    .irq = COUNTER_IRQ,
+    .interrupt = counter_interrupt,
+};
+
+// mov r1,#0x5A ; mov [r0 + FIRST_BASE + 8], r1.L ; mov [r0 + SECOND_BASE + 8], r1.L ; hlt
+static const uint8_t program[] = {
+    0x00, OP_MOV, 1, 0x00, 0x5A,
+    0x0F, OP_MOV, 1, 0, 0x00, 0x04, 0x00, 0x08,
+    0x0F, OP_MOV, 1, 0, 0x00, 0x04, 0x10, 0x08,
+    0x00, OP_HLT,
+};
+
+static bool check_accessors(const char *config_file) {
+    CPUState *state = create_test_cpu(config_file, program, sizeof(program));
+    bool passed = true;
+
+    passed &= report(state->memory_config.map.device_count == 2, "each section gets its own instance");
+
+    writes = 0;
+    write8(state, FIRST_BASE + 8, 0x11);
+    passed &= report(writes == 1 && last_base == FIRST_BASE && last_value == 0x11,
+                     "a store to a register reaches the first instance");
+    write8(state, SECOND_BASE + 8, 0x22);
+    passed &= report(writes == 2 && last_base == SECOND_BASE && last_value == 0x22,
+                     "a store to a register reaches the second instance");
+
+    passed &= report(read32(state, FIRST_BASE) == 0xC0DE0040 && read32(state, SECOND_BASE) == 0xC0DE0041,
+                     "loads from a register return the callback's value");
+
+    write8(state, FIRST_BASE + 0x20, 0x77);
+    write8(state, 0x100, 0x66);
+    passed &= report(writes == 2 && read8(state, FIRST_BASE + 0x20) == 0x77 && read8(state, 0x100) == 0x66,
+                     "the rest of the page and RAM are plain memory");
+
+    interrupts = 0;
+    mmio_interrupt(state, COUNTER_IRQ);
+    mmio_interrupt(state, COUNTER_IRQ + 1);
+    passed &= report(interrupts == 2, "an interrupt reaches every instance raising it");
+    return passed;
+}
+
+static bool check_core(const char *config_file, const char *core) {
+    CPUState *state = create_test_cpu(config_file, program, sizeof(program));
+    writes = 0;
+    StopReason reason = run_test_core(state, core);
+    bool passed = reason == STOP_HALT && writes == 2 && last_base == SECOND_BASE && last_value == 0x5A;
+    printf("%s %-8s stores from code: stop %d writes %u\n", passed ? "PASS" : "FAIL", core, reason, writes);
+    return passed;
+}
+
+int main(void) {
+    bool passed = report(register_mmio_device_type(&counter_device)
+                         && find_mmio_device_type("COUNTER") == &counter_device
+                         && find_mmio_device_type("uart") && find_mmio_device_type("PIC")
+                         && !find_mmio_device_type("timer"),
+                         "device types are found by name, ignoring case");
+
+    char config_file[] = TEST_FILE_TEMPLATE;
+    write_test_file(config_file, config, sizeof(config) - 1);
+    passed &= check_accessors(config_file);
+    for (size_t i = 0; i < TEST_CORE_COUNT; i++) {
+        passed &= check_core(config_file, test_cores[i]);
+    }
+    unlink(config_file);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
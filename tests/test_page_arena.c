@@ -0,0 +1,80 @@
+//
+// test_page_arena.c
+// The slab arena behind guest pages: blocks are page aligned and zeroed,
+// freed blocks are reused before new ones are carved, a full slab adds
+// another, and trimmed slabs are carved again from the start.
+//
+// Usage: test_page_arena
+//
+
+#include "test_harness.h"
+
+static size_t slab_count(const SlabPool *pool) {
+    size_t count = 0;
+    for (const PageSlab *slab = pool->slabs; slab; slab = slab->next) {
+        count++;
+    }
+    return count;
+}
+
+static bool is_zero(const uint8_t *block, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (block[i]) return false;
+    }
+    return true;
+}
+
+int main(void) {
+    PageArena arena;
+    page_arena_init(&arena);
+    const uint32_t per_slab = arena.frames.blocks_per_slab;
+    bool passed = true;
+
+    uint8_t **frames = calloc(per_slab + 1, sizeof(uint8_t *));
+    bool aligned = true;
+    for (uint32_t i = 0; i < per_slab; i++) {
+        frames[i] = page_arena_alloc_frame(&arena);
+        aligned &= ((uintptr_t) frames[i] & (PAGE_SIZE - 1)) == 0 && is_zero(frames[i], PAGE_SIZE);
+        aligned &= i == 0 || frames[i] == frames[i - 1] + PAGE_SIZE;
+        memset(frames[i], 0xA5, PAGE_SIZE);
+    }
+    passed &= report(aligned && slab_count(&arena.frames) == 1,
+                     "frames are carved page aligned and zeroed from one slab");
+
+    frames[per_slab] = page_arena_alloc_frame(&arena);
+    passed &= report(slab_count(&arena.frames) == 2 && arena.frames.slabs->live == 1,
+                     "a full slab adds another");
+
+    uint8_t *freed = frames[7];
+    page_arena_free_frame(&arena, freed);
+    frames[7] = page_arena_alloc_frame(&arena);
+    passed &= report(frames[7] == freed && is_zero(freed, PAGE_SIZE) && slab_count(&arena.frames) == 2,
+                     "a freed frame is reused zeroed");
+
+    page_arena_release_frame(&arena, frames[8]);
+    uint8_t *released = page_arena_alloc_frame(&arena);
+    passed &= report(released == frames[8] && is_zero(released, PAGE_SIZE),
+                     "a released frame is reused zeroed");
+
+    for (uint32_t i = 0; i <= per_slab; i++) {
+        page_arena_free_frame(&arena, frames[i]);
+    }
+    page_arena_trim(&arena);
+    bool trimmed = true;
+    for (const PageSlab *slab = arena.frames.slabs; slab; slab = slab->next) {
+        trimmed &= slab->carved == 0 && slab->live == 0 && slab->free_count == 0;
+    }
+    uint8_t *fresh = page_arena_alloc_frame(&arena);
+    passed &= report(trimmed && slab_count(&arena.frames) == 2 && is_zero(fresh, PAGE_SIZE)
+                     && ((uintptr_t) fresh & (PAGE_SIZE - 1)) == 0,
+                     "trimmed slabs are kept and carved again");
+
+    PageTableLeaf *leaf = page_arena_alloc_leaf(&arena);
+    passed &= report(arena.leaves.block_size % PAGE_SIZE == 0 && arena.leaves.block_size >= sizeof(PageTableLeaf)
+                     && is_zero((const uint8_t *) leaf, sizeof(PageTableLeaf)),
+                     "leaves come zeroed from their own pool");
+
+    free(frames);
+    page_arena_destroy(&arena);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
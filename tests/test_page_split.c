@@ -0,0 +1,84 @@
+//
+// test_page_split.c
+// Multi-byte accesses and instruction fetches that straddle two pages keep
+// the guest byte order and reach both pages, on every core.
+//
+// Usage: test_page_split <config.ini>
+//
+
+#include "test_harness.h"
+#include "guest_memory.h"
+
+#define SPLIT_PC (PAGE_SIZE - 2)
+
+/* 0x000: b SPLIT_PC ; SPLIT_PC: mov r1,#0x1234 (across the page) ; hlt */
+static size_t build_program(uint8_t *program) {
+    const uint8_t jump[] = {
+        0x00, OP_B, 0x00, 0x00, (uint8_t) (SPLIT_PC >> 8), (uint8_t) SPLIT_PC,
+    };
+    const uint8_t split[] = {
+        0x00, OP_MOV, 1, 0x12, 0x34,
+        0x00, OP_HLT,
+    };
+    memset(program, 0, SPLIT_PC + sizeof(split));
+    memcpy(program, jump, sizeof(jump));
+    memcpy(program + SPLIT_PC, split, sizeof(split));
+    return SPLIT_PC + sizeof(split);
+}
+
+static bool check_helpers(void) {
+    uint8_t bytes[4];
+    store_be32(bytes, 0x11223344);
+    bool passed = bytes[0] == 0x11 && bytes[3] == 0x44 && load_be32(bytes) == 0x11223344
+                  && load_be16(bytes + 1) == 0x2233 && load_le16(bytes) == 0x2211
+                  && load_le32(bytes) == 0x44332211;
+    store_le16(bytes, 0xABCD);
+    passed &= bytes[0] == 0xCD && bytes[1] == 0xAB;
+    passed &= fits_in_page(PAGE_SIZE - 4, 4) && !fits_in_page(PAGE_SIZE - 3, 4)
+              && fits_in_page(PAGE_SIZE - 1, 1) && !fits_in_page(PAGE_SIZE - 1, 2);
+    return report(passed, "byte order helpers and fits_in_page");
+}
+
+static bool check_data(const char *config) {
+    uint8_t program[PAGE_SIZE + 8];
+    CPUState *state = create_test_cpu(config, program, build_program(program));
+    bool passed = true;
+
+    const uint32_t edge = 2 * PAGE_SIZE;
+    write32(state, edge - 2, 0x11223344);
+    passed &= report(get_memory(state, edge - 2) == 0x11 && get_memory(state, edge - 1) == 0x22
+                     && get_memory(state, edge) == 0x33 && get_memory(state, edge + 1) == 0x44,
+                     "write32 across a page stores big-endian into both pages");
+    passed &= report(read32(state, edge - 2) == 0x11223344 && read32(state, edge - 3) == 0x00112233
+                     && read32(state, edge - 1) == 0x22334400,
+                     "read32 across a page");
+
+    write16(state, 2 * edge - 1, 0xBEEF);
+    passed &= report(get_memory(state, 2 * edge - 1) == 0xBE && get_memory(state, 2 * edge) == 0xEF
+                     && read16(state, 2 * edge - 1) == 0xBEEF,
+                     "write16 and read16 across a page");
+    return passed;
+}
+
+static bool check_fetch(const char *config, const char *core) {
+    uint8_t program[PAGE_SIZE + 8];
+    CPUState *state = create_test_cpu(config, program, build_program(program));
+    StopReason reason = run_test_core(state, core);
+    bool passed = reason == STOP_HALT && state->reg[1] == 0x1234 && *state->pc == SPLIT_PC + 5;
+    printf("%s %-8s fetch across a page: stop %d pc 0x%08x r1 0x%04x\n", passed ? "PASS" : "FAIL",
+           core, reason, *state->pc, state->reg[1]);
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <config.ini>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool passed = check_helpers();
+    passed &= check_data(argv[1]);
+    for (size_t i = 0; i < TEST_CORE_COUNT; i++) {
+        passed &= check_fetch(argv[1], test_cores[i]);
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,50 @@
+//
+// test_page_table.c
+// The two-level radix page table: leaves are allocated on first use of
+// their directory slot, pages are found again at the same entry, and pages
+// at the edges of a leaf do not alias.
+//
+// Usage: test_page_table
+//
+
+#include "test_harness.h"
+
+int main(void) {
+    PageArena arena;
+    page_arena_init(&arena);
+    PageTable *table = create_page_table(&arena);
+    bool passed = true;
+
+    const uint32_t pages[] = {
+        0, 1, PAGE_TABLE_LEAF_ENTRIES - 1, PAGE_TABLE_LEAF_ENTRIES, NUM_PAGES - 1,
+    };
+    const size_t count = sizeof(pages) / sizeof(pages[0]);
+    passed &= report(!is_page_allocated(table, 0) && table->leaf_count == 0,
+                     "a new table has no pages and no leaves");
+
+    PageTableEntry *entries[sizeof(pages) / sizeof(pages[0])];
+    for (size_t i = 0; i < count; i++) {
+        entries[i] = allocate_page(table, pages[i]);
+        memset(entries[i]->page_data, (int) i + 1, PAGE_SIZE);
+    }
+    passed &= report(table->page_count == count && table->leaf_count == 3,
+                     "leaves are allocated per directory slot");
+
+    bool distinct = true;
+    for (size_t i = 0; i < count; i++) {
+        PageTableEntry *again = allocate_page(table, pages[i]);
+        distinct &= again == entries[i] && again->page_index == pages[i] && is_page_allocated(table, pages[i])
+                    && again->page_data[0] == i + 1 && again->page_data[PAGE_SIZE - 1] == i + 1;
+    }
+    passed &= report(distinct && table->page_count == count,
+                     "allocating a page again returns its entry and data");
+
+    passed &= report(!is_page_allocated(table, 2) && !is_page_allocated(table, PAGE_TABLE_LEAF_ENTRIES + 1)
+                     && !is_page_allocated(table, NUM_PAGES - 2) && !is_page_allocated(table, NUM_PAGES / 2),
+                     "neighbouring pages stay unallocated");
+    passed &= report(validate_page_table(table), "the table validates");
+
+    free_all_pages(table);
+    page_arena_destroy(&arena);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,108 @@
+//
+// test_reclaim.c
+// A reclaim pass shares all-zero and duplicate pages and releases their
+// frames, leaves image pages alone, and a write gives a shared page its own
+// frame again without disturbing the pages it shared with.
+//
+// Usage: test_reclaim
+//
+
+#include "test_harness.h"
+
+#define RAM_BASE 0x100000
+
+static const char paged_config[] =
+    "[BootSector]\ntype = boot_sector\nstart_address = 0x0\npage_count = 1\n"
+    "[Ram]\ntype = usable_memory\nstart_address = 0x100000\npage_count = 8\n";
+
+static const char flat_config[] =
+    "[BootSector]\ntype = boot_sector\nstart_address = 0x0\npage_count = 1\n"
+    "[Ram]\ntype = usable_memory\nstart_address = 0x100000\npage_count = 8\n"
+    "[Emulator]\nmemory_backend = flat\n";
+
+static const uint8_t program[] = { 0x00, OP_HLT };
+
+static CPUState* create_cpu(const char *config) {
+    char config_file[] = TEST_FILE_TEMPLATE;
+    write_test_file(config_file, config, strlen(config));
+    CPUState *state = create_test_cpu(config_file, program, sizeof(program));
+    unlink(config_file);
+    return state;
+}
+
+static uint32_t ram_page(uint32_t n) {
+    return RAM_BASE + n * PAGE_SIZE;
+}
+
+static PageTableEntry* entry(CPUState *state, uint32_t n) {
+    return allocate_page(state->page_table, ram_page(n) >> PAGE_SHIFT);
+}
+
+/* Fill RAM page 'n' with 'pattern' (every byte) and a distinguishing byte at the end. */
+static void fill_page(CPUState *state, uint32_t n, uint8_t pattern, uint8_t last) {
+    for (uint32_t offset = 0; offset < PAGE_SIZE - 1; offset++) {
+        write8(state, ram_page(n) + offset, pattern);
+    }
+    write8(state, ram_page(n) + PAGE_SIZE - 1, last);
+}
+
+static bool check_paged(void) {
+    CPUState *state = create_cpu(paged_config);
+    bool passed = true;
+
+    fill_page(state, 0, 0x00, 0x00);    // Zero
+    fill_page(state, 1, 0x5A, 0x01);    // Three copies of one page
+    fill_page(state, 2, 0x5A, 0x01);
+    fill_page(state, 4, 0x5A, 0x01);
+    fill_page(state, 3, 0x5A, 0x02);    // Different in one byte
+
+    ReclaimStats stats = {0};
+    reclaim_guest_memory(state, &stats);
+    passed &= report(stats.zero_pages == 1 && stats.merged_pages == 2 && stats.released_bytes == 3 * PAGE_SIZE,
+                     "a pass finds the zero page and the duplicates");
+    passed &= report(entry(state, 0)->is_shared && entry(state, 1)->is_shared && entry(state, 2)->is_shared
+                     && entry(state, 4)->is_shared && !entry(state, 3)->is_shared
+                     && entry(state, 1)->page_data == entry(state, 2)->page_data
+                     && entry(state, 1)->page_data == entry(state, 4)->page_data
+                     && state->page_table->shared_frame_count == 1,
+                     "duplicates share one frame and the distinct page keeps its own");
+    passed &= report(read8(state, ram_page(0) + 9) == 0x00 && read8(state, ram_page(2) + 9) == 0x5A
+                     && read8(state, ram_page(4) + PAGE_SIZE - 1) == 0x01
+                     && read8(state, ram_page(3) + PAGE_SIZE - 1) == 0x02,
+                     "shared pages read as before");
+    uint8_t *boot = allocate_page(state->page_table, 0)->page_data;
+    passed &= report(!allocate_page(state->page_table, 0)->is_shared && boot[0] == 0x00 && boot[1] == OP_HLT,
+                     "image pages are left alone");
+
+    write8(state, ram_page(2) + 9, 0xEE);
+    write8(state, ram_page(0) + 9, 0x11);
+    passed &= report(!entry(state, 2)->is_shared && read8(state, ram_page(2) + 9) == 0xEE
+                     && read8(state, ram_page(1) + 9) == 0x5A && read8(state, ram_page(4) + 9) == 0x5A
+                     && !entry(state, 0)->is_shared && read8(state, ram_page(0) + 9) == 0x11,
+                     "a write gives a shared page its own frame");
+
+    write8(state, ram_page(4) + 9, 0xEF);
+    memset(&stats, 0, sizeof(stats));
+    reclaim_guest_memory(state, &stats);
+    passed &= report(!entry(state, 1)->is_shared && state->page_table->shared_frame_count == 0
+                     && stats.merged_pages == 0 && read8(state, ram_page(1) + 9) == 0x5A,
+                     "a frame left with one user goes back to it");
+    return passed;
+}
+
+static bool check_flat(void) {
+    CPUState *state = create_cpu(flat_config);
+    fill_page(state, 0, 0x00, 0x00);
+    fill_page(state, 1, 0x5A, 0x01);
+    ReclaimStats stats = {0};
+    reclaim_guest_memory(state, &stats);
+    return report(state->page_table->flat_base && stats.zero_pages == 1 && read8(state, ram_page(0) + 9) == 0x00
+                  && read8(state, ram_page(1) + 9) == 0x5A && read8(state, 1) == OP_HLT,
+                  "the flat backend releases zero pages in place");
+}
+
+int main(void) {
+    bool passed = check_paged();
+    passed &= check_flat();
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
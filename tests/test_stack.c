@@ -0,0 +1,98 @@
+//
+// test_stack.c
+// The stack engine keeps values least significant byte first, so 16- and
+// 32-bit pushes and pops agree with single-byte ones, across a page of the
+// stack section and on every core.
+//
+// Usage: test_stack <config.ini>
+//
+
+#include "test_harness.h"
+
+// 0x00: mov r1,#0x1234 ; psh r1 ; jsr 0x40 ; pop r2 ; hlt
+// 0x40: rts
+static size_t build_program(uint8_t *program) {
+    const uint8_t code[] = {
+        0x00, OP_MOV, 1, 0x12, 0x34,
+        0x00, OP_PSH, 1,
+        0x00, OP_JSR, 0x00, 0x00, 0x00, 0x40,
+        0x00, OP_POP, 2,
+        0x00, OP_HLT,
+    };
+    memset(program, 0, 0x42);
+    memcpy(program, code, sizeof(code));
+    program[0x40] = 0x00;
+    program[0x41] = OP_RTS;
+    return 0x42;
+}
+
+static bool has_bytes(CPUState *state, uint32_t address, const uint8_t *bytes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (get_memory(state, address + (uint32_t) i) != bytes[i]) return false;
+    }
+    return true;
+}
+
+static bool check_engine(const char *config) {
+    uint8_t program[0x42];
+    CPUState *state = create_test_cpu(config, program, build_program(program));
+    bool passed = true;
+
+    pushStack16(state, 0x1234);
+    pushStack32(state, 0xAABBCCDD);
+    const uint32_t data = state->stack.base + 4;
+    const uint8_t pushed[] = { 0x34, 0x12, 0xDD, 0xCC, 0xBB, 0xAA };
+    passed &= report(*state->stack.sp == 6 && has_bytes(state, data, pushed, sizeof(pushed)),
+                     "pushes store least significant byte first");
+
+    uint32_t value32 = 0;
+    uint16_t value16 = 0;
+    passed &= report(popStack32(state, &value32) && value32 == 0xAABBCCDD
+                     && popStack16(state, &value16) && value16 == 0x1234 && *state->stack.sp == 0,
+                     "pops return what was pushed");
+
+    for (size_t i = 0; i < 4; i++) {
+        pushStack(state, (uint8_t) (0x11 * (i + 1)));
+    }
+    uint8_t high = 0;
+    uint8_t low = 0;
+    passed &= report(popStack16(state, &value16) && value16 == 0x4433
+                     && popStack(state, &high) && high == 0x22 && popStack(state, &low) && low == 0x11,
+                     "byte pushes and pops agree with 16-bit ones");
+
+    passed &= report(!popStack16(state, &value16) && !popStack32(state, &value32) && *state->stack.sp == 0,
+                     "pops from an empty stack fail");
+
+    *state->stack.sp = PAGE_SIZE - 4 - 2;
+    pushStack32(state, 0x01020304);
+    const uint8_t split[] = { 0x04, 0x03, 0x02, 0x01 };
+    passed &= report(has_bytes(state, data + PAGE_SIZE - 4 - 2, split, sizeof(split))
+                     && popStack32(state, &value32) && value32 == 0x01020304,
+                     "a push and pop across a stack page");
+    return passed;
+}
+
+static bool check_core(const char *config, const char *core) {
+    uint8_t program[0x42];
+    CPUState *state = create_test_cpu(config, program, build_program(program));
+    StopReason reason = run_test_core(state, core);
+    // psh r1 at data + 0, then jsr's return address 0x0E at data + 2.
+    const uint8_t expected[] = { 0x34, 0x12, 0x0E, 0x00, 0x00, 0x00 };
+    bool passed = reason == STOP_HALT && state->reg[2] == 0x1234 && *state->stack.sp == 0
+                  && has_bytes(state, state->stack.base + 4, expected, sizeof(expected));
+    printf("%s %-8s psh, jsr, rts and pop: stop %d r2 0x%04x\n", passed ? "PASS" : "FAIL",
+           core, reason, state->reg[2]);
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <config.ini>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    bool passed = check_engine(argv[1]);
+    for (size_t i = 0; i < TEST_CORE_COUNT; i++) {
+        passed &= check_core(argv[1], test_cores[i]);
+    }
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,78 @@
+//
+// test_tlb.c
+// The software TLB: pages sharing a slot evict each other and refill with
+// the right frame, the fetch, data and write sets are independent, and
+// evicted or released pages are translated again through the page table.
+//
+// Usage: test_tlb
+//
+
+#include "test_harness.h"
+#include "tlb.h"
+
+static const char config[] =
+    "[BootSector]\n"
+    "type = boot_sector\n"
+    "start_address = 0x00000000\n"
+    "page_count = 128\n";
+
+static uint8_t* translate(CPUState *state, TlbEntry *set, uint32_t page) {
+    uint8_t attributes;
+    return tlb_translate(state, set, (page << PAGE_SHIFT) + 0x10, false, &attributes);
+}
+
+static bool is_cached(const TlbEntry *set, uint32_t page) {
+    return set[page & (TLB_ENTRIES - 1)].tag == page + 1;
+}
+
+int main(void) {
+    char config_file[] = TEST_FILE_TEMPLATE;
+    write_test_file(config_file, config, sizeof(config) - 1);
+    const uint8_t program[] = { 0x00, OP_HLT };
+    CPUState *state = create_test_cpu(config_file, program, sizeof(program));
+    unlink(config_file);
+    SoftTlb *tlb = &state->tlb;
+    bool passed = true;
+
+    const uint32_t page = 1;
+    const uint32_t alias = page + TLB_ENTRIES;
+    set_memory(state, (page << PAGE_SHIFT) + 0x10, 0x11);
+    set_memory(state, (alias << PAGE_SHIFT) + 0x10, 0x22);
+    tlb_flush(state);
+
+    uint8_t *first = translate(state, tlb->data, page);
+    uint8_t *second = translate(state, tlb->data, alias);
+    passed &= report(first && second && *first == 0x11 && *second == 0x22
+                     && is_cached(tlb->data, alias) && !is_cached(tlb->data, page),
+                     "a page evicts the page sharing its slot");
+    passed &= report(translate(state, tlb->data, page) == first && is_cached(tlb->data, page),
+                     "an evicted page refills with the same frame");
+
+    passed &= report(translate(state, tlb->fetch, alias) == second
+                     && is_cached(tlb->fetch, alias) && is_cached(tlb->data, page),
+                     "fetches do not evict data translations");
+
+    tlb_evict_page(state, alias);
+    passed &= report(is_cached(tlb->data, page) && !is_cached(tlb->fetch, alias),
+                     "evicting a page leaves the page sharing its slot");
+    tlb_evict_page(state, page);
+    passed &= report(!is_cached(tlb->data, page), "evicting a page drops it from every set");
+
+    const uint32_t released = 2;
+    translate(state, tlb->data, released);
+    release_page(state, released);
+    passed &= report(!is_cached(tlb->data, released) && translate(state, tlb->data, released) == NULL,
+                     "a released page is no longer translated");
+
+    const uint32_t unmapped = 200;
+    passed &= report(translate(state, tlb->data, unmapped) == NULL && !is_cached(tlb->data, unmapped),
+                     "unmapped pages are not cached");
+
+    tlb_flush(state);
+    bool empty = true;
+    for (uint32_t slot = 0; slot < TLB_ENTRIES; slot++) {
+        empty &= tlb->fetch[slot].tag == 0 && tlb->data[slot].tag == 0 && tlb->write[slot].tag == 0;
+    }
+    passed &= report(empty, "a flush empties every set");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
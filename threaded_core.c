@@ -0,0 +1,485 @@
+//
+// threaded_core.c
+// Threaded-code interpreter core using GCC computed goto.
+//
+// Every decoded instruction carries a dense InstructionHandler index, so
+// dispatch is one table load and one indirect jump at the end of each
+// handler. PC and the lazy flags result live in locals and are only written
+// back to the CPUState when a helper or an interrupt needs them, as are the
+// cycle and instruction counters. Interrupts and stop requests are only
+// polled at branch targets, WFI and ENI; run limits stop on the exact
+// instruction. run_block_ops() uses the same dispatch to interpret one basic
+// block for the block core.
+//
+
+#include "main.h"
+#include "alu.h"
+
+#if defined(__GNUC__)
+
+// Labels as values and computed goto are GNU extensions.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+/* Inline decode-cache hit path; falls back to fetch_decoded() on a miss. */
+static inline const DecodedInstruction* lookup_decoded(CPUState *state, uint32_t pc) {
+    DecodeCacheEntry *entry = &state->decode_cache->entries[pc & (DECODE_CACHE_SIZE - 1)];
+    if (__builtin_expect(entry->valid && entry->pc == pc, 1)) {
+        return &entry->insn;
+    }
+    return fetch_decoded(state, pc);
+}
+
+StopReason run_threaded(CPUState *state) {
+    static const void *const handlers[HANDLER_COUNT] = {
+        [HANDLER_NOP]        = &&op_nop,
+        [HANDLER_ADD_IMM]    = &&op_add_imm,  [HANDLER_ADD_REG] = &&op_add_reg,  [HANDLER_ADD_MEM] = &&op_add_mem,
+        [HANDLER_SUB_IMM]    = &&op_sub_imm,  [HANDLER_SUB_REG] = &&op_sub_reg,  [HANDLER_SUB_MEM] = &&op_sub_mem,
+        [HANDLER_MUL_IMM]    = &&op_mul_imm,  [HANDLER_MUL_REG] = &&op_mul_reg,  [HANDLER_MUL_MEM] = &&op_mul_mem,
+        [HANDLER_AND_IMM]    = &&op_and_imm,  [HANDLER_AND_REG] = &&op_and_reg,  [HANDLER_AND_MEM] = &&op_and_mem,
+        [HANDLER_OR_IMM]     = &&op_or_imm,   [HANDLER_OR_REG]  = &&op_or_reg,   [HANDLER_OR_MEM]  = &&op_or_mem,
+        [HANDLER_XOR_IMM]    = &&op_xor_imm,  [HANDLER_XOR_REG] = &&op_xor_reg,  [HANDLER_XOR_MEM] = &&op_xor_mem,
+        [HANDLER_LSH_IMM]    = &&op_lsh_imm,  [HANDLER_LSH_REG] = &&op_lsh_reg,  [HANDLER_LSH_MEM] = &&op_lsh_mem,
+        [HANDLER_RSH_IMM]    = &&op_rsh_imm,  [HANDLER_RSH_REG] = &&op_rsh_reg,  [HANDLER_RSH_MEM] = &&op_rsh_mem,
+        [HANDLER_MOV_IMM]    = &&op_mov_imm,
+        [HANDLER_MOV_IMM32]  = &&op_mov_imm32,
+        [HANDLER_MOV_REG]    = &&op_mov_reg,
+        [HANDLER_MOV_MEMORY] = &&op_mov_memory,
+        [HANDLER_B]          = &&op_b,
+        [HANDLER_BE]         = &&op_be,
+        [HANDLER_BNE]        = &&op_bne,
+        [HANDLER_BLT]        = &&op_blt,
+        [HANDLER_BGT]        = &&op_bgt,
+        [HANDLER_BRO]        = &&op_bro,
+        [HANDLER_UMULL]      = &&op_umull,
+        [HANDLER_SMULL]      = &&op_smull,
+        [HANDLER_HLT]        = &&op_hlt,
+        [HANDLER_PSH]        = &&op_psh,
+        [HANDLER_POP]        = &&op_pop,
+        [HANDLER_JSR]        = &&op_jsr,
+        [HANDLER_RTS]        = &&op_rts,
+        [HANDLER_WFI]        = &&op_wfi,
+        [HANDLER_ENI]        = &&op_eni,
+        [HANDLER_DSI]        = &&op_dsi,
+        [HANDLER_INVALID]    = &&op_invalid,
+    };
+
+    uint16_t *reg = state->reg;
+    uint32_t pc = *(state->pc);
+    uint32_t flags_result = state->flags_result;
+    uint64_t cycles = state->cycles;
+    uint64_t instructions = state->instructions;
+    uint64_t next_sync = __atomic_load_n(&state->clock.next_sync, __ATOMIC_RELAXED);
+    const DecodedInstruction *insn;
+    uint32_t result;
+
+// Write the cached PC and flags back before calling into shared helpers.
+#define SYNC_STATE() do {                                                     \
+        *(state->pc) = pc; state->flags_result = flags_result;                \
+        state->cycles = cycles; state->instructions = instructions;           \
+    } while (0)
+#define RELOAD_STATE() do { pc = *(state->pc); flags_result = state->flags_result; } while (0)
+
+#define DISPATCH() do {                                 \
+        insn = lookup_decoded(state, pc);               \
+        if (__builtin_expect(insn == NULL, 0)) goto fault; \
+        cycles += insn->cycles;                         \
+        instructions++;                                 \
+        goto *handlers[insn->handler];                  \
+    } while (0)
+// Run limits are honoured on every instruction boundary against the local
+// next_sync; stop requests are picked up when it is reloaded at branch targets.
+#define NEXT() do {                                     \
+        pc += insn->length;                             \
+        if (__builtin_expect(cycles >= next_sync, 0)) goto sync_point; \
+        DISPATCH();                                     \
+    } while (0)
+#define BRANCH(target) do { pc = (target); goto branch_target; } while (0)
+
+// ALU result handling shared by every mode; Z and V are derived from flags_result.
+#define ALU_WRITEBACK() do {                            \
+        flags_result = result;                          \
+        reg[insn->rd] = (uint16_t) result;              \
+        NEXT();                                         \
+    } while (0)
+
+// Mode 0: rd op #imm, mode 1: rn op rd, mode 2: rd op [normAddressing].
+#define ALU_HANDLERS(name, NAME, expression)                                            \
+    op_##name##_imm:                                                                    \
+        result = alu_##name(reg[insn->rd], insn->immediate);                            \
+        ALU_WRITEBACK();                                                                \
+    op_##name##_reg:                                                                    \
+        result = alu_##name(reg[insn->rn], reg[insn->rd]);                              \
+        ALU_WRITEBACK();                                                                \
+    op_##name##_mem:                                                                    \
+        result = alu_##name(reg[insn->rd], get_memory(state, insn->norm_address));      \
+        ALU_WRITEBACK();
+
+    goto branch_target;
+
+    ALU_OPERATIONS(ALU_HANDLERS)
+
+op_nop:
+    NEXT();
+
+op_mov_imm:
+    reg[insn->rd] = insn->immediate;
+    NEXT();
+
+op_mov_imm32:
+    reg[insn->rd] = (insn->offset >> 16) & 0xFFFF;
+    reg[insn->rn] = insn->offset & 0xFFFF;
+    NEXT();
+
+op_mov_reg:
+    reg[insn->rn] = reg[insn->rd];
+    NEXT();
+
+op_mov_memory:
+    mov(state, insn->rd, insn->rn, insn->rn1, insn->immediate,
+        insn->norm_address, insn->offset, insn->specifier);
+    NEXT();
+
+op_b:
+    if (__builtin_expect(insn->label == pc, 0)) {
+        // b to itself: nothing changes until an interrupt arrives.
+        SYNC_STATE();
+        idle_wait(state, insn->cycles, 1);
+        cycles = state->cycles;
+        instructions = state->instructions;
+    }
+    BRANCH(insn->label);
+
+op_be:
+    if (reg[insn->rd] == reg[insn->rn]) BRANCH(insn->label);
+    NEXT();
+
+op_bne:
+    if (reg[insn->rd] != reg[insn->rn]) BRANCH(insn->label);
+    NEXT();
+
+op_blt:
+    if (reg[insn->rd] < reg[insn->rn]) BRANCH(insn->label);
+    NEXT();
+
+op_bgt:
+    if (reg[insn->rd] > reg[insn->rn]) BRANCH(insn->label);
+    NEXT();
+
+op_bro:
+    if (flags_result > UINT16_MAX) BRANCH(insn->label);
+    NEXT();
+
+op_umull:
+    umull(&reg[insn->rd], &reg[insn->rn1], &reg[insn->mull_rn]);
+    NEXT();
+
+op_smull:
+    smull(&reg[insn->rd], &reg[insn->rn1], &reg[insn->mull_rn]);
+    NEXT();
+
+op_hlt:
+    SYNC_STATE();
+    printf("Halt\n");
+    return STOP_HALT;
+
+op_psh:
+    pushStack16(state, reg[insn->rd]);
+    NEXT();
+
+op_pop:
+    if (!popStack16(state, &reg[insn->rd])) {
+        fprintf(stderr, "Stack underflow while executing POP.\n");
+    }
+    NEXT();
+
+op_jsr:
+    pushStack32(state, pc + 6);
+    BRANCH(insn->label);
+
+op_rts: {
+    uint32_t return_address;
+    if (!popStack32(state, &return_address)) {
+        fprintf(stderr, "Stack underflow while executing RTS.\n");
+        NEXT();
+    }
+    BRANCH(return_address);
+}
+
+op_wfi:
+    // On a stop request the PC stays on the wfi so it waits again when resumed.
+    if (wait_for_interrupt(state)) {
+        pc += insn->length;
+    }
+    goto branch_target;
+
+op_eni:
+    state->enable_mask_interrupts = true;
+    pc += insn->length;
+    goto branch_target;
+
+op_dsi:
+    state->enable_mask_interrupts = false;
+    NEXT();
+
+op_invalid:
+    // Let the reference core report unknown opcodes and specifiers.
+    SYNC_STATE();
+    if (execute_decoded(state, insn)) {
+        return STOP_HALT;
+    }
+    RELOAD_STATE();
+    DISPATCH();
+
+branch_target:
+    // Interrupts are only taken at branch targets. The unlocked peek keeps
+    // the common no-interrupt path free of the queue mutex.
+    if (__atomic_load_n(&state->i_queue->count, __ATOMIC_RELAXED) != 0 &&
+        state->enable_mask_interrupts) {
+        SYNC_STATE();
+        service_pending_interrupt(state);
+        RELOAD_STATE();
+    }
+    next_sync = __atomic_load_n(&state->clock.next_sync, __ATOMIC_RELAXED);
+    if (cycles < next_sync) {
+        DISPATCH();
+    }
+
+sync_point: {
+    SYNC_STATE();
+    StopReason reason = clock_sync(state);
+    if (reason != STOP_NONE) {
+        return reason;
+    }
+    next_sync = __atomic_load_n(&state->clock.next_sync, __ATOMIC_RELAXED);
+    DISPATCH();
+}
+
+fault:
+    SYNC_STATE();
+    fprintf(stderr, "Invalid memory access at PC address 0x%08x\n", pc);
+    return STOP_FAULT;
+
+#undef ALU_HANDLERS
+#undef ALU_WRITEBACK
+#undef BRANCH
+#undef NEXT
+#undef DISPATCH
+#undef RELOAD_STATE
+#undef SYNC_STATE
+}
+
+/**
+ * Interpret the ops of 'block', which starts at the current PC, with the same
+ * threaded dispatch, for the block core. The block has been charged already,
+ * so nothing is counted here, and register-only ops never touch the
+ * CPUState's PC or flags. Everything else runs through execute_decoded() or
+ * execute_fused(), after which a rewrite of cached code ends the block early.
+ * Stores the number of ops run in 'ops_run' and returns true if the CPU halted.
+ */
+bool run_block_ops(CPUState *state, const BasicBlock *block, uint16_t *ops_run) {
+    static const void *const handlers[HANDLER_COUNT] = {
+        [HANDLER_NOP]        = &&op_nop,
+        [HANDLER_ADD_IMM]    = &&op_add_imm,  [HANDLER_ADD_REG] = &&op_add_reg,  [HANDLER_ADD_MEM] = &&op_add_mem,
+        [HANDLER_SUB_IMM]    = &&op_sub_imm,  [HANDLER_SUB_REG] = &&op_sub_reg,  [HANDLER_SUB_MEM] = &&op_sub_mem,
+        [HANDLER_MUL_IMM]    = &&op_mul_imm,  [HANDLER_MUL_REG] = &&op_mul_reg,  [HANDLER_MUL_MEM] = &&op_mul_mem,
+        [HANDLER_AND_IMM]    = &&op_and_imm,  [HANDLER_AND_REG] = &&op_and_reg,  [HANDLER_AND_MEM] = &&op_and_mem,
+        [HANDLER_OR_IMM]     = &&op_or_imm,   [HANDLER_OR_REG]  = &&op_or_reg,   [HANDLER_OR_MEM]  = &&op_or_mem,
+        [HANDLER_XOR_IMM]    = &&op_xor_imm,  [HANDLER_XOR_REG] = &&op_xor_reg,  [HANDLER_XOR_MEM] = &&op_xor_mem,
+        [HANDLER_LSH_IMM]    = &&op_lsh_imm,  [HANDLER_LSH_REG] = &&op_lsh_reg,  [HANDLER_LSH_MEM] = &&op_lsh_mem,
+        [HANDLER_RSH_IMM]    = &&op_rsh_imm,  [HANDLER_RSH_REG] = &&op_rsh_reg,  [HANDLER_RSH_MEM] = &&op_rsh_mem,
+        [HANDLER_MOV_IMM]    = &&op_mov_imm,
+        [HANDLER_MOV_IMM32]  = &&op_mov_imm32,
+        [HANDLER_MOV_REG]    = &&op_mov_reg,
+        [HANDLER_MOV_MEMORY] = &&op_helper,
+        [HANDLER_B]          = &&op_b,
+        [HANDLER_BE]         = &&op_be,
+        [HANDLER_BNE]        = &&op_bne,
+        [HANDLER_BLT]        = &&op_blt,
+        [HANDLER_BGT]        = &&op_bgt,
+        [HANDLER_BRO]        = &&op_bro,
+        [HANDLER_UMULL]      = &&op_umull,
+        [HANDLER_SMULL]      = &&op_smull,
+        [HANDLER_HLT]        = &&op_helper,
+        [HANDLER_PSH]        = &&op_helper,
+        [HANDLER_POP]        = &&op_helper,
+        [HANDLER_JSR]        = &&op_helper,
+        [HANDLER_RTS]        = &&op_helper,
+        [HANDLER_WFI]        = &&op_helper,
+        [HANDLER_ENI]        = &&op_helper,
+        [HANDLER_DSI]        = &&op_dsi,
+        [HANDLER_INVALID]    = &&op_helper,
+    };
+
+    BlockCache *cache = state->block_cache;
+    const uint32_t generation = cache->generation;
+    uint16_t *reg = state->reg;
+    uint32_t pc = *(state->pc);
+    uint32_t flags_result = state->flags_result;
+    const DecodedInstruction *insn = block->ops;
+    const DecodedInstruction *const end = block->ops + block->op_count;
+    uint32_t result;
+    bool halted = false;
+
+#define SYNC_STATE() do { *(state->pc) = pc; state->flags_result = flags_result; } while (0)
+#define RELOAD_STATE() do { pc = *(state->pc); flags_result = state->flags_result; } while (0)
+
+#define DISPATCH() do {                                 \
+        if (insn == end) goto done;                     \
+        if (__builtin_expect(insn->fusion != FUSION_NONE, 0)) goto fused; \
+        goto *handlers[insn->handler];                  \
+    } while (0)
+#define NEXT() do { pc += insn->length; insn++; DISPATCH(); } while (0)
+// Only the last op of a block branches.
+#define BRANCH(target) do { pc = (target); goto done_after_op; } while (0)
+
+#define ALU_WRITEBACK() do {                            \
+        flags_result = result;                          \
+        reg[insn->rd] = (uint16_t) result;              \
+        NEXT();                                         \
+    } while (0)
+
+#define ALU_HANDLERS(name, NAME, expression)                                            \
+    op_##name##_imm:                                                                    \
+        result = alu_##name(reg[insn->rd], insn->immediate);                            \
+        ALU_WRITEBACK();                                                                \
+    op_##name##_reg:                                                                    \
+        result = alu_##name(reg[insn->rn], reg[insn->rd]);                              \
+        ALU_WRITEBACK();                                                                \
+    op_##name##_mem:                                                                    \
+        result = alu_##name(reg[insn->rd], get_memory(state, insn->norm_address));      \
+        ALU_WRITEBACK();
+
+    DISPATCH();
+
+    ALU_OPERATIONS(ALU_HANDLERS)
+
+op_nop:
+    NEXT();
+
+op_mov_imm:
+    reg[insn->rd] = insn->immediate;
+    NEXT();
+
+op_mov_imm32:
+    reg[insn->rd] = (insn->offset >> 16) & 0xFFFF;
+    reg[insn->rn] = insn->offset & 0xFFFF;
+    NEXT();
+
+op_mov_reg:
+    reg[insn->rn] = reg[insn->rd];
+    NEXT();
+
+op_b:
+    // An idle b to itself is detected by the block core.
+    BRANCH(insn->label);
+
+op_be:
+    if (reg[insn->rd] == reg[insn->rn]) BRANCH(insn->label);
+    NEXT();
+
+op_bne:
+    if (reg[insn->rd] != reg[insn->rn]) BRANCH(insn->label);
+    NEXT();
+
+op_blt:
+    if (reg[insn->rd] < reg[insn->rn]) BRANCH(insn->label);
+    NEXT();
+
+op_bgt:
+    if (reg[insn->rd] > reg[insn->rn]) BRANCH(insn->label);
+    NEXT();
+
+op_bro:
+    if (flags_result > UINT16_MAX) BRANCH(insn->label);
+    NEXT();
+
+op_umull:
+    umull(&reg[insn->rd], &reg[insn->rn1], &reg[insn->mull_rn]);
+    NEXT();
+
+op_smull:
+    smull(&reg[insn->rd], &reg[insn->rn1], &reg[insn->mull_rn]);
+    NEXT();
+
+op_dsi:
+    state->enable_mask_interrupts = false;
+    NEXT();
+
+op_helper:
+    SYNC_STATE();
+    halted = execute_decoded(state, insn);
+    RELOAD_STATE();
+    insn++;
+    if (halted || cache->generation != generation) {
+        goto done;  // The block rewrote code; re-enter at the current PC.
+    }
+    DISPATCH();
+
+fused:
+    if (insn->fusion == FUSION_MOV_IMM_ALU || insn->fusion == FUSION_SUB_BRANCH) {
+        // Register pairs cost no more to dispatch here one half at a time.
+        cache->fusion_hits[insn->fusion]++;
+        goto *handlers[insn->handler];
+    }
+    SYNC_STATE();
+    execute_fused(state, insn);
+    RELOAD_STATE();
+    insn += 2;
+    DISPATCH();
+
+done_after_op:
+    insn++;
+done:
+    SYNC_STATE();
+    *ops_run = (uint16_t) (insn - block->ops);
+    return halted;
+
+#undef ALU_HANDLERS
+#undef ALU_WRITEBACK
+#undef BRANCH
+#undef NEXT
+#undef DISPATCH
+#undef RELOAD_STATE
+#undef SYNC_STATE
+}
+
+#pragma GCC diagnostic pop
+
+#else
+
+/* Without computed goto, fall back to the reference switch core. */
+StopReason run_threaded(CPUState *state) {
+    StopReason reason;
+    while ((reason = execute_instruction(state)) == STOP_NONE) {
+        if (!is_interrupt_queue_empty(state->i_queue) && state->enable_mask_interrupts) {
+            service_pending_interrupt(state);
+        }
+        if (state->cycles >= state->clock.next_sync && (reason = clock_sync(state)) != STOP_NONE) {
+            break;
+        }
+    }
+    return reason;
+}
+
+/* Without computed goto, interpret the block one op at a time. */
+bool run_block_ops(CPUState *state, const BasicBlock *block, uint16_t *ops_run) {
+    uint32_t generation = state->block_cache->generation;
+    uint16_t i = 0;
+    while (i < block->op_count) {
+        if (block->ops[i].fusion != FUSION_NONE) {
+            execute_fused(state, &block->ops[i]);
+            i += 2;
+        } else if (execute_decoded(state, &block->ops[i++])) {
+            *ops_run = i;
+            return true;
+        }
+        if (state->block_cache->generation != generation) {
+            break;  // The block rewrote code; re-enter at the current PC.
+        }
+    }
+    *ops_run = i;
+    return false;
+}
+
+#endif
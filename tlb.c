@@ -0,0 +1,59 @@
+//
+// tlb.c
+// Software TLB miss handling and flushing (hit path in tlb.h).
+//
+
+#include "main.h"
+
+/**
+ * Translate 'address' through the page table and cache the result in 'set'
+ * together with the page's attributes from the memory map. Unmapped
+ * addresses, and fetches from pages without PAGE_ATTR_EXEC, are not cached,
+ * so the error is reported on every access.
+ */
+uint8_t* tlb_fill(CPUState *state, TlbEntry *set, uint32_t address,
+                  bool allocate_if_unallocated, uint8_t *attributes) {
+    const PageAttributes *page_attributes = lookup_page_attributes(&state->memory_config, address);
+    if (set == state->tlb.fetch && !(page_attributes->flags & PAGE_ATTR_EXEC)) {
+        fprintf(stderr, "Instruction fetch from non-executable page at 0x%08x\n", address);
+        *attributes = 0;
+        return NULL;
+    }
+    uint32_t page = address >> PAGE_SHIFT;
+    if (set == state->tlb.write && state->checkpoint) {
+        // First write to the page since the checkpoint or the last flush.
+        preserve_checkpoint_page(state, page);
+    }
+    uint8_t *ptr = translate_address(state, address, allocate_if_unallocated);
+    if (!ptr) {
+        *attributes = 0;
+        return NULL;
+    }
+    TlbEntry *entry = &set[page & (TLB_ENTRIES - 1)];
+    entry->tag = page + 1;
+    entry->attributes = page_attributes->flags;
+    entry->host_page = ptr - (address & (PAGE_SIZE - 1));
+    *attributes = entry->attributes;
+    return ptr;
+}
+
+/* Drop the cached translations of one page from every set. */
+void tlb_evict_page(CPUState *state, uint32_t page) {
+    uint32_t slot = page & (TLB_ENTRIES - 1);
+    TlbEntry *sets[] = { state->tlb.fetch, state->tlb.data, state->tlb.write };
+    for (size_t i = 0; i < sizeof(sets) / sizeof(sets[0]); i++) {
+        if (sets[i][slot].tag == page + 1) {
+            sets[i][slot].tag = 0;
+        }
+    }
+}
+
+/* Drop the cached write translations, so the next write to every page goes through tlb_fill(). */
+void tlb_flush_writes(CPUState *state) {
+    memset(state->tlb.write, 0, sizeof(state->tlb.write));
+}
+
+/* Drop every cached translation, e.g. after a new page table or memory configuration. */
+void tlb_flush(CPUState *state) {
+    memset(&state->tlb, 0, sizeof(SoftTlb));
+}
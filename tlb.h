@@ -0,0 +1,39 @@
+//
+// tlb.h
+// Software TLB: the hit path of guest address translation, inlined into the
+// memory accessors.
+//
+// Each set is direct-mapped on the low bits of the page index. A hit is a
+// tag compare and an add; a miss walks the page table in tlb_fill() and
+// caches the page's host address together with its attributes, which come
+// from the memory configuration. Only allocated pages are cached, and pages
+// only move when a write gives a shared page its own frame, which evicts the
+// page with tlb_evict_page(). Otherwise entries stay valid until tlb_flush()
+// is called for a new page table, memory configuration or reclaim pass.
+// Writes go through their own set, filled with allocation, so that a write
+// never reaches a shared frame. Taking a checkpoint empties just that set,
+// so the first write to each page afterwards is seen by tlb_fill().
+//
+
+#ifndef NEOCORE_TLB_H
+#define NEOCORE_TLB_H
+
+#include "main.h"
+
+/**
+ * Host pointer for 'address' through the TLB set 'set' (state->tlb.fetch,
+ * data or write), with the page's PAGE_ATTR_* bits in 'attributes'.
+ * Returns NULL, like get_memory_ptr(), for an unmapped address.
+ */
+static inline uint8_t* tlb_translate(CPUState *state, TlbEntry *set, uint32_t address,
+                                     bool allocate_if_unallocated, uint8_t *attributes) {
+    uint32_t page = address >> PAGE_SHIFT;
+    const TlbEntry *entry = &set[page & (TLB_ENTRIES - 1)];
+    if (__builtin_expect(entry->tag == page + 1, 1)) {
+        *attributes = entry->attributes;
+        return entry->host_page + (address & (PAGE_SIZE - 1));
+    }
+    return tlb_fill(state, set, address, allocate_if_unallocated, attributes);
+}
+
+#endif // NEOCORE_TLB_H
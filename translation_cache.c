@@ -0,0 +1,346 @@
+//
+// translation_cache.c
+// Persistent on-disk cache of decoded basic blocks for warm starts.
+//
+// After a run, the blocks decoded from the boot image are written to a cache
+// file next to the program, together with a map of instruction boundaries
+// and the chain links between blocks. The next time the same image (by hash)
+// is loaded the file is mapped and the block cache is seeded from it, so a
+// warm run starts with its hot paths already formed into blocks, chained and,
+// thanks to the saved execution counts, ready for the JIT. The file is not
+// trusted: every instruction is decoded again from the image, and a record
+// whose saved instructions disagree with the image is dropped.
+//
+// Only blocks lying entirely within boot image pages that were never written
+// are saved. Anything built from code modified or generated at runtime is
+// left for the next run to decode again.
+//
+// File layout (host byte order, tied to this build's DecodedInstruction):
+//   TranslationCacheHeader
+//   boundary map: one bit per image byte, set where an instruction starts
+//   block records: TranslationCacheRecord followed by op_count instructions
+//
+
+#include "main.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#define TRANSLATION_CACHE_MAGIC   0x4354434Eu  // "NCTC"
+#define TRANSLATION_CACHE_VERSION 3
+#define NO_SUCCESSOR              (-1)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t insn_size;         // sizeof(DecodedInstruction) of the writer
+    uint32_t load_address;
+    uint64_t image_hash;
+    uint32_t image_size;
+    uint32_t block_count;
+    uint64_t boundary_offset;
+    uint64_t blocks_offset;
+    uint64_t file_size;
+} TranslationCacheHeader;
+
+typedef struct {
+    uint32_t start_pc;
+    uint32_t end_pc;
+    uint64_t exec_count;
+    int32_t taken;              // Record index of the chained taken successor, or NO_SUCCESSOR
+    int32_t fallthrough;        // Record index of the chained fall-through successor
+    uint16_t op_count;
+    uint16_t reserved[3];
+    DecodedInstruction ops[];
+} TranslationCacheRecord;
+
+static inline size_t record_size(uint16_t op_count) {
+    return sizeof(TranslationCacheRecord) + op_count * sizeof(DecodedInstruction);
+}
+
+static inline size_t boundary_map_size(const BootImage *image) {
+    return ((size_t) image->size + 7) / 8;
+}
+
+static inline bool is_saved(const CPUState *state, const BasicBlock *block) {
+    return is_boot_image_range_clean(state, block->start_pc, block->end_pc);
+}
+
+static int compare_start_pc(const void *a, const void *b) {
+    const BasicBlock *block_a = *(const BasicBlock *const *) a;
+    const BasicBlock *block_b = *(const BasicBlock *const *) b;
+    if (block_a->start_pc == block_b->start_pc) return 0;
+    return block_a->start_pc < block_b->start_pc ? -1 : 1;
+}
+
+/* Record index of 'block' in 'saved' (sorted by start PC), or NO_SUCCESSOR if it is not saved. */
+static int32_t find_record(BasicBlock **saved, size_t count, const BasicBlock *block) {
+    if (!block) {
+        return NO_SUCCESSOR;
+    }
+    BasicBlock **match = bsearch(&block, saved, count, sizeof(BasicBlock *), compare_start_pc);
+    return (match && *match == block) ? (int32_t) (match - saved) : NO_SUCCESSOR;
+}
+
+/**
+ * Write the blocks decoded from the boot image to 'path'. The file is
+ * written under a temporary name and renamed into place so concurrent runs
+ * of the same image never see a partial file.
+ */
+bool save_translation_cache(CPUState *state, const char *path) {
+    const BootImage *image = &state->boot_image;
+    BlockCache *cache = state->block_cache;
+    if (!path || image->size == 0 || !cache || cache->block_count == 0) {
+        return false;
+    }
+
+    BasicBlock **saved = malloc(cache->block_count * sizeof(BasicBlock *));
+    uint8_t *boundaries = calloc(boundary_map_size(image), 1);
+    if (!saved || !boundaries) {
+        fprintf(stderr, "Memory allocation failed for translation cache.\n");
+        free(saved);
+        free(boundaries);
+        return false;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < BLOCK_CACHE_BUCKETS; i++) {
+        for (BasicBlock *block = cache->buckets[i]; block; block = block->hash_next) {
+            if (!is_saved(state, block)) {
+                continue;
+            }
+            saved[count++] = block;
+            uint32_t pc = block->start_pc;
+            for (uint16_t op = 0; op < block->op_count; op++) {
+                uint32_t offset = pc - image->load_address;
+                boundaries[offset >> 3] |= (uint8_t) (1u << (offset & 7));
+                pc += block->ops[op].length;
+            }
+        }
+    }
+    qsort(saved, count, sizeof(BasicBlock *), compare_start_pc);
+
+    TranslationCacheHeader header = {
+        .magic = TRANSLATION_CACHE_MAGIC,
+        .version = TRANSLATION_CACHE_VERSION,
+        .insn_size = sizeof(DecodedInstruction),
+        .load_address = image->load_address,
+        .image_hash = image->hash,
+        .image_size = image->size,
+        .block_count = (uint32_t) count,
+        .boundary_offset = sizeof(TranslationCacheHeader),
+    };
+    header.blocks_offset = (header.boundary_offset + boundary_map_size(image) + 7) & ~(uint64_t) 7;
+    header.file_size = header.blocks_offset;
+    for (size_t i = 0; i < count; i++) {
+        header.file_size += record_size(saved[i]->op_count);
+    }
+
+    size_t temp_length = strlen(path) + 16;
+    char *temp_path = malloc(temp_length);
+    FILE *file = NULL;
+    if (temp_path) {
+        snprintf(temp_path, temp_length, "%s.%d", path, (int) getpid());
+        file = fopen(temp_path, "wb");
+    }
+    if (!file) {
+        fprintf(stderr, "Could not write translation cache %s\n", path);
+        free(temp_path);
+        free(saved);
+        free(boundaries);
+        return false;
+    }
+
+    static const uint8_t padding[8] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(boundaries, boundary_map_size(image), 1, file) == 1;
+    size_t pad = header.blocks_offset - header.boundary_offset - boundary_map_size(image);
+    if (ok && pad > 0) {
+        ok = fwrite(padding, pad, 1, file) == 1;
+    }
+    for (size_t i = 0; ok && i < count; i++) {
+        const BasicBlock *block = saved[i];
+        TranslationCacheRecord record = {
+            .start_pc = block->start_pc,
+            .end_pc = block->end_pc,
+            .exec_count = block->exec_count,
+            .taken = find_record(saved, count, block->taken),
+            .fallthrough = find_record(saved, count, block->fallthrough),
+            .op_count = block->op_count,
+        };
+        ok = fwrite(&record, sizeof(record), 1, file) == 1 &&
+             fwrite(block->ops, sizeof(DecodedInstruction), block->op_count, file) == block->op_count;
+    }
+    ok = (fclose(file) == 0) && ok;
+    if (ok && rename(temp_path, path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Could not write translation cache %s\n", path);
+        unlink(temp_path);
+    } else {
+        printf("Saved %zu blocks to translation cache %s\n", count, path);
+    }
+
+    free(temp_path);
+    free(saved);
+    free(boundaries);
+    return ok;
+}
+
+/* True if every instruction in 'record' starts on a recorded boundary inside the image. */
+static bool is_record_consistent(const BootImage *image, const uint8_t *boundaries,
+                                 const TranslationCacheRecord *record) {
+    if (record->op_count == 0 || record->op_count > BLOCK_MAX_OPS) {
+        return false;
+    }
+    uint32_t pc = record->start_pc;
+    for (uint16_t op = 0; op < record->op_count; op++) {
+        uint32_t offset = pc - image->load_address;
+        if (pc < image->load_address || offset >= image->size ||
+            !((boundaries[offset >> 3] >> (offset & 7)) & 1)) {
+            return false;
+        }
+        pc += record->ops[op].length;
+    }
+    return pc == record->end_pc;
+}
+
+/**
+ * Decode the instructions of 'record' again from guest memory into 'ops'.
+ * Returns false if any of them no longer matches the saved opcode,
+ * specifier or length, i.e. the record was not written for this image.
+ */
+static bool decode_record(CPUState *state, const TranslationCacheRecord *record, DecodedInstruction *ops) {
+    uint32_t pc = record->start_pc;
+    for (uint16_t op = 0; op < record->op_count; op++) {
+        const DecodedInstruction *saved = &record->ops[op];
+        const DecodedInstruction *insn = fetch_decoded(state, pc);
+        if (!insn || insn->opcode != saved->opcode || insn->specifier != saved->specifier ||
+            insn->length != saved->length) {
+            return false;
+        }
+        ops[op] = *insn;
+        pc += insn->length;
+    }
+    return true;
+}
+
+/**
+ * Seed the block and decode caches from 'path' if it was written for the
+ * boot image that is currently loaded. Returns the number of blocks restored.
+ */
+size_t load_translation_cache(CPUState *state, const char *path) {
+    const BootImage *image = &state->boot_image;
+    if (!path || image->size == 0 || !state->block_cache) {
+        return 0;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 0;  // Cold start
+    }
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || (size_t) sb.st_size < sizeof(TranslationCacheHeader)) {
+        close(fd);
+        return 0;
+    }
+    size_t file_size = (size_t) sb.st_size;
+    uint8_t *data = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+
+    const TranslationCacheHeader *header = (const TranslationCacheHeader *) data;
+    if (header->magic != TRANSLATION_CACHE_MAGIC ||
+        header->version != TRANSLATION_CACHE_VERSION ||
+        header->insn_size != sizeof(DecodedInstruction) ||
+        header->file_size != file_size ||
+        header->image_hash != image->hash ||
+        header->image_size != image->size ||
+        header->load_address != image->load_address ||
+        header->boundary_offset + boundary_map_size(image) > header->blocks_offset ||
+        header->blocks_offset > file_size) {
+        printf("Translation cache %s is stale; ignoring it.\n", path);
+        munmap(data, file_size);
+        return 0;
+    }
+    if (header->block_count == 0) {
+        munmap(data, file_size);
+        return 0;
+    }
+
+    const uint8_t *boundaries = data + header->boundary_offset;
+    BasicBlock **restored = calloc(header->block_count, sizeof(BasicBlock *));
+    int32_t (*links)[2] = calloc(header->block_count, sizeof(*links));
+    if (!restored || !links) {
+        fprintf(stderr, "Memory allocation failed for translation cache.\n");
+        free(restored);
+        free(links);
+        munmap(data, file_size);
+        return 0;
+    }
+
+    DecodedInstruction ops[BLOCK_MAX_OPS];
+    size_t offset = header->blocks_offset;
+    size_t count = 0;
+    for (uint32_t i = 0; i < header->block_count; i++) {
+        const TranslationCacheRecord *record = (const TranslationCacheRecord *) (data + offset);
+        if (offset + sizeof(TranslationCacheRecord) > file_size ||
+            offset + record_size(record->op_count) > file_size) {
+            break;  // Truncated; keep what was restored so far
+        }
+        offset += record_size(record->op_count);
+        links[i][0] = record->taken;
+        links[i][1] = record->fallthrough;
+        if (!is_record_consistent(image, boundaries, record) ||
+            !is_boot_image_range_clean(state, record->start_pc, record->end_pc) ||
+            find_block(state->block_cache, record->start_pc) ||
+            !decode_record(state, record, ops)) {
+            continue;
+        }
+
+        BasicBlock *block = install_block(state, record->start_pc, ops, record->op_count);
+        block->exec_count = record->exec_count;
+        restored[i] = block;
+        count++;
+    }
+
+    // Re-chain restored blocks whose exits still lead where they did when saved.
+    for (uint32_t i = 0; i < header->block_count; i++) {
+        BasicBlock *block = restored[i];
+        if (!block) {
+            continue;
+        }
+        int32_t taken = links[i][0];
+        int32_t fallthrough = links[i][1];
+        if (taken >= 0 && (uint32_t) taken < header->block_count && restored[taken] &&
+            block->has_taken_exit && restored[taken]->start_pc == block->taken_pc) {
+            chain_block(block, true, restored[taken]);
+        }
+        if (fallthrough >= 0 && (uint32_t) fallthrough < header->block_count && restored[fallthrough] &&
+            restored[fallthrough]->start_pc == block->end_pc) {
+            chain_block(block, false, restored[fallthrough]);
+        }
+    }
+
+    free(restored);
+    free(links);
+    munmap(data, file_size);
+    if (count > 0) {
+        printf("Restored %zu blocks from translation cache %s\n", count, path);
+    }
+    return count;
+}
+
+/* Cache file used for 'program_file': the program path with TRANSLATION_CACHE_SUFFIX appended. */
+char* translation_cache_path(const char *program_file) {
+    if (!program_file) {
+        return NULL;
+    }
+    size_t length = strlen(program_file) + strlen(TRANSLATION_CACHE_SUFFIX) + 1;
+    char *path = malloc(length);
+    if (path) {
+        snprintf(path, length, "%s%s", program_file, TRANSLATION_CACHE_SUFFIX);
+    }
+    return path;
+}
@@ -16,6 +16,7 @@
         extern int posix_openpt(int flags);
         extern int grantpt(int fd);
         extern int unlockpt(int fd);
+        extern char *ptsname(int fd);
     #endif
 #endif
 
@@ -35,9 +36,6 @@
 /* Configuration                                                               */
 /* -------------------------------------------------------------------------- */
 
-#define UART_IRQ_RX            0
-#define UART_IRQ_TX            1
-
 #define IDLE_SLEEP_US          1000      /* 1 ms when line is idle           */
 #define EIO_SLEEP_MS           250       /* 250 ms when slave not yet open   */
 
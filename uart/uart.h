@@ -16,6 +16,9 @@
 // UART Definitions
 // ----------------------------
 
+#define UART_IRQ_RX            0    // Raised for every byte received
+#define UART_IRQ_TX            1    // Raised when a byte has been transmitted
+
 // UART configuration structure.
 typedef struct {
     uint32_t baud_rate;
@@ -29,7 +32,7 @@ typedef struct UART {
     // Simulated registers for status, transmit, and receive.
     uint32_t status_reg;
     uint8_t tx_reg;
-    uint8_t rx_reg;
+    uint8_t rx_reg;             // Last byte received, latched as UART_IRQ_RX is serviced
 
     // Mutexes for protecting TX and RX buffers and registers.
     pthread_mutex_t tx_mutex;
@@ -4,12 +4,14 @@
 #include <sys/fcntl.h>
 #include <sys/stat.h>
 
-static uint8_t get_instruction_length(uint8_t opcode, uint8_t specifier) {
+uint8_t get_instruction_length(uint8_t opcode, uint8_t specifier) {
     switch (opcode) {
         case OP_NOP:
         case OP_HLT:
         case OP_RTS:
         case OP_WFI:
+        case OP_ENI:
+        case OP_DSI:
             return 2;
         case OP_PSH:
         case OP_POP:
@@ -50,15 +52,16 @@ static uint8_t get_instruction_length(uint8_t opcode, uint8_t specifier) {
                 case 0x0B:
                 case 0x0C:
                 case 0x0D: return 8;
-                case 0x0E: return 9;
+                case 0x0E: return MAX_INSTRUCTION_LENGTH;
                 case 0x0F:
                 case 0x10:
                 case 0x11: return 8;
-                case 0x12: return 9;
+                case 0x12: return MAX_INSTRUCTION_LENGTH;
                 default: return 1;
             }
 
         case OP_B:
+        case OP_BRO:
         case OP_JSR:
             return 6;
 
@@ -77,129 +80,6 @@ void increment_pc(CPUState *state, uint8_t opcode, uint8_t specifier) {
     *(state->pc) += get_instruction_length(opcode, specifier);
 }
 
-void handle_operation(
-    CPUState *state,
-    uint8_t operand_rd,
-    uint8_t operand_rn,
-    uint16_t immediate,
-    uint32_t operand2,
-    uint8_t mode,
-    uint32_t (*operation)(uint16_t, uint32_t)
-) {
-    uint32_t result = 0;
-
-    // Determine result based on mode using a switch-case.
-    switch (mode) {
-        case 0:
-            // Mode 0: Use operand_rd and immediate operand2.
-            result = operation(state->reg[operand_rd], immediate);
-            break;
-        case 1:
-            // Mode 1: Use operand_rn, second operand as zero.
-            result = operation(state->reg[operand_rn], state->reg[operand_rd]);
-            break;
-        case 2:
-            // Mode 2: Use operand_rd and operand_rn.
-            result = operation(state->reg[operand_rd], get_memory(state, operand2));
-            break;
-        default:
-            printf("Unsupported mode: %d\n", mode);
-            return;
-    }
-
-    // Update flags based on the result.
-    state->v_flag = result > UINT16_MAX;
-    state->z_flag = (result == 0);
-
-    // Store the result or handle overflow based on mode.
-    switch (mode) {
-        case 0:
-        case 1:
-        case 2:
-            // For modes 0, 1, and 2, store to register.
-            state->reg[operand_rd] = (uint16_t) result;
-            break;
-        default:
-            // Already handled unsupported modes above.
-            break;
-    }
-}
-
-uint32_t add_operation(uint16_t operand1, uint32_t operand2) {
-    return (uint32_t) operand1 + operand2;
-}
-
-uint32_t subtract_operation(uint16_t operand1, uint32_t operand2) {
-    int64_t result = (int64_t) operand1 - (int64_t) operand2;
-    if (result < 0) {
-        return 0;
-    }
-    return (uint32_t) result;
-}
-
-uint32_t multiply_operation(uint16_t operand1, uint32_t operand2) {
-    return (uint32_t) operand1 * operand2;
-}
-
-uint32_t left_shift_operation(uint16_t operand1, uint32_t operand2) {
-    return ((uint32_t) operand1 << operand2) & 0xFFFFFFFF;
-}
-
-uint32_t right_shift_operation(uint16_t operand1, uint32_t operand2) {
-    return ((uint32_t) operand1 >> operand2) & 0xFFFFFFFF;
-}
-
-uint32_t and_operation(uint16_t operand1, uint32_t operand2) {
-    return (uint32_t) operand1 & operand2;
-}
-
-uint32_t or_operation(uint16_t operand1, uint32_t operand2) {
-    return (uint32_t) operand1 | operand2;
-}
-
-uint32_t xor_operation(uint16_t operand1, uint32_t operand2) {
-    return (uint32_t) operand1 ^ operand2;
-}
-
-void add(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2, uint8_t mode) {
-    handle_operation(state, operand_rd, operand_rn, immediate, operand2, mode, add_operation);
-}
-
-void subtract(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2,
-              uint8_t mode) {
-    handle_operation(state, operand_rd, operand_rn, immediate, operand2, mode, subtract_operation);
-}
-
-void multiply(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2,
-              uint8_t mode) {
-    handle_operation(state, operand_rd, operand_rn, immediate, operand2, mode, multiply_operation);
-}
-
-void left_shift(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2,
-                uint8_t mode) {
-    handle_operation(state, operand_rd, operand_rn, immediate, operand2, mode, left_shift_operation);
-}
-
-void right_shift(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2,
-                 uint8_t mode) {
-    handle_operation(state, operand_rd, operand_rn, immediate, operand2, mode, right_shift_operation);
-}
-
-void bitwise_and(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2,
-                 uint8_t mode) {
-    handle_operation(state, operand_rd, operand_rn, immediate, operand2, mode, and_operation);
-}
-
-void bitwise_or(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2,
-                uint8_t mode) {
-    handle_operation(state, operand_rd, operand_rn, immediate, operand2, mode, or_operation);
-}
-
-void bitwise_xor(CPUState *state, uint8_t operand_rd, uint8_t operand_rn, uint16_t immediate, uint32_t operand2,
-                 uint8_t mode) {
-    handle_operation(state, operand_rd, operand_rn, immediate, operand2, mode, xor_operation);
-}
-
 // Unsigned Multiply Long Long (UMULL)
 void umull(uint16_t *rd, uint16_t *rn1, const uint16_t *rn) {
     uint32_t result = (uint32_t)(*rd) * (uint32_t)(*rn);  // Perform 16x16 unsigned multiplication
@@ -215,105 +95,6 @@ void smull(uint16_t *rd, uint16_t *rn1, const uint16_t *rn) {
 }
 
 
-// Helper: Find the STACK memory section in the MemoryConfig.
-// Returns a pointer to the STACK MemorySection or NULL if not found.
-static MemorySection* find_stack_section(const MemoryConfig *config) {
-    for (size_t i = 0; i < config->section_count; i++) {
-        if (config->sections[i].type == STACK) {
-            return (MemorySection *)&config->sections[i];
-        }
-    }
-    return NULL;
-}
-
-/**
- * Push a single byte onto the stack.
- * The first 4 bytes of the stack section hold the current stack pointer.
- * The stack grows upward (i.e. increasing offset from the start of the data area).
- */
-void pushStack(CPUState *state, uint8_t value) {
-    MemorySection *stack_section = find_stack_section(&state->memory_config);
-    if (!stack_section) {
-        fprintf(stderr, "Error: Stack section not found in configuration.\n");
-        exit(EXIT_FAILURE);
-    }
-    // The base address for the stack section in emulator memory.
-    uint32_t base_addr = stack_section->start_address;
-    // The first 4 bytes store the current stack pointer.
-    uint8_t *sp_mem = get_memory_ptr(state, base_addr, true);
-    if (!sp_mem) {
-        fprintf(stderr, "Error: Unable to access stack pointer memory.\n");
-        exit(EXIT_FAILURE);
-    }
-    uint32_t *sp_ptr = (uint32_t *)sp_mem;
-    uint32_t sp = *sp_ptr; // current offset in the data area (in bytes)
-
-    // Determine the maximum available bytes for stack data.
-    // (Total section size minus 4 bytes reserved for the stack pointer)
-    uint32_t total_section_bytes = stack_section->page_count * PAGE_SIZE;
-    uint32_t max_stack_bytes = total_section_bytes - 4;
-    if (sp >= max_stack_bytes) {
-        fprintf(stderr, "Stack overflow: cannot push more data.\n");
-        exit(EXIT_FAILURE);
-    }
-
-    // Calculate where to store the value:
-    // (Base address + 4 bytes for pointer + current SP offset)
-    uint32_t push_addr = base_addr + 4 + sp;
-    uint8_t *dest = get_memory_ptr(state, push_addr, true);
-    if (!dest) {
-        fprintf(stderr, "Error: Unable to access memory for push operation.\n");
-        exit(EXIT_FAILURE);
-    }
-    *dest = value;
-
-    // Increment and update the stack pointer.
-    sp++;
-    *sp_ptr = sp;
-}
-
-/**
- * Pop a single byte from the stack.
- *
- * @param state Pointer to the CPU state.
- * @param out Pointer to a byte where the popped value will be stored.
- * @return 1 if a byte was successfully popped, or 0 if the stack was empty.
- */
-uint8_t popStack(CPUState *state, uint8_t *out) {
-    MemorySection *stack_section = find_stack_section(&state->memory_config);
-    if (!stack_section) {
-        fprintf(stderr, "Error: Stack section not found in configuration.\n");
-        exit(EXIT_FAILURE);
-    }
-    uint32_t base_addr = stack_section->start_address;
-    uint8_t *sp_mem = get_memory_ptr(state, base_addr, false);
-    if (!sp_mem) {
-        fprintf(stderr, "Error: Unable to access stack pointer memory.\n");
-        return 0;
-    }
-    uint32_t *sp_ptr = (uint32_t *)sp_mem;
-    uint32_t sp = *sp_ptr; // current offset (number of bytes on stack)
-
-    if (sp == 0) {
-        fprintf(stderr, "Stack underflow: no data to pop.\n");
-        return 0;
-    }
-
-    // Decrement the stack pointer to point to the top-most data
-    sp--;
-    uint32_t pop_addr = base_addr + 4 + sp;
-    uint8_t *src = get_memory_ptr(state, pop_addr, false);
-    if (!src) {
-        fprintf(stderr, "Error: Unable to access memory for pop operation.\n");
-        return 0;
-    }
-    *out = *src;
-
-    // Update the stored stack pointer.
-    *sp_ptr = sp;
-    return 1;
-}
-
 uint8_t count_leading_zeros(uint8_t x) {
     if (x == 0) return 8;
     uint8_t n = 0;
@@ -329,35 +110,58 @@ uint8_t count_leading_zeros(uint8_t x) {
     return n;
 }
 
-size_t load_program(const char *filename, uint8_t **buffer) {
+/**
+ * Map 'filename' copy-on-write instead of reading it: nothing is read until
+ * a page is used. The descriptor stays open so initialize_page_table() can
+ * map the file straight into the boot sector. Returns false, leaving
+ * 'image' empty, if the file cannot be opened or mapped; an empty file is
+ * an empty image.
+ */
+bool load_program(const char *filename, ProgramImage *image) {
+    *image = (ProgramImage) { .data = NULL, .size = 0, .fd = -1 };
     int fd = open(filename, O_RDONLY);
     if (fd == -1) {
-        *buffer = NULL;
-        return 0;
+        return false;
     }
 
     struct stat sb;
     if (fstat(fd, &sb) == -1) {
         close(fd);
-        *buffer = NULL;
-        return 0;
+        return false;
     }
-
-    size_t size = sb.st_size;
-    *buffer = (uint8_t *) malloc(size);
-    if (!*buffer) {
+    if (sb.st_size == 0) {
         close(fd);
-        return 0;
+        return true;
     }
 
-    ssize_t bytes_read = read(fd, *buffer, size);
-    close(fd);
+    void *data = mmap(NULL, (size_t) sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    image->data = data;
+    image->size = (size_t) sb.st_size;
+    image->fd = fd;
+    return true;
+}
 
-    if ((size_t) bytes_read != size) {
-        free(*buffer);
-        *buffer = NULL;
-        return 0;
+/* Release what load_program() returned; pages mapped into a page table stay valid. */
+void unload_program(ProgramImage *image) {
+    if (image->data) {
+        munmap((void *) image->data, image->size);
+    }
+    if (image->fd != -1) {
+        close(image->fd);
     }
+    *image = (ProgramImage) { .data = NULL, .size = 0, .fd = -1 };
+}
 
-    return size;
+/* 64-bit FNV-1a hash, used to recognise a boot image across runs. */
+uint64_t hash_bytes(const uint8_t *data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
 }